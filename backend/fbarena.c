@@ -0,0 +1,171 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+#include <glib/gprintf.h>
+
+#include <stdarg.h>
+#include <string.h>
+
+#include "fbarena.h"
+
+#define ARENA_ALIGN     (2 * sizeof (gpointer))
+
+typedef struct _FbArenaChunk FbArenaChunk;
+
+struct _FbArenaChunk {
+    FbArenaChunk *next;
+    gsize         size;
+    gsize         used;
+    /* The data follows the header which is aligned by ARENA_ALIGN. */
+};
+
+struct _FbArena {
+    FbArenaChunk *chunks;
+    gsize         total_size;
+};
+
+#define CHUNK_HEADER_SIZE \
+        ((sizeof (FbArenaChunk) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+#define CHUNK_DATA(chunk) ((guint8 *)(chunk) + CHUNK_HEADER_SIZE)
+
+static FbArenaChunk *
+fb_arena_chunk_new (gsize size)
+{
+    FbArenaChunk *chunk = g_malloc (CHUNK_HEADER_SIZE + size);
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+    return chunk;
+}
+
+FbArena *
+fb_arena_new (gsize chunk_size)
+{
+    FbArena *arena = g_slice_new0 (FbArena);
+
+    arena->total_size = MAX (chunk_size, 256);
+    arena->chunks = fb_arena_chunk_new (arena->total_size);
+    return arena;
+}
+
+void
+fb_arena_free (FbArena *arena)
+{
+    FbArenaChunk *chunk;
+
+    g_return_if_fail (arena != NULL);
+
+    while ((chunk = arena->chunks) != NULL) {
+        arena->chunks = chunk->next;
+        g_free (chunk);
+    }
+    g_slice_free (FbArena, arena);
+}
+
+gpointer
+fb_arena_alloc (FbArena *arena,
+                gsize    size)
+{
+    FbArenaChunk *chunk;
+    gpointer mem;
+
+    g_return_val_if_fail (arena != NULL, NULL);
+
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    chunk = arena->chunks;
+    if (chunk->used + size > chunk->size) {
+        gsize chunk_size = MAX (chunk->size * 2, size);
+
+        chunk = fb_arena_chunk_new (chunk_size);
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->total_size += chunk_size;
+    }
+
+    mem = CHUNK_DATA (chunk) + chunk->used;
+    chunk->used += size;
+    return mem;
+}
+
+gchar *
+fb_arena_strdup (FbArena     *arena,
+                 const gchar *str)
+{
+    gsize length;
+    gchar *retval;
+
+    if (str == NULL)
+        return NULL;
+
+    length = strlen (str) + 1;
+    retval = fb_arena_alloc (arena, length);
+    memcpy (retval, str, length);
+    return retval;
+}
+
+gchar *
+fb_arena_strdup_printf (FbArena     *arena,
+                        const gchar *format,
+                        ...)
+{
+    va_list args;
+    gint length;
+    gchar *retval;
+
+    va_start (args, format);
+    length = g_vsnprintf (NULL, 0, format, args);
+    va_end (args);
+
+    retval = fb_arena_alloc (arena, length + 1);
+    va_start (args, format);
+    g_vsnprintf (retval, length + 1, format, args);
+    va_end (args);
+    return retval;
+}
+
+void
+fb_arena_reset (FbArena *arena)
+{
+    FbArenaChunk *chunk;
+
+    g_return_if_fail (arena != NULL);
+
+    if (arena->chunks->next == NULL) {
+        arena->chunks->used = 0;
+        return;
+    }
+
+    while ((chunk = arena->chunks) != NULL) {
+        arena->chunks = chunk->next;
+        g_free (chunk);
+    }
+    arena->chunks = fb_arena_chunk_new (arena->total_size);
+}
+
+gsize
+fb_arena_get_size (FbArena *arena)
+{
+    g_return_val_if_fail (arena != NULL, 0);
+
+    return arena->total_size;
+}
@@ -0,0 +1,76 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_ARENA_H_
+#define __FB_ARENA_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+typedef struct _FbArena FbArena;
+
+/**
+ * fb_arena_new:
+ * @chunk_size: The size of the first chunk.
+ *
+ * Creates a bump allocator for the short-lived strings.  The memory is
+ * released at once with fb_arena_reset() and the chunks are reused.
+ *
+ * Returns: A newly allocated #FbArena
+ */
+FbArena         *fb_arena_new                      (gsize        chunk_size);
+void             fb_arena_free                     (FbArena     *arena);
+
+/**
+ * fb_arena_alloc:
+ * @arena: A #FbArena
+ * @size: The size in bytes.
+ *
+ * Returns: (transfer none): The memory aligned for any types which is
+ *          valid until fb_arena_reset() is called.
+ */
+gpointer         fb_arena_alloc                    (FbArena     *arena,
+                                                    gsize        size);
+gchar           *fb_arena_strdup                   (FbArena     *arena,
+                                                    const gchar *str);
+gchar           *fb_arena_strdup_printf            (FbArena     *arena,
+                                                    const gchar *format,
+                                                    ...) G_GNUC_PRINTF (2, 3);
+
+/**
+ * fb_arena_reset:
+ * @arena: A #FbArena
+ *
+ * Releases all the allocated memory.  The chunks are merged into one
+ * chunk of the total size so that the same workload does not call
+ * malloc() again.
+ */
+void             fb_arena_reset                    (FbArena     *arena);
+
+/**
+ * fb_arena_get_size:
+ * @arena: A #FbArena
+ *
+ * Returns: The bytes of all the chunks.
+ */
+gsize            fb_arena_get_size                 (FbArena     *arena);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,201 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* The startup cache is a GVariant file which is memory-mapped:
+ *   u   cache version
+ *   x   IBus registry time stamp
+ *   as  requested engine names
+ *   av  serialized IBus.EngineDesc
+ *   au  console keymap
+ */
+class FbCache : GLib.Object {
+    private const uint32 VERSION = 1;
+    private const string VARIANT_TYPE = "(uxasavau)";
+    private const string FILENAME = "startup.cache";
+
+    private static FbCache? m_default;
+
+    private string m_path;
+    private GLib.MappedFile? m_mapped_file;
+    private GLib.Variant? m_variant;
+    private int64 m_registry_stamp;
+    private string[] m_names = {};
+    private IBus.EngineDesc[]? m_engines;
+    private uint32[] m_keymap = {};
+
+    private FbCache() {
+        m_path = GLib.Path.build_filename(GLib.Environment.get_user_cache_dir(),
+                                          "ibus-fbterm",
+                                          FILENAME);
+        m_registry_stamp = get_registry_stamp();
+        load();
+    }
+
+    public static FbCache get_default() {
+        if (m_default == null)
+            m_default = new FbCache();
+        return m_default;
+    }
+
+    /* ibus-daemon rewrites the registry cache when the component files
+     * are changed so the mtime is enough to know the engines are updated.
+     */
+    private static int64 get_registry_stamp() {
+        string[] paths = {
+            GLib.Path.build_filename(GLib.Environment.get_user_cache_dir(),
+                                     "ibus", "bus", "registry"),
+            "/var/cache/ibus/bus/registry",
+        };
+        int64 stamp = 0;
+        foreach (var path in paths) {
+            Posix.Stat buf;
+            if (Posix.stat(path, out buf) != 0)
+                continue;
+            if ((int64)buf.st_mtime > stamp)
+                stamp = (int64)buf.st_mtime;
+        }
+        return stamp;
+    }
+
+    private void load() {
+        try {
+            m_mapped_file = new GLib.MappedFile(m_path, false);
+        } catch (GLib.FileError e) {
+            if (!(e is GLib.FileError.NOENT))
+                warning("Failed to map %s: %s", m_path, e.message);
+            return;
+        }
+
+        /* untrusted data is validated while it's accessed. */
+        m_variant = new GLib.Variant.from_bytes(
+                new GLib.VariantType(VARIANT_TYPE),
+                m_mapped_file.get_bytes(),
+                false);
+        if (m_variant.get_child_value(0).get_uint32() != VERSION) {
+            m_variant = null;
+            return;
+        }
+
+        var keymap = m_variant.get_child_value(4);
+        for (size_t i = 0; i < keymap.n_children(); i++)
+            m_keymap += keymap.get_child_value(i).get_uint32();
+
+        if (m_variant.get_child_value(1).get_int64() != m_registry_stamp)
+            return;
+        m_names = m_variant.get_child_value(2).dup_strv();
+    }
+
+    private void save() {
+        var engines = new GLib.VariantBuilder(new GLib.VariantType("av"));
+        if (m_engines != null) {
+            foreach (var engine in m_engines)
+                engines.add_value(new GLib.Variant.variant(engine.serialize()));
+        }
+        var keymap = new GLib.VariantBuilder(new GLib.VariantType("au"));
+        foreach (var keysym in m_keymap)
+            keymap.add_value(new GLib.Variant.uint32(keysym));
+
+        var variant = new GLib.Variant.tuple({
+                new GLib.Variant.uint32(VERSION),
+                new GLib.Variant.int64(m_registry_stamp),
+                new GLib.Variant.strv(m_names),
+                engines.end(),
+                keymap.end()
+        });
+        try {
+            GLib.DirUtils.create_with_parents(
+                    GLib.Path.get_dirname(m_path), 0700);
+            GLib.FileUtils.set_data(m_path,
+                                    variant.get_data_as_bytes().get_data());
+        } catch (GLib.FileError e) {
+            warning("Failed to save %s: %s", m_path, e.message);
+        }
+    }
+
+    /**
+     * lookup_engines:
+     * @names: The engine names of preload-engines in the order.
+     *
+     * Returns the cached engines if the IBus registry and @names are not
+     * changed, %null otherwise.
+     */
+    public IBus.EngineDesc[]? lookup_engines(string[] names) {
+        if (m_engines != null && names_equal(names))
+            return m_engines;
+        if (m_variant == null || !names_equal(names))
+            return null;
+
+        IBus.EngineDesc[] engines = {};
+        var array = m_variant.get_child_value(3);
+        for (size_t i = 0; i < array.n_children(); i++) {
+            var child = array.get_child_value(i).get_variant();
+            var engine = IBus.Serializable.deserialize(child)
+                    as IBus.EngineDesc;
+            if (engine == null)
+                return null;
+            engines += engine;
+        }
+        if (engines.length == 0)
+            return null;
+        m_engines = engines;
+        return m_engines;
+    }
+
+    public void store_engines(string[]          names,
+                              IBus.EngineDesc[] engines) {
+        m_names = names;
+        m_engines = engines;
+        save();
+    }
+
+    public uint32[]? lookup_keymap() {
+        if (m_keymap.length == 0)
+            return null;
+        return m_keymap;
+    }
+
+    public void store_keymap(uint32[] keymap) {
+        m_keymap = keymap;
+        save();
+    }
+
+    public void invalidate_keymap() {
+        m_keymap = {};
+    }
+
+    private bool names_equal(string[] names) {
+        if (names.length != m_names.length)
+            return false;
+        for (int i = 0; i < names.length; i++) {
+            if (names[i] != m_names[i])
+                return false;
+        }
+        return true;
+    }
+}
+
+/* Called by fbshell.c */
+public uint32[]? fb_cache_lookup_keymap() {
+    return FbCache.get_default().lookup_keymap();
+}
+
+public void fb_cache_store_keymap(uint32[] keymap) {
+    FbCache.get_default().store_keymap(keymap);
+}
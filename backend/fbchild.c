@@ -0,0 +1,185 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "fbchild.h"
+
+/* The time to wait for the exit after SIGTERM in milliseconds */
+#define KILL_TIMEOUT    500
+/* The interval of waitpid() without the pidfd in milliseconds */
+#define POLL_INTERVAL   100
+
+typedef struct {
+    int   pid;
+    int   pidfd;
+    guint watch_id;
+    guint timeout_id;
+    guint poll_id;
+} FbChild;
+
+static GSList *pending_children;
+
+static int
+fb_child_pidfd_open (int pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall (SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void
+fb_child_send_signal (FbChild *child,
+                      int      signo)
+{
+#ifdef SYS_pidfd_send_signal
+    /* The pidfd never refers to another process even if the pid is
+     * reused after the child is reaped in the SIGCHLD handler.
+     */
+    if (child->pidfd >= 0 &&
+        syscall (SYS_pidfd_send_signal, child->pidfd, signo, NULL, 0) == 0)
+        return;
+    if (child->pidfd >= 0 && errno != ENOSYS)
+        return;
+#endif
+    kill (child->pid, signo);
+}
+
+/* Returns TRUE if the child is reaped here or by the SIGCHLD handler. */
+static gboolean
+fb_child_reap (FbChild *child)
+{
+    int retval = waitpid (child->pid, 0, WNOHANG);
+
+    return retval > 0 || (retval == -1 && errno == ECHILD);
+}
+
+static void
+fb_child_free (FbChild *child)
+{
+    pending_children = g_slist_remove (pending_children, child);
+
+    if (child->watch_id)
+        g_source_remove (child->watch_id);
+    if (child->timeout_id)
+        g_source_remove (child->timeout_id);
+    if (child->poll_id)
+        g_source_remove (child->poll_id);
+    if (child->pidfd >= 0)
+        close (child->pidfd);
+    g_slice_free (FbChild, child);
+}
+
+static gboolean
+fb_child_exited_cb (gint          fd,
+                    GIOCondition  condition,
+                    gpointer      user_data)
+{
+    FbChild *child = user_data;
+
+    fb_child_reap (child);
+    child->watch_id = 0;
+    fb_child_free (child);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+fb_child_poll_cb (gpointer user_data)
+{
+    FbChild *child = user_data;
+
+    if (!fb_child_reap (child))
+        return G_SOURCE_CONTINUE;
+
+    child->poll_id = 0;
+    fb_child_free (child);
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean
+fb_child_timeout_cb (gpointer user_data)
+{
+    FbChild *child = user_data;
+
+    child->timeout_id = 0;
+    /* The pidfd or the polling keeps watching the child until
+     * SIGKILL is delivered.
+     */
+    fb_child_send_signal (child, SIGKILL);
+    return G_SOURCE_REMOVE;
+}
+
+void
+fb_child_terminate (int pid)
+{
+    FbChild *child;
+
+    /* The shell resets the reaped pid, which can be reused. */
+    if (pid <= 0)
+        return;
+
+    child = g_slice_new0 (FbChild);
+    child->pid = pid;
+    /* Open the pidfd before the child can be reaped. */
+    child->pidfd = fb_child_pidfd_open (pid);
+
+    if (fb_child_reap (child)) {
+        fb_child_free (child);
+        return;
+    }
+
+    fb_child_send_signal (child, SIGTERM);
+
+    if (child->pidfd >= 0) {
+        child->watch_id = g_unix_fd_add (child->pidfd, G_IO_IN,
+                                         fb_child_exited_cb, child);
+    } else {
+        child->poll_id = g_timeout_add (POLL_INTERVAL,
+                                        fb_child_poll_cb, child);
+    }
+    child->timeout_id = g_timeout_add (KILL_TIMEOUT,
+                                       fb_child_timeout_cb, child);
+    pending_children = g_slist_prepend (pending_children, child);
+}
+
+void
+fb_child_kill_pending (void)
+{
+    while (pending_children) {
+        FbChild *child = pending_children->data;
+
+        if (!fb_child_reap (child)) {
+            fb_child_send_signal (child, SIGKILL);
+            waitpid (child->pid, 0, 0);
+        }
+        fb_child_free (child);
+    }
+}
@@ -0,0 +1,49 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_CHILD_H_
+#define __FB_CHILD_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * fb_child_terminate:
+ * @pid: The process ID of the child.
+ *
+ * Sends SIGTERM to @pid and returns without waiting for the exit.
+ * The child is watched with the pidfd in the main loop and SIGKILL is
+ * sent if the child does not exit in time.  Nothing is done if @pid
+ * is not positive.
+ */
+void             fb_child_terminate                (int          pid);
+
+/**
+ * fb_child_kill_pending:
+ *
+ * Kills and reaps the children which are still watched by
+ * fb_child_terminate().  This is called after the shells are
+ * destroyed.
+ */
+void             fb_child_kill_pending             (void);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,757 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <ibus.h>
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fbcompose.h"
+
+#define COMPOSE_CACHE_MAGIC     0x54434246 /* "FBCT" */
+#define COMPOSE_CACHE_VERSION   2
+#define MAX_SEQUENCE_LENGTH     8
+#define MAX_INCLUDE_DEPTH       5
+#define X11_LOCALE_DIR          "/usr/share/X11/locale"
+
+/* The cache file is the header, the mtimes of the parsed files, the
+ * nodes, the result strings and the paths of the parsed files.
+ * The node 0 is the root and the children of a node are stored
+ * continuously in the keyval order so that they can be searched
+ * with bsearch() on the mapped file directly.  The cache is valid
+ * while all the files including the included files have the same
+ * mtimes.
+ */
+typedef struct {
+    guint32 magic;
+    guint32 version;
+    guint32 n_files;
+    guint32 paths_length;
+    guint32 n_nodes;
+    guint32 strings_length;
+} FbComposeHeader;
+
+/* A parsed file and its mtime or -1 if it does not exist */
+typedef struct {
+    gchar  *path;
+    gint64  mtime;
+} FbComposeFile;
+
+typedef struct {
+    guint32 keyval;
+    guint32 children;
+    guint32 n_children;
+    /* The offset + 1 in the strings, 0 if no result */
+    guint32 result;
+} FbComposeNode;
+
+typedef struct _BuildNode BuildNode;
+
+struct _BuildNode {
+    guint32    keyval;
+    gchar     *result;
+    GPtrArray *children;
+};
+
+struct _FbCompose {
+    GMappedFile         *mapped_file;
+    GBytes              *data;
+    const FbComposeNode *nodes;
+    guint32              n_nodes;
+    const gchar         *strings;
+    guint32              current;
+};
+
+static void         fb_compose_parse_file    (BuildNode   *root,
+                                              GArray      *files,
+                                              const gchar *path,
+                                              int          depth);
+
+static BuildNode *
+build_node_new (guint32 keyval)
+{
+    BuildNode *node = g_slice_new0 (BuildNode);
+    node->keyval = keyval;
+    return node;
+}
+
+static void
+build_node_free (BuildNode *node)
+{
+    if (node->children)
+        g_ptr_array_free (node->children, TRUE);
+    g_free (node->result);
+    g_slice_free (BuildNode, node);
+}
+
+static int
+build_node_compare (gconstpointer a,
+                    gconstpointer b)
+{
+    const BuildNode *node_a = *(const BuildNode **)a;
+    const BuildNode *node_b = *(const BuildNode **)b;
+
+    if (node_a->keyval < node_b->keyval)
+        return -1;
+    return node_a->keyval > node_b->keyval;
+}
+
+static int
+fb_compose_node_compare (gconstpointer key,
+                         gconstpointer element)
+{
+    guint32 keyval = *(const guint32 *)key;
+    const FbComposeNode *node = element;
+
+    if (keyval < node->keyval)
+        return -1;
+    return keyval > node->keyval;
+}
+
+/* compose.dir uses the normalized code set names likes "en_US.UTF-8". */
+static gchar *
+fb_compose_get_locale_name (void)
+{
+    const gchar *locale = setlocale (LC_CTYPE, NULL);
+    const gchar *dot;
+    const gchar *at;
+    gchar *codeset;
+    gchar *name;
+
+    if (locale == NULL ||
+        g_strcmp0 (locale, "C") == 0 || g_strcmp0 (locale, "POSIX") == 0)
+        return g_strdup ("en_US.UTF-8");
+
+    if ((dot = strchr (locale, '.')) == NULL)
+        return g_strdup (locale);
+
+    at = strchr (dot, '@');
+    codeset = g_strndup (dot + 1, at ? at - dot - 1 : strlen (dot + 1));
+    if (g_ascii_strcasecmp (codeset, "utf8") == 0 ||
+        g_ascii_strcasecmp (codeset, "utf-8") == 0) {
+        g_free (codeset);
+        codeset = g_strdup ("UTF-8");
+    }
+    name = g_strdup_printf ("%.*s.%s%s",
+                            (int)(dot - locale), locale,
+                            codeset,
+                            at ? at : "");
+    g_free (codeset);
+    return name;
+}
+
+static gchar *
+fb_compose_get_locale_file (void)
+{
+    gchar *locale = fb_compose_get_locale_name ();
+    gchar *contents = NULL;
+    gchar **lines;
+    gchar *path = NULL;
+    int i;
+
+    if (!g_file_get_contents (X11_LOCALE_DIR "/compose.dir",
+                              &contents, NULL, NULL)) {
+        g_free (locale);
+        return NULL;
+    }
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i] && path == NULL; i++) {
+        gchar *colon;
+
+        if (lines[i][0] == '#' || (colon = strchr (lines[i], ':')) == NULL)
+            continue;
+        *colon = '\0';
+        if (g_strcmp0 (g_strstrip (colon + 1), locale) == 0)
+            path = g_build_filename (X11_LOCALE_DIR, lines[i], NULL);
+    }
+    g_strfreev (lines);
+    g_free (contents);
+
+    if (path == NULL && g_str_has_suffix (locale, ".UTF-8"))
+        path = g_build_filename (X11_LOCALE_DIR, "en_US.UTF-8", "Compose", NULL);
+    g_free (locale);
+    return path;
+}
+
+/* Follows the lookup order of libX11. */
+static gchar *
+fb_compose_get_file (void)
+{
+    const gchar *env = g_getenv ("XCOMPOSEFILE");
+    gchar *path;
+
+    if (env != NULL && g_file_test (env, G_FILE_TEST_EXISTS))
+        return g_strdup (env);
+
+    path = g_build_filename (g_get_home_dir (), ".XCompose", NULL);
+    if (g_file_test (path, G_FILE_TEST_EXISTS))
+        return path;
+    g_free (path);
+
+    return fb_compose_get_locale_file ();
+}
+
+static gchar *
+fb_compose_expand_include (const gchar *path)
+{
+    GString *string = g_string_new (NULL);
+    const gchar *p;
+
+    for (p = path; *p; p++) {
+        gchar *file;
+
+        if (*p != '%' || p[1] == '\0') {
+            g_string_append_c (string, *p);
+            continue;
+        }
+        switch (*++p) {
+        case 'H':
+            g_string_append (string, g_get_home_dir ());
+            break;
+        case 'L':
+            if ((file = fb_compose_get_locale_file ()) != NULL)
+                g_string_append (string, file);
+            g_free (file);
+            break;
+        case 'S':
+            g_string_append (string, X11_LOCALE_DIR);
+            break;
+        default:
+            g_string_append_c (string, *p);
+        }
+    }
+    return g_string_free (string, FALSE);
+}
+
+static guint32
+fb_compose_keyval_from_name (const gchar *name)
+{
+    guint32 keyval;
+
+    /* ibus_keyval_from_name() does not know the "U1234" names. */
+    if (name[0] == 'U' && g_ascii_isxdigit (name[1])) {
+        gchar *end = NULL;
+        gulong ch = strtoul (name + 1, &end, 16);
+        if (end != NULL && *end == '\0' && ch <= 0x10ffff)
+            return ibus_unicode_to_keyval (ch);
+    }
+
+    keyval = ibus_keyval_from_name (name);
+    if (keyval == IBUS_KEY_VoidSymbol)
+        return 0;
+    return keyval;
+}
+
+static gboolean
+fb_compose_parse_string (const gchar **p,
+                         GString      *string)
+{
+    const gchar *s = *p;
+
+    g_assert (*s == '"');
+
+    for (s++; *s && *s != '"'; s++) {
+        if (*s != '\\') {
+            g_string_append_c (string, *s);
+            continue;
+        }
+        s++;
+        if (*s == '\0')
+            return FALSE;
+        if (*s == 'x' || *s == 'X') {
+            int value = 0;
+            int i;
+            for (i = 0; i < 2 && g_ascii_isxdigit (s[1]); i++)
+                value = value * 16 + g_ascii_xdigit_value (*++s);
+            g_string_append_c (string, (gchar) value);
+        } else if (*s >= '0' && *s <= '7') {
+            int value = *s - '0';
+            int i;
+            for (i = 0; i < 2 && s[1] >= '0' && s[1] <= '7'; i++)
+                value = value * 8 + (*++s - '0');
+            g_string_append_c (string, (gchar) value);
+        } else if (*s == 'n') {
+            g_string_append_c (string, '\n');
+        } else if (*s == 'r') {
+            g_string_append_c (string, '\r');
+        } else if (*s == 't') {
+            g_string_append_c (string, '\t');
+        } else {
+            g_string_append_c (string, *s);
+        }
+    }
+    if (*s != '"')
+        return FALSE;
+    *p = s + 1;
+    return TRUE;
+}
+
+static void
+fb_compose_insert (BuildNode     *root,
+                   const guint32 *keyvals,
+                   int            length,
+                   const gchar   *result)
+{
+    BuildNode *node = root;
+    int i;
+
+    for (i = 0; i < length; i++) {
+        BuildNode *child = NULL;
+        guint j;
+
+        if (node->children) {
+            for (j = 0; j < node->children->len; j++) {
+                BuildNode *n = g_ptr_array_index (node->children, j);
+                if (n->keyval == keyvals[i]) {
+                    child = n;
+                    break;
+                }
+            }
+        }
+        if (child == NULL) {
+            /* A shorter sequence is already defined. */
+            if (node->result)
+                return;
+            if (node->children == NULL) {
+                node->children = g_ptr_array_new_with_free_func (
+                        (GDestroyNotify) build_node_free);
+            }
+            child = build_node_new (keyvals[i]);
+            g_ptr_array_add (node->children, child);
+        }
+        node = child;
+    }
+
+    /* A longer sequence is already defined. */
+    if (node->children)
+        return;
+    g_free (node->result);
+    node->result = g_strdup (result);
+}
+
+static gint64
+fb_compose_get_mtime (const gchar *path)
+{
+    GStatBuf buf;
+
+    if (g_stat (path, &buf) != 0)
+        return -1;
+    return buf.st_mtime;
+}
+
+static void
+fb_compose_file_clear (FbComposeFile *file)
+{
+    g_free (file->path);
+}
+
+static void
+fb_compose_parse_line (BuildNode   *root,
+                       GArray      *files,
+                       const gchar *line,
+                       int          depth)
+{
+    const gchar *p = line;
+    guint32 keyvals[MAX_SEQUENCE_LENGTH];
+    int length = 0;
+    GString *result;
+
+    while (g_ascii_isspace (*p))
+        p++;
+
+    if (g_str_has_prefix (p, "include")) {
+        GString *path = g_string_new (NULL);
+        p += strlen ("include");
+        while (g_ascii_isspace (*p))
+            p++;
+        if (*p == '"' && fb_compose_parse_string (&p, path)) {
+            gchar *expanded = fb_compose_expand_include (path->str);
+            fb_compose_parse_file (root, files, expanded, depth + 1);
+            g_free (expanded);
+        }
+        g_string_free (path, TRUE);
+        return;
+    }
+
+    /* The lines with the modifier specifications are not supported. */
+    while (*p == '<') {
+        const gchar *end = strchr (p, '>');
+        gchar *name;
+
+        if (end == NULL || length == MAX_SEQUENCE_LENGTH)
+            return;
+        name = g_strndup (p + 1, end - p - 1);
+        keyvals[length] = fb_compose_keyval_from_name (name);
+        g_free (name);
+        if (keyvals[length++] == 0)
+            return;
+        for (p = end + 1; g_ascii_isspace (*p); p++);
+    }
+
+    if (length == 0 || *p != ':')
+        return;
+    for (p++; g_ascii_isspace (*p); p++);
+
+    result = g_string_new (NULL);
+    if (*p == '"') {
+        if (!fb_compose_parse_string (&p, result))
+            g_string_truncate (result, 0);
+    } else {
+        const gchar *end = p;
+        gchar *name;
+        gunichar ch;
+
+        while (*end && !g_ascii_isspace (*end) && *end != '#')
+            end++;
+        name = g_strndup (p, end - p);
+        if ((ch = ibus_keyval_to_unicode (fb_compose_keyval_from_name (name))))
+            g_string_append_unichar (result, ch);
+        g_free (name);
+    }
+
+    if (result->len > 0 && g_utf8_validate (result->str, result->len, NULL))
+        fb_compose_insert (root, keyvals, length, result->str);
+    g_string_free (result, TRUE);
+}
+
+static void
+fb_compose_parse_file (BuildNode   *root,
+                       GArray      *files,
+                       const gchar *path,
+                       int          depth)
+{
+    FbComposeFile file;
+    gchar *contents = NULL;
+    gchar **lines;
+    int i;
+
+    if (depth > MAX_INCLUDE_DEPTH) {
+        g_warning ("Too deep include in %s", path);
+        return;
+    }
+
+    /* The missing file is also recorded so that the cache is updated
+     * when it's created.
+     */
+    file.path = g_strdup (path);
+    file.mtime = fb_compose_get_mtime (path);
+    g_array_append_val (files, file);
+    if (!g_file_get_contents (path, &contents, NULL, NULL))
+        return;
+
+    lines = g_strsplit (contents, "\n", -1);
+    for (i = 0; lines[i]; i++) {
+        if (lines[i][0] == '#' || lines[i][0] == '\0')
+            continue;
+        fb_compose_parse_line (root, files, lines[i], depth);
+    }
+    g_strfreev (lines);
+    g_free (contents);
+}
+
+/* Flattens the tree in the breadth-first order so that the children of
+ * a node are continuous.
+ */
+static GBytes *
+fb_compose_build_data (BuildNode *root,
+                       GArray    *files)
+{
+    GArray *nodes = g_array_new (FALSE, TRUE, sizeof (FbComposeNode));
+    GString *strings = g_string_new (NULL);
+    GString *paths = g_string_new (NULL);
+    GQueue queue = G_QUEUE_INIT;
+    BuildNode *build;
+    FbComposeHeader header = { 0, };
+    GByteArray *data;
+    guint32 index = 0;
+    guint i;
+
+    g_array_set_size (nodes, 1);
+    g_queue_push_tail (&queue, root);
+
+    while ((build = g_queue_pop_head (&queue)) != NULL) {
+        FbComposeNode node = { 0, };
+
+        node.keyval = build->keyval;
+        if (build->result) {
+            node.result = strings->len + 1;
+            g_string_append_len (strings, build->result,
+                                 strlen (build->result) + 1);
+        }
+        if (build->children) {
+            g_ptr_array_sort (build->children, build_node_compare);
+            node.children = nodes->len;
+            node.n_children = build->children->len;
+            g_array_set_size (nodes, nodes->len + build->children->len);
+            for (i = 0; i < build->children->len; i++)
+                g_queue_push_tail (&queue,
+                                   g_ptr_array_index (build->children, i));
+        }
+        g_array_index (nodes, FbComposeNode, index++) = node;
+    }
+
+    for (i = 0; i < files->len; i++) {
+        FbComposeFile *file = &g_array_index (files, FbComposeFile, i);
+        g_string_append_len (paths, file->path, strlen (file->path) + 1);
+    }
+
+    header.magic = COMPOSE_CACHE_MAGIC;
+    header.version = COMPOSE_CACHE_VERSION;
+    header.n_files = files->len;
+    header.paths_length = paths->len;
+    header.n_nodes = nodes->len;
+    header.strings_length = strings->len;
+
+    data = g_byte_array_sized_new (sizeof (header) +
+                                   files->len * sizeof (gint64) +
+                                   nodes->len * sizeof (FbComposeNode) +
+                                   strings->len +
+                                   paths->len);
+    g_byte_array_append (data, (guint8 *)&header, sizeof (header));
+    for (i = 0; i < files->len; i++) {
+        FbComposeFile *file = &g_array_index (files, FbComposeFile, i);
+        g_byte_array_append (data, (guint8 *)&file->mtime, sizeof (gint64));
+    }
+    g_byte_array_append (data, (guint8 *)nodes->data,
+                         nodes->len * sizeof (FbComposeNode));
+    g_byte_array_append (data, (guint8 *)strings->str, strings->len);
+    g_byte_array_append (data, (guint8 *)paths->str, paths->len);
+
+    g_array_free (nodes, TRUE);
+    g_string_free (strings, TRUE);
+    g_string_free (paths, TRUE);
+    return g_byte_array_free_to_bytes (data);
+}
+
+/* The cache file can be broken so all the offsets are checked once.
+ * The parsed files are compared with their mtimes if @check_files is
+ * %TRUE.
+ */
+static gboolean
+fb_compose_set_data (FbCompose *compose,
+                     GBytes    *data,
+                     gboolean   check_files)
+{
+    const FbComposeHeader *header;
+    const gchar *mtimes;
+    const FbComposeNode *nodes;
+    const gchar *strings;
+    const gchar *path;
+    gsize size = 0;
+    guint32 i;
+
+    header = g_bytes_get_data (data, &size);
+    if (size < sizeof (FbComposeHeader))
+        return FALSE;
+    size -= sizeof (FbComposeHeader);
+    if (header->magic != COMPOSE_CACHE_MAGIC ||
+        header->version != COMPOSE_CACHE_VERSION ||
+        header->n_files == 0 ||
+        header->n_nodes == 0 ||
+        header->n_files > size / sizeof (gint64) ||
+        header->n_nodes > (size - header->n_files * sizeof (gint64)) /
+                sizeof (FbComposeNode) ||
+        size != header->n_files * sizeof (gint64) +
+                header->n_nodes * sizeof (FbComposeNode) +
+                (gsize) header->strings_length +
+                (gsize) header->paths_length) {
+        return FALSE;
+    }
+
+    mtimes = (const gchar *)(header + 1);
+    nodes = (const FbComposeNode *)(mtimes +
+                                    header->n_files * sizeof (gint64));
+    strings = (const gchar *)(nodes + header->n_nodes);
+    path = strings + header->strings_length;
+    if (header->strings_length > 0 &&
+        strings[header->strings_length - 1] != '\0') {
+        return FALSE;
+    }
+    if (header->paths_length == 0 ||
+        path[header->paths_length - 1] != '\0') {
+        return FALSE;
+    }
+    for (i = 0; i < header->n_nodes; i++) {
+        if (nodes[i].n_children > 0 &&
+            (nodes[i].children <= i ||
+             nodes[i].children > header->n_nodes ||
+             nodes[i].n_children > header->n_nodes - nodes[i].children)) {
+            return FALSE;
+        }
+        if (nodes[i].result > header->strings_length)
+            return FALSE;
+    }
+    for (i = 0; i < header->n_files; i++) {
+        gint64 mtime;
+
+        if (path >= strings + header->strings_length + header->paths_length)
+            return FALSE;
+        memcpy (&mtime, mtimes + i * sizeof (gint64), sizeof (gint64));
+        if (check_files && fb_compose_get_mtime (path) != mtime)
+            return FALSE;
+        path += strlen (path) + 1;
+    }
+
+    compose->data = g_bytes_ref (data);
+    compose->nodes = nodes;
+    compose->n_nodes = header->n_nodes;
+    compose->strings = strings;
+    return TRUE;
+}
+
+FbCompose *
+fb_compose_new (void)
+{
+    FbCompose *compose = g_slice_new0 (FbCompose);
+    gchar *path = fb_compose_get_file ();
+    gchar *checksum;
+    gchar *cache_path;
+    BuildNode *root;
+    GArray *files;
+    GBytes *data;
+
+    if (path == NULL || !g_file_test (path, G_FILE_TEST_EXISTS)) {
+        g_free (path);
+        return compose;
+    }
+
+    checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, path, -1);
+    cache_path = g_strdup_printf ("%s/ibus-fbterm/compose-%s.cache",
+                                  g_get_user_cache_dir (),
+                                  checksum);
+    g_free (checksum);
+
+    compose->mapped_file = g_mapped_file_new (cache_path, FALSE, NULL);
+    if (compose->mapped_file) {
+        data = g_mapped_file_get_bytes (compose->mapped_file);
+        if (fb_compose_set_data (compose, data, TRUE)) {
+            g_bytes_unref (data);
+            goto out;
+        }
+        g_bytes_unref (data);
+        g_mapped_file_unref (compose->mapped_file);
+        compose->mapped_file = NULL;
+    }
+
+    root = build_node_new (0);
+    files = g_array_new (FALSE, FALSE, sizeof (FbComposeFile));
+    g_array_set_clear_func (files, (GDestroyNotify) fb_compose_file_clear);
+    fb_compose_parse_file (root, files, path, 0);
+    data = fb_compose_build_data (root, files);
+    build_node_free (root);
+    g_array_free (files, TRUE);
+
+    if (fb_compose_set_data (compose, data, FALSE)) {
+        GError *error = NULL;
+        gchar *dir = g_path_get_dirname (cache_path);
+
+        g_mkdir_with_parents (dir, 0700);
+        if (!g_file_set_contents (cache_path,
+                                  g_bytes_get_data (data, NULL),
+                                  g_bytes_get_size (data),
+                                  &error)) {
+            g_warning ("Failed to save %s: %s", cache_path, error->message);
+            g_error_free (error);
+        }
+        g_free (dir);
+    }
+    g_bytes_unref (data);
+
+out:
+    g_free (cache_path);
+    g_free (path);
+    return compose;
+}
+
+void
+fb_compose_free (FbCompose *compose)
+{
+    g_return_if_fail (compose != NULL);
+
+    if (compose->data)
+        g_bytes_unref (compose->data);
+    if (compose->mapped_file)
+        g_mapped_file_unref (compose->mapped_file);
+    g_slice_free (FbCompose, compose);
+}
+
+FbComposeStatus
+fb_compose_process_key (FbCompose    *compose,
+                        guint         keyval,
+                        guint         modifiers,
+                        const gchar **output)
+{
+    const FbComposeNode *parent;
+    const FbComposeNode *node = NULL;
+
+    g_return_val_if_fail (compose != NULL, FB_COMPOSE_IGNORED);
+
+    if (output)
+        *output = NULL;
+    if (compose->n_nodes == 0)
+        return FB_COMPOSE_IGNORED;
+
+    if ((modifiers & IBUS_RELEASE_MASK) ||
+        (keyval >= IBUS_KEY_Shift_L && keyval <= IBUS_KEY_Hyper_R) ||
+        keyval == IBUS_KEY_ISO_Level3_Shift) {
+        return compose->current ? FB_COMPOSE_COMPOSING : FB_COMPOSE_IGNORED;
+    }
+
+    if (!(modifiers & (IBUS_CONTROL_MASK | IBUS_MOD1_MASK | IBUS_SUPER_MASK))) {
+        parent = &compose->nodes[compose->current];
+        node = bsearch (&keyval,
+                        compose->nodes + parent->children,
+                        parent->n_children,
+                        sizeof (FbComposeNode),
+                        fb_compose_node_compare);
+    }
+
+    if (node == NULL) {
+        if (compose->current == 0)
+            return FB_COMPOSE_IGNORED;
+        compose->current = 0;
+        return FB_COMPOSE_CANCELLED;
+    }
+
+    if (node->n_children > 0) {
+        compose->current = node - compose->nodes;
+        return FB_COMPOSE_COMPOSING;
+    }
+
+    compose->current = 0;
+    if (node->result == 0)
+        return FB_COMPOSE_CANCELLED;
+    if (output)
+        *output = compose->strings + node->result - 1;
+    return FB_COMPOSE_COMMITTED;
+}
+
+void
+fb_compose_reset (FbCompose *compose)
+{
+    g_return_if_fail (compose != NULL);
+
+    compose->current = 0;
+}
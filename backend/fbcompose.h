@@ -0,0 +1,80 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_COMPOSE_H_
+#define __FB_COMPOSE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+typedef struct _FbCompose FbCompose;
+
+/**
+ * FbComposeStatus:
+ * @FB_COMPOSE_IGNORED: The key does not start any sequences.
+ * @FB_COMPOSE_COMPOSING: The key is consumed in the sequence.
+ * @FB_COMPOSE_COMMITTED: The sequence is completed.
+ * @FB_COMPOSE_CANCELLED: The key does not match the sequence and
+ *                        the sequence is discarded.
+ */
+typedef enum {
+    FB_COMPOSE_IGNORED = 0,
+    FB_COMPOSE_COMPOSING,
+    FB_COMPOSE_COMMITTED,
+    FB_COMPOSE_CANCELLED
+} FbComposeStatus;
+
+/**
+ * fb_compose_new:
+ *
+ * Loads the Compose table of $XCOMPOSEFILE, ~/.XCompose or the current
+ * locale.  The table is converted to a trie once and the trie is
+ * memory-mapped from $XDG_CACHE_HOME/ibus-fbterm on the next startup.
+ *
+ * Returns: A newly allocated #FbCompose
+ */
+FbCompose       *fb_compose_new                    (void);
+void             fb_compose_free                   (FbCompose         *compose);
+
+/**
+ * fb_compose_process_key:
+ * @compose: A #FbCompose
+ * @keyval: The IBus keyval.
+ * @modifiers: The #IBusModifierType
+ * @output: (out) (transfer none): The composed string if
+ *          %FB_COMPOSE_COMMITTED is returned.
+ *
+ * Returns: A #FbComposeStatus
+ */
+FbComposeStatus  fb_compose_process_key            (FbCompose         *compose,
+                                                    guint              keyval,
+                                                    guint              modifiers,
+                                                    const gchar      **output);
+
+/**
+ * fb_compose_reset:
+ * @compose: A #FbCompose
+ *
+ * Discards the current sequence.
+ */
+void             fb_compose_reset                  (FbCompose         *compose);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,423 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/kd.h>
+#include <linux/kdev_t.h> /* MINOR() */
+#include <linux/keyboard.h>
+#include <linux/tiocl.h>
+#include <linux/vt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fbconsole.h"
+
+/* The Linux virtual console */
+typedef struct {
+    FbConsole parent;
+    /* tty0 is needed to get the keysyms and to undo TIOCCONS. */
+    int       tty0_fd;
+} FbVcConsole;
+
+typedef struct {
+    FbConsoleClass parent;
+} FbVcConsoleClass;
+
+/* The pty which runs the backend without a virtual console */
+typedef struct {
+    FbConsole parent;
+} FbPtyConsole;
+
+typedef struct {
+    FbConsoleClass parent;
+} FbPtyConsoleClass;
+
+GType fb_vc_console_get_type (void);
+GType fb_pty_console_get_type (void);
+
+G_DEFINE_ABSTRACT_TYPE (FbConsole, fb_console, IBUS_TYPE_OBJECT);
+G_DEFINE_TYPE (FbVcConsole, fb_vc_console, FB_TYPE_CONSOLE);
+G_DEFINE_TYPE (FbPtyConsole, fb_pty_console, FB_TYPE_CONSOLE);
+
+static void
+fb_console_init (FbConsole *console)
+{
+}
+
+static void
+fb_console_class_init (FbConsoleClass *class)
+{
+}
+
+static void
+fb_vc_console_init (FbVcConsole *console)
+{
+    console->tty0_fd = -1;
+}
+
+static void
+fb_vc_console_destroy (FbVcConsole *console)
+{
+    if (console->tty0_fd != -1) {
+        close (console->tty0_fd);
+        console->tty0_fd = -1;
+    }
+    IBUS_OBJECT_CLASS (fb_vc_console_parent_class)->destroy (
+            IBUS_OBJECT (console));
+}
+
+static int
+fb_vc_console_get_tty0 (FbVcConsole *console)
+{
+    if (console->tty0_fd == -1)
+        console->tty0_fd = open ("/dev/tty0", O_RDWR | O_CLOEXEC);
+    return console->tty0_fd;
+}
+
+static void
+fb_vc_console_setup (FbConsole *console)
+{
+    struct vt_mode vtm;
+
+    vtm.mode = VT_PROCESS;
+    vtm.waitv = 0;
+    vtm.relsig = SIGUSR1;
+    vtm.acqsig = SIGUSR2;
+    vtm.frsig = 0;
+    ioctl (STDIN_FILENO, VT_SETMODE, &vtm);
+}
+
+static void
+fb_vc_console_release (FbConsole *console)
+{
+    ioctl (STDIN_FILENO, VT_RELDISP, 1);
+}
+
+static gboolean
+fb_vc_console_is_active (FbConsole *console)
+{
+    struct vt_stat vtstat;
+    struct stat ttystat;
+
+    ioctl (STDIN_FILENO, VT_GETSTATE, &vtstat);
+    fstat (STDIN_FILENO, &ttystat);
+    return vtstat.v_active == MINOR (ttystat.st_rdev);
+}
+
+static void
+fb_vc_console_activate (FbConsole *console,
+                        int        num)
+{
+    ioctl (STDIN_FILENO, VT_ACTIVATE, num);
+}
+
+static gboolean
+fb_vc_console_get_winsize (FbConsole      *console,
+                           struct winsize *size)
+{
+    /* Need tty instead of tty0 to get the right size. */
+    int tty_fd = open ("/dev/tty", O_RDONLY | O_CLOEXEC);
+    gboolean retval;
+
+    if (tty_fd == -1)
+        return FALSE;
+    retval = ioctl (tty_fd, TIOCGWINSZ, size) == 0;
+    close (tty_fd);
+    return retval;
+}
+
+static gboolean
+fb_vc_console_redirect (FbConsole *console,
+                        int        pty_fd)
+{
+    int tty0_fd = fb_vc_console_get_tty0 ((FbVcConsole *) console);
+    gboolean retval = FALSE;
+
+    if (tty0_fd == -1)
+        return FALSE;
+
+    seteuid (0);
+    ioctl (tty0_fd, TIOCCONS, 0);
+    if (pty_fd != -1) {
+        int slavefd = open (ptsname (pty_fd), O_RDWR | O_CLOEXEC);
+        if (slavefd != -1) {
+            retval = ioctl (slavefd, TIOCCONS, 0) == 0;
+            close (slavefd);
+        }
+    }
+    seteuid (getuid ());
+    return retval;
+}
+
+static gboolean
+fb_vc_console_read_keymap_entry (FbConsole *console,
+                                 int        keycode,
+                                 guint32   *keysym)
+{
+    int tty0_fd = fb_vc_console_get_tty0 ((FbVcConsole *) console);
+    struct kbentry entry;
+
+    entry.kb_table = 0;
+    entry.kb_index = keycode;
+    if (tty0_fd == -1 || ioctl (tty0_fd, KDGKBENT, &entry) < 0)
+        return FALSE;
+    *keysym = KVAL (entry.kb_value);
+    return TRUE;
+}
+
+static gboolean
+fb_vc_console_get_keyboard_mode (FbConsole *console,
+                                 long int  *mode)
+{
+    return ioctl (STDIN_FILENO, KDGKBMODE, mode) == 0;
+}
+
+static gboolean
+fb_vc_console_set_keyboard_mode (FbConsole *console,
+                                 long int   mode)
+{
+    return ioctl (STDIN_FILENO, KDSKBMODE, mode) == 0;
+}
+
+static gboolean
+fb_vc_console_get_shift_state (FbConsole *console,
+                               int       *state)
+{
+    char arg = TIOCL_GETSHIFTSTATE;
+
+    if (ioctl (STDIN_FILENO, TIOCLINUX, &arg) < 0)
+        return FALSE;
+    *state = (unsigned char) arg;
+    return TRUE;
+}
+
+static void
+fb_vc_console_class_init (FbVcConsoleClass *class)
+{
+    FbConsoleClass *console_class = FB_CONSOLE_CLASS (class);
+
+    IBUS_OBJECT_CLASS (class)->destroy =
+            (IBusObjectDestroyFunc) fb_vc_console_destroy;
+    console_class->setup = fb_vc_console_setup;
+    console_class->release = fb_vc_console_release;
+    console_class->is_active = fb_vc_console_is_active;
+    console_class->activate = fb_vc_console_activate;
+    console_class->get_winsize = fb_vc_console_get_winsize;
+    console_class->redirect = fb_vc_console_redirect;
+    console_class->read_keymap_entry = fb_vc_console_read_keymap_entry;
+    console_class->get_keyboard_mode = fb_vc_console_get_keyboard_mode;
+    console_class->set_keyboard_mode = fb_vc_console_set_keyboard_mode;
+    console_class->get_shift_state = fb_vc_console_get_shift_state;
+}
+
+static void
+fb_pty_console_init (FbPtyConsole *console)
+{
+}
+
+static gboolean
+fb_pty_console_is_active (FbConsole *console)
+{
+    return TRUE;
+}
+
+static gboolean
+fb_pty_console_get_winsize (FbConsole      *console,
+                            struct winsize *size)
+{
+    return ioctl (STDIN_FILENO, TIOCGWINSZ, size) == 0;
+}
+
+/* The pty does not switch the consoles, has no keymap in the kernel
+ * and the console messages are not redirected.  The other methods
+ * are left unset.
+ */
+static void
+fb_pty_console_class_init (FbPtyConsoleClass *class)
+{
+    FbConsoleClass *console_class = FB_CONSOLE_CLASS (class);
+
+    console_class->is_active = fb_pty_console_is_active;
+    console_class->get_winsize = fb_pty_console_get_winsize;
+}
+
+FbConsole *
+fb_console_new (void)
+{
+    char type;
+
+    if (ioctl (STDIN_FILENO, KDGKBTYPE, &type) == 0)
+        return g_object_new (fb_vc_console_get_type (), NULL);
+    return g_object_new (fb_pty_console_get_type (), NULL);
+}
+
+gboolean
+fb_console_is_headless (FbConsole *console)
+{
+    g_return_val_if_fail (FB_IS_CONSOLE (console), TRUE);
+
+    return G_TYPE_CHECK_INSTANCE_TYPE (console, fb_pty_console_get_type ());
+}
+
+void
+fb_console_setup (FbConsole *console)
+{
+    FbConsoleClass *class;
+
+    g_return_if_fail (FB_IS_CONSOLE (console));
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (class->setup)
+        class->setup (console);
+}
+
+void
+fb_console_release (FbConsole *console)
+{
+    FbConsoleClass *class;
+
+    g_return_if_fail (FB_IS_CONSOLE (console));
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (class->release)
+        class->release (console);
+}
+
+gboolean
+fb_console_is_active (FbConsole *console)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    return class->is_active ? class->is_active (console) : FALSE;
+}
+
+void
+fb_console_activate (FbConsole *console,
+                     int        num)
+{
+    FbConsoleClass *class;
+
+    g_return_if_fail (FB_IS_CONSOLE (console));
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (class->activate)
+        class->activate (console, num);
+}
+
+gboolean
+fb_console_get_winsize (FbConsole      *console,
+                        struct winsize *size)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+    g_return_val_if_fail (size != NULL, FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    return class->get_winsize ? class->get_winsize (console, size) : FALSE;
+}
+
+gboolean
+fb_console_redirect (FbConsole *console,
+                     int        pty_fd)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    return class->redirect ? class->redirect (console, pty_fd) : FALSE;
+}
+
+gboolean
+fb_console_read_keymap_entry (FbConsole *console,
+                              int        keycode,
+                              guint32   *keysym)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+    g_return_val_if_fail (keysym != NULL, FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (!class->read_keymap_entry)
+        return FALSE;
+    return class->read_keymap_entry (console, keycode, keysym);
+}
+
+gboolean
+fb_console_get_keyboard_mode (FbConsole *console,
+                              long int  *mode)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+    g_return_val_if_fail (mode != NULL, FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (!class->get_keyboard_mode) {
+        errno = ENOTTY;
+        return FALSE;
+    }
+    return class->get_keyboard_mode (console, mode);
+}
+
+gboolean
+fb_console_set_keyboard_mode (FbConsole *console,
+                              long int   mode)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (!class->set_keyboard_mode) {
+        errno = ENOTTY;
+        return FALSE;
+    }
+    return class->set_keyboard_mode (console, mode);
+}
+
+gboolean
+fb_console_get_shift_state (FbConsole *console,
+                            int       *state)
+{
+    FbConsoleClass *class;
+
+    g_return_val_if_fail (FB_IS_CONSOLE (console), FALSE);
+    g_return_val_if_fail (state != NULL, FALSE);
+
+    class = FB_CONSOLE_GET_CLASS (console);
+    if (!class->get_shift_state) {
+        errno = ENOTTY;
+        return FALSE;
+    }
+    return class->get_shift_state (console, state);
+}
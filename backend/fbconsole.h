@@ -0,0 +1,209 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_CONSOLE_H_
+#define __FB_CONSOLE_H_
+
+#include <glib-object.h>
+#include <ibus.h>
+#include <sys/ioctl.h>
+
+/*
+ * Type macros.
+ */
+
+/* define GOBJECT macros */
+#define FB_TYPE_CONSOLE                         (fb_console_get_type ())
+#define FB_CONSOLE(o)                           (G_TYPE_CHECK_INSTANCE_CAST ((o), FB_TYPE_CONSOLE, FbConsole))
+#define FB_CONSOLE_CLASS(k)                     (G_TYPE_CHECK_CLASS_CAST ((k), FB_TYPE_CONSOLE, FbConsoleClass))
+#define FB_IS_CONSOLE(o)                        (G_TYPE_CHECK_INSTANCE_TYPE ((o), FB_TYPE_CONSOLE))
+#define FB_IS_CONSOLE_CLASS(k)                  (G_TYPE_CHECK_CLASS_TYPE ((k), FB_TYPE_CONSOLE))
+#define FB_CONSOLE_GET_CLASS(o)                 (G_TYPE_INSTANCE_GET_CLASS ((o), FB_TYPE_CONSOLE, FbConsoleClass))
+
+
+G_BEGIN_DECLS
+typedef struct _FbConsole FbConsole;
+typedef struct _FbConsoleClass FbConsoleClass;
+
+/**
+ * FbConsole:
+ *
+ * <structname>FbConsole</structname> provides the operations of
+ * the console on the standard input.  The Linux virtual console
+ * implements them with the ioctls of the kernel and a pty implements
+ * the headless mode without them.
+ */
+struct _FbConsole {
+    IBusObject parent;
+};
+
+struct _FbConsoleClass {
+    IBusObjectClass parent;
+
+    void     (* setup)             (FbConsole      *console);
+    void     (* release)           (FbConsole      *console);
+    gboolean (* is_active)         (FbConsole      *console);
+    void     (* activate)          (FbConsole      *console,
+                                    int             num);
+    gboolean (* get_winsize)       (FbConsole      *console,
+                                    struct winsize *size);
+    gboolean (* redirect)          (FbConsole      *console,
+                                    int             pty_fd);
+    gboolean (* read_keymap_entry) (FbConsole      *console,
+                                    int             keycode,
+                                    guint32        *keysym);
+    gboolean (* get_keyboard_mode) (FbConsole      *console,
+                                    long int       *mode);
+    gboolean (* set_keyboard_mode) (FbConsole      *console,
+                                    long int        mode);
+    gboolean (* get_shift_state)   (FbConsole      *console,
+                                    int            *state);
+
+    gpointer dummy[5];
+};
+
+
+GType            fb_console_get_type            (void);
+
+/**
+ * fb_console_new:
+ *
+ * Creates a new #FbConsole for the standard input.  The headless
+ * #FbConsole is returned if the standard input is not a Linux
+ * virtual console, e.g. a pty.
+ *
+ * Returns: A newly allocated #FbConsole
+ */
+FbConsole       *fb_console_new                 (void);
+
+/**
+ * fb_console_is_headless:
+ * @console: A #FbConsole
+ *
+ * Returns: %TRUE if @console is not a Linux virtual console.
+ */
+gboolean         fb_console_is_headless         (FbConsole      *console);
+
+/**
+ * fb_console_setup:
+ * @console: A #FbConsole
+ *
+ * Requests SIGUSR1 and SIGUSR2 when the console is released and
+ * acquired.
+ */
+void             fb_console_setup               (FbConsole      *console);
+
+/**
+ * fb_console_release:
+ * @console: A #FbConsole
+ *
+ * Allows the console to be switched after SIGUSR1.
+ */
+void             fb_console_release             (FbConsole      *console);
+
+/**
+ * fb_console_is_active:
+ * @console: A #FbConsole
+ *
+ * Returns: %TRUE if the console is shown.
+ */
+gboolean         fb_console_is_active           (FbConsole      *console);
+
+/**
+ * fb_console_activate:
+ * @console: A #FbConsole
+ * @num: The number of the console from 1.
+ *
+ * Switches to the console @num.
+ */
+void             fb_console_activate            (FbConsole      *console,
+                                                 int             num);
+
+/**
+ * fb_console_get_winsize:
+ * @console: A #FbConsole
+ * @size: (out): The size of the console.
+ *
+ * Returns: %TRUE if @size is set.
+ */
+gboolean         fb_console_get_winsize         (FbConsole      *console,
+                                                 struct winsize *size);
+
+/**
+ * fb_console_redirect:
+ * @console: A #FbConsole
+ * @pty_fd: The master fd of a pty or -1
+ *
+ * Redirects the console messages to the pty of @pty_fd or back to
+ * the console if @pty_fd is -1.
+ *
+ * Returns: %TRUE if the messages are redirected.
+ */
+gboolean         fb_console_redirect            (FbConsole      *console,
+                                                 int             pty_fd);
+
+/**
+ * fb_console_read_keymap_entry:
+ * @console: A #FbConsole
+ * @keycode: A keycode
+ * @keysym: (out): The keysym of @keycode in the plain table.
+ *
+ * Returns: %TRUE if @keysym is read from the keymap of the kernel.
+ */
+gboolean         fb_console_read_keymap_entry   (FbConsole      *console,
+                                                 int             keycode,
+                                                 guint32        *keysym);
+
+/**
+ * fb_console_get_keyboard_mode:
+ * @console: A #FbConsole
+ * @mode: (out): The keyboard mode, e.g. K_UNICODE.
+ *
+ * Returns: %TRUE if @mode is set.
+ */
+gboolean         fb_console_get_keyboard_mode   (FbConsole      *console,
+                                                 long int       *mode);
+
+/**
+ * fb_console_set_keyboard_mode:
+ * @console: A #FbConsole
+ * @mode: The keyboard mode, e.g. K_MEDIUMRAW.
+ *
+ * Returns: %TRUE if the keyboard mode is changed.  Otherwise errno
+ *          is set.
+ */
+gboolean         fb_console_set_keyboard_mode   (FbConsole      *console,
+                                                 long int        mode);
+
+/**
+ * fb_console_get_shift_state:
+ * @console: A #FbConsole
+ * @state: (out): The bits of the held modifiers, e.g. 1 << KG_ALT.
+ *
+ * The kernel does not add the modifiers to the function keys in
+ * K_UNICODE mode and they are read with this function.
+ *
+ * Returns: %TRUE if @state is set.
+ */
+gboolean         fb_console_get_shift_state     (FbConsole      *console,
+                                                 int            *state);
+
+G_END_DECLS
+#endif
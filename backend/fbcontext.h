@@ -52,8 +52,12 @@ struct _FbContextIface {
                                                     guint         length,
                                                     gchar       **dispatched);
     void       (*load_settings)                    (FbContext    *context);
+    gboolean   (*process_key_event)                (FbContext    *context,
+                                                    guint         keyval,
+                                                    guint         keycode,
+                                                    guint         modifiers);
 
-    gpointer dummy[5];
+    gpointer dummy[4];
 };
 
 GType            fb_context_get_type               (void) G_GNUC_CONST;
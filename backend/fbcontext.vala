@@ -0,0 +1,54 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* FIXME: Cannot use fbcontext.vapi because GObject.TypeInterface
+ * does not exist in gobject-2.0.vapi
+ */
+public interface FbContext {
+    public abstract uint filter_keypress   (string?          buff,
+                                            uint             length,
+                                            out string?      dispatched = null);
+    public abstract void load_settings     ();
+    public abstract bool process_key_event (uint             keyval,
+                                            uint             keycode,
+                                            uint             modifiers);
+
+    public signal void   user_warning      (string           message);
+    public signal int    switcher_switch   (IBus.EngineDesc[]
+                                                             engines,
+                                            uint32           keyval);
+    public signal uint32 keysym_to_keycode (uint32           keysym);
+    public signal void   engine_changed    (IBus.EngineDesc  engine);
+    public signal void   keymap_changed    ();
+
+    public signal void   commit            (IBus.Text        text);
+    public signal void   preedit_changed   (IBus.Text        text,
+                                            uint             cursor_pos,
+                                            bool             visible);
+    public signal void   update_lookup_table
+                                           (IBus.LookupTable table,
+                                            bool             visible);
+    public signal void   register_properties
+                                           (IBus.PropList    props);
+    public signal void   update_property   (IBus.Property    prop);
+    public signal void   forward_key_event (uint             keyval,
+                                            uint             keycode,
+                                            uint             state);
+}
@@ -0,0 +1,1019 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+#include <ibus.h>
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/kd.h>
+#include <linux/keyboard.h>
+
+#include "fbcontext.h"
+#include "fbimclient.h"
+#include "fbkeyboard.h"
+#include "fbwidth.h"
+
+#define FB_IM_MAX_COLUMNS 512
+
+typedef enum {
+    FB_IM_WINDOW_PREEDIT = 0,
+    FB_IM_WINDOW_LOOKUP_TABLE,
+    FB_IM_WINDOW_STATUS,
+    FB_IM_N_WINDOWS
+} FbImWindow;
+
+typedef enum {
+    FB_IM_CELL_INVERSE   = 1 << 0,
+    FB_IM_CELL_BLUE_BG   = 1 << 1,
+    FB_IM_CELL_WARNING   = 1 << 2,
+    /* The right half of the previous wide character */
+    FB_IM_CELL_WIDE_TAIL = 1 << 3
+} FbImCellAttr;
+
+typedef struct {
+    gunichar ch;
+    guint32  attr;
+} FbImCell;
+
+struct _FbImClientPrivate {
+    FbContext         *context;
+    /* Encodes the forwarded keys */
+    FbKeyboard        *keyboard;
+    guint              modes;
+    GString           *input;
+    FbImInfo           info;
+    guint32            cursor_x;
+    guint32            cursor_y;
+    gboolean           active;
+    gboolean           ui_shown;
+    gboolean           hung_up;
+    /* The terminal has not acknowledged the windows yet. */
+    gboolean           waiting_ack;
+    gboolean           dirty;
+    guint              render_id;
+    /* The cells of FbImWindow */
+    GArray            *cells[FB_IM_N_WINDOWS];
+    /* The windows acknowledged by the terminal */
+    FbImWin            wins[FB_IM_N_WINDOWS];
+    gchar             *engine_name;
+    GPtrArray         *status_keys;
+    GPtrArray         *status_labels;
+    gchar             *warning;
+    int                switcher_engine_index;
+    guint32           *keymap;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (FbImClient,
+                            fb_im_client,
+                            FB_TYPE_IO);
+
+static void         fb_im_client_destroy          (FbImClient      *client);
+static void         fb_im_client_ready_read       (FbIo            *io,
+                                                   const gchar     *buff,
+                                                   guint            length);
+static void         fb_im_client_hangup           (FbIo            *io);
+static void         fb_im_client_queue_render     (FbImClient      *client);
+static void         fb_im_client_update_status    (FbImClient      *client);
+
+static void
+fb_im_client_init (FbImClient *client)
+{
+    FbImClientPrivate *priv =
+            fb_im_client_get_instance_private (client);
+    int i;
+
+    client->priv = priv;
+
+    ibus_init ();
+
+    priv->input = g_string_new (NULL);
+    for (i = 0; i < FB_IM_N_WINDOWS; i++)
+        priv->cells[i] = g_array_new (FALSE, TRUE, sizeof (FbImCell));
+    priv->status_keys = g_ptr_array_new_with_free_func (g_free);
+    priv->status_labels = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+fb_im_client_class_init (FbImClientClass *class)
+{
+    IBUS_OBJECT_CLASS (class)->destroy =
+            (IBusObjectDestroyFunc)fb_im_client_destroy;
+    FB_IO_CLASS (class)->ready_read = fb_im_client_ready_read;
+    FB_IO_CLASS (class)->hangup = fb_im_client_hangup;
+}
+
+static void
+fb_im_client_destroy (FbImClient *client)
+{
+    FbImClientPrivate *priv;
+    int i;
+
+    g_return_if_fail (FB_IS_IM_CLIENT (client));
+
+    priv = client->priv;
+
+    if (priv->render_id) {
+        g_source_remove (priv->render_id);
+        priv->render_id = 0;
+    }
+    if (priv->context) {
+        g_signal_handlers_disconnect_by_data (priv->context, client);
+        g_object_unref (priv->context);
+        priv->context = NULL;
+    }
+    g_clear_pointer (&priv->keyboard, fb_keyboard_free);
+    fb_io_set_fd (FB_IO (client), -1);
+
+    for (i = 0; i < FB_IM_N_WINDOWS; i++)
+        g_clear_pointer (&priv->cells[i], g_array_unref);
+    g_clear_pointer (&priv->status_keys, g_ptr_array_unref);
+    g_clear_pointer (&priv->status_labels, g_ptr_array_unref);
+    if (priv->input) {
+        g_string_free (priv->input, TRUE);
+        priv->input = NULL;
+    }
+    g_clear_pointer (&priv->engine_name, g_free);
+    g_clear_pointer (&priv->warning, g_free);
+    g_clear_pointer (&priv->keymap, g_free);
+}
+
+/* Sends the fixed @size bytes of @message and the variable length
+ * array @data.
+ */
+static void
+fb_im_client_send (FbImClient    *client,
+                   FbImMessage   *message,
+                   gsize          size,
+                   gconstpointer  data,
+                   gsize          length)
+{
+    GString *buff;
+
+    if (size + length > G_MAXUINT16) {
+        g_warning ("Too long IM message: %" G_GSIZE_FORMAT, size + length);
+        return;
+    }
+
+    message->length = size + length;
+    buff = g_string_sized_new (message->length);
+    g_string_append_len (buff, (const gchar *)message, size);
+    if (length)
+        g_string_append_len (buff, data, length);
+    fb_io_write (FB_IO (client), buff->str, buff->len);
+    g_string_free (buff, TRUE);
+}
+
+static void
+fb_im_client_send_text (FbImClient  *client,
+                        const gchar *text,
+                        gsize        length)
+{
+    FbImMessage message;
+
+    message.type = FB_IM_MESSAGE_PUT_TEXT;
+    fb_im_client_send (client,
+                       &message,
+                       FB_IM_MESSAGE_HEADER_SIZE,
+                       text,
+                       length);
+}
+
+/* Appends @ch to @cells.  A wide character uses two cells. */
+static void
+fb_im_client_put_char (GArray   *cells,
+                       gunichar  ch,
+                       guint32   attr)
+{
+    FbImCell cell;
+    int width;
+
+    if ((width = fb_width_unichar (ch)) == 0)
+        return;
+    if (cells->len + width > FB_IM_MAX_COLUMNS)
+        return;
+
+    cell.ch = ch;
+    cell.attr = attr;
+    g_array_append_val (cells, cell);
+    if (width == 2) {
+        cell.ch = 0;
+        cell.attr = attr | FB_IM_CELL_WIDE_TAIL;
+        g_array_append_val (cells, cell);
+    }
+}
+
+static void
+fb_im_client_put_text (GArray      *cells,
+                       const gchar *text,
+                       guint32      attr)
+{
+    const gchar *p;
+
+    for (p = text; *p; p = g_utf8_next_char (p))
+        fb_im_client_put_char (cells, g_utf8_get_char (p), attr);
+}
+
+static void
+fb_im_client_load_keymap (FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    int keycode;
+
+    if (priv->keymap)
+        return;
+
+    priv->keymap = g_new0 (guint32, NR_KEYS);
+    for (keycode = 0; keycode < NR_KEYS; keycode++) {
+        struct kbentry entry;
+
+        entry.kb_table = 0;
+        entry.kb_index = keycode;
+        if (ioctl (STDIN_FILENO, KDGKBENT, &entry) < 0)
+            break;
+        priv->keymap[keycode] = KVAL (entry.kb_value);
+    }
+}
+
+static FbKeyboard *
+fb_im_client_get_keyboard (FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    if (priv->keyboard == NULL) {
+        priv->keyboard = fb_keyboard_new (STDIN_FILENO);
+        fb_keyboard_load_keymap (priv->keyboard);
+        fb_keyboard_set_modes (priv->keyboard, priv->modes);
+    }
+    return priv->keyboard;
+}
+
+/* The preedit is drawn at the cursor, the lookup table is drawn on
+ * the next row or the previous row at the bottom, and the status is
+ * drawn on the last row.
+ */
+static void
+fb_im_client_layout (FbImClient *client,
+                     FbImWin    *wins)
+{
+    FbImClientPrivate *priv = client->priv;
+    guint32 font_width = priv->info.font_width;
+    guint32 font_height = priv->info.font_height;
+    guint32 screen_width = priv->info.screen_width;
+    guint32 screen_height = priv->info.screen_height;
+    int i;
+
+    memset (wins, 0, sizeof (FbImWin) * FB_IM_N_WINDOWS);
+
+    if (!priv->active || !priv->ui_shown || font_width == 0 ||
+        font_height == 0 || screen_height < font_height) {
+        return;
+    }
+
+    for (i = 0; i < FB_IM_N_WINDOWS; i++) {
+        guint32 width = MIN (priv->cells[i]->len * font_width,
+                             screen_width / font_width * font_width);
+
+        if (width == 0)
+            continue;
+
+        wins[i].w = width;
+        wins[i].h = font_height;
+        switch (i) {
+        case FB_IM_WINDOW_PREEDIT:
+            wins[i].x = MIN (priv->cursor_x, screen_width - width);
+            wins[i].y = MIN (priv->cursor_y, screen_height - font_height);
+            break;
+        case FB_IM_WINDOW_LOOKUP_TABLE:
+            wins[i].x = MIN (priv->cursor_x, screen_width - width);
+            wins[i].y = priv->cursor_y + font_height;
+            if (wins[i].y + 2 * font_height > screen_height)
+                wins[i].y = priv->cursor_y - MIN (priv->cursor_y,
+                                                  font_height);
+            break;
+        case FB_IM_WINDOW_STATUS:
+            wins[i].x = 0;
+            wins[i].y = screen_height - font_height;
+            break;
+        default:;
+        }
+    }
+}
+
+static void
+fb_im_client_get_colors (guint32  attr,
+                         guint8  *fc,
+                         guint8  *bc)
+{
+    *fc = FB_IM_COLOR_BLACK;
+    *bc = FB_IM_COLOR_GRAY;
+    if (attr & FB_IM_CELL_INVERSE) {
+        *fc = FB_IM_COLOR_GRAY;
+        *bc = FB_IM_COLOR_BLACK;
+    }
+    if (attr & FB_IM_CELL_BLUE_BG) {
+        *fc = FB_IM_COLOR_WHITE;
+        *bc = FB_IM_COLOR_DARK_BLUE;
+    }
+    if (attr & FB_IM_CELL_WARNING)
+        *fc = FB_IM_COLOR_DARK_RED;
+}
+
+/* The window is filled with the background and the cells of the same
+ * attributes are drawn with one FB_IM_MESSAGE_DRAW_TEXT.
+ */
+static void
+fb_im_client_draw_window (FbImClient    *client,
+                          const FbImWin *win,
+                          GArray        *cells)
+{
+    FbImClientPrivate *priv = client->priv;
+    guint columns = win->w / priv->info.font_width;
+    FbImMessage message;
+    GString *text;
+    guint start;
+    guint i;
+
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_FILL_RECT;
+    message.fill_rect.rect = *win;
+    message.fill_rect.color = FB_IM_COLOR_GRAY;
+    fb_im_client_send (client, &message, sizeof (message), NULL, 0);
+
+    text = g_string_new (NULL);
+    columns = MIN (columns, cells->len);
+    for (start = 0; start < columns; start = i) {
+        guint32 attr = g_array_index (cells, FbImCell, start).attr &
+                       ~FB_IM_CELL_WIDE_TAIL;
+
+        g_string_truncate (text, 0);
+        for (i = start; i < columns; i++) {
+            FbImCell *cell = &g_array_index (cells, FbImCell, i);
+
+            if ((cell->attr & ~FB_IM_CELL_WIDE_TAIL) != attr)
+                break;
+            /* The wide character is clipped at the right edge. */
+            if (i + 1 == columns && i + 1 < cells->len &&
+                (g_array_index (cells, FbImCell, i + 1).attr &
+                 FB_IM_CELL_WIDE_TAIL)) {
+                break;
+            }
+            if (!(cell->attr & FB_IM_CELL_WIDE_TAIL))
+                g_string_append_unichar (text, cell->ch);
+        }
+        if (i == start)
+            break;
+
+        memset (&message, 0, sizeof (message));
+        message.type = FB_IM_MESSAGE_DRAW_TEXT;
+        message.draw_text.x = win->x + start * priv->info.font_width;
+        message.draw_text.y = win->y;
+        fb_im_client_get_colors (attr,
+                                 &message.draw_text.fc,
+                                 &message.draw_text.bc);
+        fb_im_client_send (client,
+                           &message,
+                           G_STRUCT_OFFSET (FbImMessage, draw_text.texts),
+                           text->str,
+                           text->len);
+    }
+    g_string_free (text, TRUE);
+}
+
+static void
+fb_im_client_draw (FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    int i;
+
+    if (priv->info.font_width == 0)
+        return;
+    for (i = 0; i < FB_IM_N_WINDOWS; i++) {
+        if (priv->wins[i].w == 0)
+            continue;
+        fb_im_client_draw_window (client, &priv->wins[i], priv->cells[i]);
+    }
+}
+
+/* The terminal protects the windows from the shells after it replies
+ * FB_IM_MESSAGE_ACK_WINS and the windows are drawn then.  The same
+ * windows are redrawn without the round trip.
+ */
+static gboolean
+fb_im_client_render (gpointer user_data)
+{
+    FbImClient *client = FB_IM_CLIENT (user_data);
+    FbImClientPrivate *priv = client->priv;
+    FbImWin wins[FB_IM_N_WINDOWS];
+    FbImWin shown[FB_IM_N_WINDOWS];
+    FbImMessage message;
+    guint n_shown = 0;
+    int i;
+
+    priv->render_id = 0;
+
+    if (priv->waiting_ack || !priv->dirty)
+        return G_SOURCE_REMOVE;
+    priv->dirty = FALSE;
+
+    fb_im_client_layout (client, wins);
+    if (memcmp (wins, priv->wins, sizeof (wins)) == 0) {
+        fb_im_client_draw (client);
+        return G_SOURCE_REMOVE;
+    }
+
+    memcpy (priv->wins, wins, sizeof (wins));
+    for (i = 0; i < FB_IM_N_WINDOWS; i++) {
+        if (wins[i].w > 0)
+            shown[n_shown++] = wins[i];
+    }
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_SET_WINS;
+    fb_im_client_send (client,
+                       &message,
+                       FB_IM_MESSAGE_HEADER_SIZE,
+                       shown,
+                       n_shown * sizeof (FbImWin));
+    priv->waiting_ack = TRUE;
+    return G_SOURCE_REMOVE;
+}
+
+static void
+fb_im_client_queue_render (FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    priv->dirty = TRUE;
+    if (priv->render_id || priv->waiting_ack)
+        return;
+    priv->render_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                       fb_im_client_render,
+                                       client,
+                                       NULL);
+}
+
+static void
+fb_im_client_send_key (FbImClient  *client,
+                       const gchar *keys,
+                       gsize        length)
+{
+    FbImClientPrivate *priv = client->priv;
+    gchar *dispatched = NULL;
+    guint retval;
+
+    retval = FB_CONTEXT_GET_INTERFACE (priv->context)->filter_keypress (
+            priv->context, keys, length, &dispatched);
+    if (retval)
+        fb_im_client_send_text (client, dispatched, retval);
+    g_free (dispatched);
+}
+
+static void
+fb_im_client_set_term_mode (FbImClient        *client,
+                            const FbImMessage *message)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    priv->modes = 0;
+    if (message->term.cursor_esc_o)
+        priv->modes |= FB_KEYBOARD_MODE_CURSOR_KEY_ESC_O;
+    if (message->term.applic_keypad)
+        priv->modes |= FB_KEYBOARD_MODE_APPLIC_KEYPAD;
+    if (message->term.cr_with_lf)
+        priv->modes |= FB_KEYBOARD_MODE_CR_WITH_LF;
+    if (priv->keyboard)
+        fb_keyboard_set_modes (priv->keyboard, priv->modes);
+}
+
+static void
+fb_im_client_process_message (FbImClient        *client,
+                              const FbImMessage *message)
+{
+    FbImClientPrivate *priv = client->priv;
+    gsize length = message->length;
+
+    switch (message->type) {
+    case FB_IM_MESSAGE_DISCONNECT:
+        fb_im_client_hangup (FB_IO (client));
+        break;
+    case FB_IM_MESSAGE_ACTIVE:
+        priv->active = TRUE;
+        priv->ui_shown = TRUE;
+        fb_im_client_load_keymap (client);
+        FB_CONTEXT_GET_INTERFACE (priv->context)->load_settings (
+                priv->context);
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_DEACTIVE:
+        priv->active = FALSE;
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_SHOW_UI:
+        /* The windows are redrawn even if they are not changed. */
+        priv->ui_shown = TRUE;
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_HIDE_UI:
+        priv->ui_shown = FALSE;
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_SEND_KEY:
+        if (priv->active && length > FB_IM_MESSAGE_HEADER_SIZE) {
+            fb_im_client_send_key (client,
+                                   message->keys,
+                                   length - FB_IM_MESSAGE_HEADER_SIZE);
+        }
+        break;
+    case FB_IM_MESSAGE_SET_CURSOR:
+        if (length < G_STRUCT_OFFSET (FbImMessage, cursor) +
+                     sizeof (message->cursor)) {
+            break;
+        }
+        priv->cursor_x = message->cursor.x;
+        priv->cursor_y = message->cursor.y;
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_ACK_WINS:
+        if (!priv->waiting_ack)
+            break;
+        priv->waiting_ack = FALSE;
+        fb_im_client_draw (client);
+        if (priv->dirty)
+            fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_FBTERM_INFO:
+        if (length < G_STRUCT_OFFSET (FbImMessage, info) +
+                     sizeof (message->info)) {
+            break;
+        }
+        priv->info = message->info;
+        fb_im_client_queue_render (client);
+        break;
+    case FB_IM_MESSAGE_TERM_MODE:
+        if (length < G_STRUCT_OFFSET (FbImMessage, term) +
+                     sizeof (message->term)) {
+            break;
+        }
+        fb_im_client_set_term_mode (client, message);
+        break;
+    case FB_IM_MESSAGE_PING: {
+        FbImMessage ack;
+
+        memset (&ack, 0, sizeof (ack));
+        ack.type = FB_IM_MESSAGE_ACK_PING;
+        fb_im_client_send (client, &ack, sizeof (ack), NULL, 0);
+        break;
+    }
+    default:;
+    }
+}
+
+static void
+fb_im_client_ready_read (FbIo        *io,
+                         const gchar *buff,
+                         guint        length)
+{
+    FbImClient *client = FB_IM_CLIENT (io);
+    GString *input = client->priv->input;
+    gsize offset = 0;
+
+    g_string_append_len (input, buff, length);
+
+    while (input->len - offset >= FB_IM_MESSAGE_HEADER_SIZE) {
+        FbImMessage *message;
+        guint16 message_length;
+
+        memcpy (&message_length,
+                input->str + offset + G_STRUCT_OFFSET (FbImMessage, length),
+                sizeof (message_length));
+        if (message_length < FB_IM_MESSAGE_HEADER_SIZE) {
+            g_warning ("Broken IM message: length %u", message_length);
+            offset = input->len;
+            break;
+        }
+        if (input->len - offset < message_length)
+            break;
+
+        /* The copy is aligned and the fixed fields can be read even if
+         * the terminal sends the shorter message.
+         */
+        message = g_malloc0 (MAX (message_length, sizeof (FbImMessage)));
+        memcpy (message, input->str + offset, message_length);
+        fb_im_client_process_message (client, message);
+        g_free (message);
+        offset += message_length;
+    }
+    g_string_erase (input, 0, offset);
+}
+
+static void
+fb_im_client_hangup (FbIo *io)
+{
+    FbImClientPrivate *priv = FB_IM_CLIENT (io)->priv;
+
+    if (priv->hung_up)
+        return;
+    priv->hung_up = TRUE;
+    ibus_quit ();
+}
+
+static void
+fb_im_client_update_status (FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    GArray *cells = priv->cells[FB_IM_WINDOW_STATUS];
+    guint i;
+
+    g_array_set_size (cells, 0);
+    if (priv->warning) {
+        fb_im_client_put_text (cells, priv->warning, FB_IM_CELL_WARNING);
+        return;
+    }
+    if (priv->engine_name) {
+        fb_im_client_put_text (cells,
+                               priv->engine_name,
+                               FB_IM_CELL_INVERSE);
+    }
+    for (i = 0; i < priv->status_labels->len; i++) {
+        fb_im_client_put_text (cells, " ", 0);
+        fb_im_client_put_text (cells,
+                               g_ptr_array_index (priv->status_labels, i),
+                               0);
+    }
+}
+
+static void
+fb_context_warning_cb (FbContext   *context,
+                       const gchar *message,
+                       FbImClient  *client)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    /* The warning is shown until the next status change. */
+    g_free (priv->warning);
+    priv->warning = g_strdup (message);
+    fb_im_client_update_status (client);
+    fb_im_client_queue_render (client);
+}
+
+static int
+fb_context_switcher_switch_cb (FbContext       *context,
+                               IBusEngineDesc **engines,
+                               int              length,
+                               guint32          keyval,
+                               FbImClient      *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    GArray *cells = priv->cells[FB_IM_WINDOW_STATUS];
+    int index = priv->switcher_engine_index;
+    int i;
+
+    g_return_val_if_fail (engines != NULL, -1);
+
+    switch (keyval) {
+    case IBUS_KEY_Escape:
+    case IBUS_KEY_Return:
+        priv->switcher_engine_index = 0;
+        fb_im_client_update_status (client);
+        fb_im_client_queue_render (client);
+        return keyval == IBUS_KEY_Return ? index : -1;
+    case IBUS_KEY_Left:
+        index = index > 0 ? index - 1 : length - 1;
+        break;
+    case IBUS_KEY_Right:
+        index = index + 1 < length ? index + 1 : 0;
+        break;
+    default:
+        return -1;
+    }
+
+    priv->switcher_engine_index = index;
+    g_array_set_size (cells, 0);
+    for (i = 0; i < length; i++) {
+        if (i > 0)
+            fb_im_client_put_text (cells, " ", 0);
+        fb_im_client_put_text (cells,
+                               ibus_engine_desc_get_longname (engines[i]),
+                               i == index ? FB_IM_CELL_INVERSE : 0);
+    }
+    fb_im_client_queue_render (client);
+    return -1;
+}
+
+static guint32
+fb_context_keysym_to_keycode_cb (FbContext  *context,
+                                 guint32     keysym,
+                                 FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    guint32 keycode;
+
+    fb_im_client_load_keymap (client);
+    for (keycode = 0; keycode < NR_KEYS; keycode++) {
+        if (priv->keymap[keycode] == keysym)
+            return keycode;
+    }
+    return 0;
+}
+
+static void
+fb_context_engine_changed_cb (FbContext      *context,
+                              IBusEngineDesc *engine,
+                              FbImClient     *client)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    g_free (priv->engine_name);
+    priv->engine_name = g_strdup (ibus_engine_desc_get_longname (engine));
+    g_clear_pointer (&priv->warning, g_free);
+    fb_im_client_update_status (client);
+    fb_im_client_queue_render (client);
+}
+
+static void
+fb_context_keymap_changed_cb (FbContext  *context,
+                              FbImClient *client)
+{
+    FbImClientPrivate *priv = client->priv;
+
+    /* They are read again when they are used next. */
+    g_clear_pointer (&priv->keymap, g_free);
+    g_clear_pointer (&priv->keyboard, fb_keyboard_free);
+}
+
+static void
+fb_context_commit_cb (FbContext  *context,
+                      IBusText   *text,
+                      FbImClient *client)
+{
+    fb_im_client_send_text (client, text->text, strlen (text->text));
+}
+
+/* The whole preedit is drawn in the inverse color and the sub segment,
+ * e.g. the converted clause, is drawn in the blue background.
+ */
+static void
+fb_context_preedit_changed_cb (FbContext  *context,
+                               IBusText   *text,
+                               guint       cursor_pos,
+                               gboolean    visible,
+                               FbImClient *client)
+{
+    GArray *cells = client->priv->cells[FB_IM_WINDOW_PREEDIT];
+    glong n_chars = g_utf8_strlen (text->text, -1);
+    guint sub_start = 0;
+    guint sub_end = 0;
+    guint32 whole_attr = 0;
+    const gchar *p;
+    guint i;
+
+    if (text->attrs) {
+        for (i = 0; ; i++) {
+            IBusAttribute *attr = ibus_attr_list_get (text->attrs, i);
+
+            if (attr == NULL)
+                break;
+            if (attr->type != IBUS_ATTR_TYPE_UNDERLINE &&
+                attr->type != IBUS_ATTR_TYPE_FOREGROUND &&
+                attr->type != IBUS_ATTR_TYPE_BACKGROUND)
+                continue;
+
+            if (attr->start_index == 0 && attr->end_index >= n_chars) {
+                whole_attr = FB_IM_CELL_INVERSE;
+            } else {
+                sub_start = attr->start_index;
+                sub_end = attr->end_index;
+            }
+        }
+    }
+
+    g_array_set_size (cells, 0);
+    fb_im_client_queue_render (client);
+
+    if (!visible)
+        return;
+
+    for (p = text->text, i = 0; *p; p = g_utf8_next_char (p), i++) {
+        guint32 attr = whole_attr;
+
+        if (i >= sub_start && i < sub_end)
+            attr |= FB_IM_CELL_BLUE_BG;
+        fb_im_client_put_char (cells, g_utf8_get_char (p), attr);
+    }
+}
+
+static void
+fb_context_update_lookup_table_cb (FbContext       *context,
+                                   IBusLookupTable *table,
+                                   gboolean         visible,
+                                   FbImClient      *client)
+{
+    GArray *cells = client->priv->cells[FB_IM_WINDOW_LOOKUP_TABLE];
+    guint page_size;
+    guint ncandidates;
+    guint cursor;
+    guint cursor_in_page;
+    guint page_start_pos;
+    guint page_end_pos;
+    gboolean show_cursor;
+    guint i;
+
+    g_array_set_size (cells, 0);
+    fb_im_client_queue_render (client);
+
+    if (!visible)
+        return;
+
+    page_size = MAX (ibus_lookup_table_get_page_size (table), 1);
+    ncandidates = ibus_lookup_table_get_number_of_candidates (table);
+    cursor = ibus_lookup_table_get_cursor_pos (table);
+    cursor_in_page = ibus_lookup_table_get_cursor_in_page (table);
+    page_start_pos = cursor / page_size * page_size;
+    page_end_pos = MIN (page_start_pos + page_size, ncandidates);
+    show_cursor = ibus_lookup_table_is_cursor_visible (table);
+
+    for (i = page_start_pos; i < page_end_pos; i++) {
+        IBusText *candidate = ibus_lookup_table_get_candidate (table, i);
+        guint index = i - page_start_pos;
+        IBusText *label = ibus_lookup_table_get_label (table, index);
+        guint32 attr = 0;
+        gchar index_str[16];
+
+        if (show_cursor && index == cursor_in_page)
+            attr = FB_IM_CELL_INVERSE;
+        if (index > 0)
+            fb_im_client_put_text (cells, " ", 0);
+        if (label == NULL) {
+            g_snprintf (index_str, sizeof (index_str), "%u", index);
+            fb_im_client_put_text (cells, index_str, attr);
+        } else {
+            fb_im_client_put_text (cells, label->text, attr);
+        }
+        fb_im_client_put_text (cells, ". ", attr);
+        fb_im_client_put_text (cells, candidate->text, attr);
+    }
+}
+
+static void
+fb_context_register_properties_cb (FbContext    *context,
+                                   IBusPropList *props,
+                                   FbImClient   *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    int i;
+
+    g_ptr_array_set_size (priv->status_keys, 0);
+    g_ptr_array_set_size (priv->status_labels, 0);
+    for (i = 0; ; i++) {
+        IBusProperty *prop = ibus_prop_list_get (props, i);
+
+        if (prop == NULL)
+            break;
+        g_ptr_array_add (priv->status_keys,
+                         g_strdup (ibus_property_get_key (prop)));
+        g_ptr_array_add (priv->status_labels,
+                         g_strdup (ibus_property_get_label (prop)->text));
+    }
+    g_clear_pointer (&priv->warning, g_free);
+    fb_im_client_update_status (client);
+    fb_im_client_queue_render (client);
+}
+
+static void
+fb_context_update_property_cb (FbContext    *context,
+                               IBusProperty *prop,
+                               FbImClient   *client)
+{
+    FbImClientPrivate *priv = client->priv;
+    const gchar *key = ibus_property_get_key (prop);
+    const gchar *label = ibus_property_get_label (prop)->text;
+    guint i;
+
+    for (i = 0; i < priv->status_keys->len; i++) {
+        if (g_strcmp0 (g_ptr_array_index (priv->status_keys, i), key) == 0)
+            break;
+    }
+    /* The unknown keys are ignored after the labels are registered
+     * as fbshell.c does.
+     */
+    if (i == priv->status_keys->len) {
+        if (priv->status_keys->len > 0)
+            return;
+        g_ptr_array_add (priv->status_keys, g_strdup (key));
+        g_ptr_array_add (priv->status_labels, g_strdup (label));
+    } else if (g_strcmp0 (g_ptr_array_index (priv->status_labels, i),
+                          label) != 0) {
+        g_free (g_ptr_array_index (priv->status_labels, i));
+        g_ptr_array_index (priv->status_labels, i) = g_strdup (label);
+    } else {
+        return;
+    }
+    g_clear_pointer (&priv->warning, g_free);
+    fb_im_client_update_status (client);
+    fb_im_client_queue_render (client);
+}
+
+/* The forwarded key is translated as the Linux console does because
+ * the terminal passes FB_IM_MESSAGE_PUT_TEXT to the shell as it is.
+ */
+static void
+fb_context_forward_key_event_cb (FbContext  *context,
+                                 guint       keyval,
+                                 guint       keycode,
+                                 guint       state,
+                                 FbImClient *client)
+{
+    FbKeyEvent event;
+    const gchar *buff;
+    gsize length = 0;
+
+    event.keycode = keycode;
+    event.keyval = keyval;
+    event.modifiers = state;
+    buff = fb_keyboard_event_to_string (fb_im_client_get_keyboard (client),
+                                        &event,
+                                        &length);
+    if (length > 0)
+        fb_im_client_send_text (client, buff, length);
+}
+
+FbImClient *
+fb_im_client_new (int        fd,
+                  FbContext *context)
+{
+    FbImClient *client;
+    FbImClientPrivate *priv;
+    FbImMessage message;
+
+    g_return_val_if_fail (fd >= 0, NULL);
+    g_return_val_if_fail (IS_FB_CONTEXT (context), NULL);
+
+    client = g_object_new (FB_TYPE_IM_CLIENT, NULL);
+    priv = client->priv;
+
+    priv->context = g_object_ref_sink (context);
+    g_object_connect (priv->context,
+                      "signal::user-warning",
+                      (GCallback)fb_context_warning_cb,
+                      client,
+                      "signal::switcher-switch",
+                      (GCallback)fb_context_switcher_switch_cb,
+                      client,
+                      "signal::keysym-to-keycode",
+                      (GCallback)fb_context_keysym_to_keycode_cb,
+                      client,
+                      "signal::engine-changed",
+                      (GCallback)fb_context_engine_changed_cb,
+                      client,
+                      "signal::keymap-changed",
+                      (GCallback)fb_context_keymap_changed_cb,
+                      client,
+                      "signal::commit",
+                      (GCallback)fb_context_commit_cb,
+                      client,
+                      "signal::preedit-changed",
+                      (GCallback)fb_context_preedit_changed_cb,
+                      client,
+                      "signal::update-lookup-table",
+                      (GCallback)fb_context_update_lookup_table_cb,
+                      client,
+                      "signal::register-properties",
+                      (GCallback)fb_context_register_properties_cb,
+                      client,
+                      "signal::update-property",
+                      (GCallback)fb_context_update_property_cb,
+                      client,
+                      "signal::forward-key-event",
+                      (GCallback)fb_context_forward_key_event_cb,
+                      client,
+                      NULL);
+
+    fb_io_set_fd (FB_IO (client), fd);
+
+    /* The terminal translates the keys to the sequences. */
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_CONNECT;
+    message.raw = 0;
+    fb_im_client_send (client, &message, sizeof (message), NULL, 0);
+    return client;
+}
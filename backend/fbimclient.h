@@ -0,0 +1,212 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_IM_CLIENT_H_
+#define __FB_IM_CLIENT_H_
+
+#include <glib-object.h>
+
+#include "fbcontext.h"
+#include "fbio.h"
+
+/*
+ * Type macros.
+ */
+
+/* define GOBJECT macros */
+#define FB_TYPE_IM_CLIENT                       (fb_im_client_get_type ())
+#define FB_IM_CLIENT(o)                         (G_TYPE_CHECK_INSTANCE_CAST ((o), FB_TYPE_IM_CLIENT, FbImClient))
+#define FB_IM_CLIENT_CLASS(k)                   (G_TYPE_CHECK_CLASS_CAST ((k), FB_TYPE_IM_CLIENT, FbImClientClass))
+#define FB_IS_IM_CLIENT(o)                      (G_TYPE_CHECK_INSTANCE_TYPE ((o), FB_TYPE_IM_CLIENT))
+#define FB_IS_IM_CLIENT_CLASS(k)                (G_TYPE_CHECK_CLASS_TYPE ((k), FB_TYPE_IM_CLIENT))
+
+/* fbterm passes the socket of the input method with this variable. */
+#define FB_IM_SOCKET_ENV                        "FBTERM_IM_SOCKET"
+
+G_BEGIN_DECLS
+typedef struct _FbImClient FbImClient;
+typedef struct _FbImClientPrivate FbImClientPrivate;
+typedef struct _FbImClientClass FbImClientClass;
+
+/**
+ * FbImMessageType:
+ *
+ * The message types of imapi.h of fbterm.
+ * %FB_IM_MESSAGE_CONNECT, %FB_IM_MESSAGE_PUT_TEXT,
+ * %FB_IM_MESSAGE_SET_WINS, %FB_IM_MESSAGE_FILL_RECT,
+ * %FB_IM_MESSAGE_DRAW_TEXT and %FB_IM_MESSAGE_ACK_PING are sent by
+ * the input method and the others are sent by the terminal.
+ */
+typedef enum {
+    FB_IM_MESSAGE_CONNECT = 0,
+    FB_IM_MESSAGE_DISCONNECT,
+    FB_IM_MESSAGE_ACTIVE,
+    FB_IM_MESSAGE_DEACTIVE,
+    FB_IM_MESSAGE_SHOW_UI,
+    FB_IM_MESSAGE_HIDE_UI,
+    FB_IM_MESSAGE_SEND_KEY,
+    FB_IM_MESSAGE_PUT_TEXT,
+    FB_IM_MESSAGE_SET_CURSOR,
+    FB_IM_MESSAGE_SET_WINS,
+    FB_IM_MESSAGE_ACK_WINS,
+    FB_IM_MESSAGE_FILL_RECT,
+    FB_IM_MESSAGE_DRAW_TEXT,
+    FB_IM_MESSAGE_FBTERM_INFO,
+    FB_IM_MESSAGE_TERM_MODE,
+    FB_IM_MESSAGE_PING,
+    FB_IM_MESSAGE_ACK_PING
+} FbImMessageType;
+
+/* The maximum number of the windows in %FB_IM_MESSAGE_SET_WINS */
+#define FB_IM_MAX_WINDOWS                       10
+
+/**
+ * FbImColor:
+ *
+ * The palette indexes of the terminal.
+ */
+typedef enum {
+    FB_IM_COLOR_BLACK = 0,
+    FB_IM_COLOR_DARK_RED,
+    FB_IM_COLOR_DARK_GREEN,
+    FB_IM_COLOR_DARK_YELLOW,
+    FB_IM_COLOR_DARK_BLUE,
+    FB_IM_COLOR_DARK_MAGENTA,
+    FB_IM_COLOR_DARK_CYAN,
+    FB_IM_COLOR_GRAY,
+    FB_IM_COLOR_DARK_GRAY,
+    FB_IM_COLOR_RED,
+    FB_IM_COLOR_GREEN,
+    FB_IM_COLOR_YELLOW,
+    FB_IM_COLOR_BLUE,
+    FB_IM_COLOR_MAGENTA,
+    FB_IM_COLOR_CYAN,
+    FB_IM_COLOR_WHITE
+} FbImColor;
+
+/**
+ * FbImWin:
+ *
+ * The window rectangle in pixels.
+ */
+typedef struct {
+    guint32 x;
+    guint32 y;
+    guint32 w;
+    guint32 h;
+} FbImWin;
+
+/**
+ * FbImInfo:
+ *
+ * The payload of %FB_IM_MESSAGE_FBTERM_INFO in pixels.
+ */
+typedef struct {
+    guint32 font_height;
+    guint32 font_width;
+    guint32 screen_height;
+    guint32 screen_width;
+} FbImInfo;
+
+/**
+ * FbImMessage:
+ * @type: A #FbImMessageType
+ * @length: The message length including @type and @length.
+ * @raw: Non-zero if the input method wants the scancodes.
+ * @redraw: Non-zero if the terminal cleared the windows.
+ * @keys: The key sequences of %FB_IM_MESSAGE_SEND_KEY.
+ * @texts: The UTF-8 text of %FB_IM_MESSAGE_PUT_TEXT.
+ * @wins: The windows of %FB_IM_MESSAGE_SET_WINS.
+ *
+ * The messages of imapi.h in the host byte order.  The variable
+ * length arrays are not terminated with nul and the number of
+ * the elements is calculated from @length.  The windows of
+ * %FB_IM_MESSAGE_SET_WINS are protected from the shell and
+ * %FB_IM_MESSAGE_FILL_RECT and %FB_IM_MESSAGE_DRAW_TEXT are
+ * accepted after %FB_IM_MESSAGE_ACK_WINS.
+ */
+typedef struct {
+    guint16 type;
+    guint16 length;
+    union {
+        gchar   raw;
+        gchar   redraw;
+        gchar   keys[0];
+        gchar   texts[0];
+        FbImWin wins[0];
+        struct {
+            guint32 x;
+            guint32 y;
+        } cursor;
+        FbImInfo info;
+        struct {
+            gchar   cr_with_lf;
+            gchar   applic_keypad;
+            gchar   cursor_esc_o;
+        } term;
+        struct {
+            FbImWin rect;
+            guint8  color;
+        } fill_rect;
+        struct {
+            guint32 x;
+            guint32 y;
+            guint8  fc;
+            guint8  bc;
+            gchar   texts[0];
+        } draw_text;
+    };
+} FbImMessage;
+
+#define FB_IM_MESSAGE_HEADER_SIZE               G_STRUCT_OFFSET (FbImMessage, raw)
+
+/**
+ * FbImClient:
+ *
+ * <structname>FbImClient</structname> is the input method of fbterm.
+ * The preedit, the lookup table and the status are drawn by
+ * the terminal in the windows of %FB_IM_MESSAGE_SET_WINS instead of
+ * the escape sequences.
+ */
+struct _FbImClient {
+    FbIo               parent;
+    FbImClientPrivate *priv;
+};
+
+struct _FbImClientClass {
+    FbIoClass parent;
+};
+
+GType            fb_im_client_get_type             (void);
+
+/**
+ * fb_im_client_new:
+ * @fd: The socket of %FB_IM_SOCKET_ENV
+ * @context: The #FbContext which converts the keys.
+ *
+ * Connects to the terminal with @fd.
+ *
+ * Returns: A newly allocated #FbImClient
+ */
+FbImClient      *fb_im_client_new                  (int          fd,
+                                                    FbContext   *context);
+
+G_END_DECLS
+#endif
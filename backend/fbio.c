@@ -46,6 +46,7 @@ static void         fb_io_destroy            (FbIo       *io);
 static void         fb_io_real_ready_read    (FbIo         *io,
                                               const gchar  *buff,
                                               guint         length);
+static void         fb_io_real_hangup        (FbIo         *io);
 static void         fb_io_write_io           (FbIo *io,
                                               const gchar  *buff,
                                               guint         length);
@@ -68,6 +69,7 @@ fb_io_class_init (FbIoClass *class)
     //GObjectClass *gobject_class = G_OBJECT_CLASS (class);
     IBUS_OBJECT_CLASS (class)->destroy = (IBusObjectDestroyFunc)fb_io_destroy;
     class->ready_read = fb_io_real_ready_read;
+    class->hangup = fb_io_real_hangup;
 }
 
 static void
@@ -107,6 +109,12 @@ fb_io_real_ready_read (FbIo        *io,
 {
 }
 
+static void
+fb_io_real_hangup (FbIo *io)
+{
+    g_object_unref (io);
+}
+
 static void
 fb_io_write_io (FbIo        *io,
                 const gchar *buff,
@@ -188,7 +196,7 @@ fb_io_watch_cb (GIOChannel   *source,
     if (condition & G_IO_OUT)
         fb_io_ready (io, FALSE);
     if (condition & G_IO_HUP) {
-        g_object_unref (io);
+        FB_IO_GET_CLASS (io)->hangup (io);
         retval = TRUE;
     }
     if (condition & G_IO_ERR)
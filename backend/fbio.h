@@ -71,7 +71,16 @@ struct _FbIoClass {
                              const gchar *buff,
                              guint        length);
 
-    gpointer dummy[5];
+    /**
+     * FbIoClass::hangup:
+     * @io: A #FbIo.
+     *
+     * The ::hangup class method is called when the peer closes
+     * the file descriptor.  The default method unrefs @io.
+     */
+    void (* hangup)         (FbIo        *io);
+
+    gpointer dummy[4];
 };
 
 GType            fb_io_get_type                  (void);
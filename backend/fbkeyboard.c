@@ -0,0 +1,636 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+#include <ibus.h>
+
+#include <string.h>
+#include <sys/ioctl.h>
+
+#include <linux/kd.h>
+#include <linux/keyboard.h>
+
+#include "fbkeyboard.h"
+
+/* The keysyms are looked up with the shift and altgr tables only and
+ * the control and alt keys are reported as the modifiers.
+ */
+#define NR_TABLES       4
+#define NR_FUNC_STRINGS 30
+
+#define KEYCODE_LEFTMETA  125
+#define KEYCODE_RIGHTMETA 126
+
+#define SHIFT_BITS      ((1 << KG_SHIFT) | (1 << KG_SHIFTL) | (1 << KG_SHIFTR))
+#define CTRL_BITS       ((1 << KG_CTRL) | (1 << KG_CTRLL) | (1 << KG_CTRLR))
+
+struct _FbKeyboard {
+    int             fd;
+    guint8          shift_down[KG_CAPSSHIFT + 1];
+    guint           shift_state;
+    gboolean        super_down;
+    gboolean        caps_lock;
+    gboolean        num_lock;
+    guint           pending;
+    guint           pending_keycode;
+    gboolean        pending_release;
+    gboolean        has_table[NR_TABLES];
+    guint16         table[NR_TABLES][NR_KEYS];
+    gchar          *func_strings[NR_FUNC_STRINGS];
+    GString        *string;
+    guint           modes;
+};
+
+FbKeyboard *
+fb_keyboard_new (int fd)
+{
+    FbKeyboard *keyboard = g_slice_new0 (FbKeyboard);
+
+    keyboard->fd = fd;
+    keyboard->string = g_string_new (NULL);
+    return keyboard;
+}
+
+void
+fb_keyboard_free (FbKeyboard *keyboard)
+{
+    int i;
+
+    g_return_if_fail (keyboard != NULL);
+
+    for (i = 0; i < NR_FUNC_STRINGS; i++)
+        g_free (keyboard->func_strings[i]);
+    g_string_free (keyboard->string, TRUE);
+    g_slice_free (FbKeyboard, keyboard);
+}
+
+void
+fb_keyboard_load_keymap (FbKeyboard *keyboard)
+{
+    int table;
+    int keycode;
+    int i;
+
+    g_return_if_fail (keyboard != NULL);
+
+    for (table = 0; table < NR_TABLES; table++) {
+        keyboard->has_table[table] = FALSE;
+        for (keycode = 0; keycode < NR_KEYS; keycode++) {
+            struct kbentry entry;
+
+            entry.kb_table = table;
+            entry.kb_index = keycode;
+            entry.kb_value = K_HOLE;
+            ioctl (keyboard->fd, KDGKBENT, &entry);
+            if (keycode == 0 && entry.kb_value == K_NOSUCHMAP)
+                break;
+            keyboard->table[table][keycode] = entry.kb_value;
+            keyboard->has_table[table] = TRUE;
+        }
+    }
+
+    for (i = 0; i < NR_FUNC_STRINGS; i++) {
+        struct kbsentry entry;
+
+        g_free (keyboard->func_strings[i]);
+        keyboard->func_strings[i] = NULL;
+        entry.kb_func = i;
+        if (ioctl (keyboard->fd, KDGKBSENT, &entry) < 0)
+            continue;
+        entry.kb_string[sizeof (entry.kb_string) - 1] = '\0';
+        if (entry.kb_string[0] != '\0')
+            keyboard->func_strings[i] = g_strdup ((gchar *)entry.kb_string);
+    }
+}
+
+void
+fb_keyboard_reset (FbKeyboard *keyboard)
+{
+    char leds = 0;
+
+    g_return_if_fail (keyboard != NULL);
+
+    memset (keyboard->shift_down, 0, sizeof (keyboard->shift_down));
+    keyboard->shift_state = 0;
+    keyboard->super_down = FALSE;
+    keyboard->pending = 0;
+
+    if (ioctl (keyboard->fd, KDGKBLED, &leds) == 0) {
+        keyboard->caps_lock = (leds & K_CAPSLOCK) != 0;
+        keyboard->num_lock = (leds & K_NUMLOCK) != 0;
+    }
+}
+
+static guint16
+fb_keyboard_lookup (FbKeyboard *keyboard,
+                    guint       table,
+                    guint       keycode)
+{
+    if (table >= NR_TABLES || !keyboard->has_table[table])
+        table = 0;
+    if (!keyboard->has_table[table])
+        return K_HOLE;
+    return keyboard->table[table][keycode];
+}
+
+static guint
+fb_keyboard_dead_to_keyval (guint value)
+{
+    switch (value) {
+    case '`':
+        return IBUS_KEY_dead_grave;
+    case '\'':
+    case 0xb4:
+        return IBUS_KEY_dead_acute;
+    case '^':
+        return IBUS_KEY_dead_circumflex;
+    case '~':
+        return IBUS_KEY_dead_tilde;
+    case '"':
+    case 0xa8:
+        return IBUS_KEY_dead_diaeresis;
+    case ',':
+    case 0xb8:
+        return IBUS_KEY_dead_cedilla;
+    default:;
+    }
+    return 0;
+}
+
+static guint
+fb_keyboard_entry_to_keyval (FbKeyboard *keyboard,
+                             guint16     entry)
+{
+    static const guint dead_keyvals[] = {
+        IBUS_KEY_dead_grave, IBUS_KEY_dead_acute, IBUS_KEY_dead_circumflex,
+        IBUS_KEY_dead_tilde, IBUS_KEY_dead_diaeresis, IBUS_KEY_dead_cedilla
+    };
+    static const guint pad_keyvals[] = {
+        IBUS_KEY_KP_Insert, IBUS_KEY_KP_End, IBUS_KEY_KP_Down,
+        IBUS_KEY_KP_Page_Down, IBUS_KEY_KP_Left, IBUS_KEY_KP_Begin,
+        IBUS_KEY_KP_Right, IBUS_KEY_KP_Home, IBUS_KEY_KP_Up,
+        IBUS_KEY_KP_Page_Up, IBUS_KEY_KP_Add, IBUS_KEY_KP_Subtract,
+        IBUS_KEY_KP_Multiply, IBUS_KEY_KP_Divide, IBUS_KEY_KP_Enter,
+        IBUS_KEY_KP_Separator, IBUS_KEY_KP_Delete
+    };
+    static const guint cur_keyvals[] = {
+        IBUS_KEY_Down, IBUS_KEY_Left, IBUS_KEY_Right, IBUS_KEY_Up
+    };
+    static const guint shift_keyvals[] = {
+        IBUS_KEY_Shift_L, IBUS_KEY_ISO_Level3_Shift, IBUS_KEY_Control_L,
+        IBUS_KEY_Alt_L, IBUS_KEY_Shift_L, IBUS_KEY_Shift_R,
+        IBUS_KEY_Control_L, IBUS_KEY_Control_R
+    };
+    guint type = KTYP (entry);
+    guint value = KVAL (entry);
+
+    /* KDGKBENT returns the Unicode keysyms with U+F000 xor-ed. */
+    if (type >= NR_TYPES)
+        return ibus_unicode_to_keyval (entry ^ 0xf000);
+
+    switch (type) {
+    case KT_LATIN:
+    case KT_LETTER:
+    case KT_META:
+        switch (value) {
+        case 0x08:
+        case 0x7f:
+            return IBUS_KEY_BackSpace;
+        case 0x09:
+            return IBUS_KEY_Tab;
+        case 0x0a:
+        case 0x0d:
+            return IBUS_KEY_Return;
+        case 0x1b:
+            return IBUS_KEY_Escape;
+        default:;
+        }
+        if (value < 0x20)
+            return 0;
+        return ibus_unicode_to_keyval (value);
+    case KT_FN:
+        if (value < 12)
+            return IBUS_KEY_F1 + value;
+        if (value < 20)
+            return IBUS_KEY_F13 + value - 12;
+        switch (entry) {
+        case K_FIND:
+            return IBUS_KEY_Home;
+        case K_INSERT:
+            return IBUS_KEY_Insert;
+        case K_REMOVE:
+            return IBUS_KEY_Delete;
+        case K_SELECT:
+            return IBUS_KEY_End;
+        case K_PGUP:
+            return IBUS_KEY_Page_Up;
+        case K_PGDN:
+            return IBUS_KEY_Page_Down;
+        case K_HELP:
+            return IBUS_KEY_Help;
+        case K_PAUSE:
+            return IBUS_KEY_Pause;
+        default:;
+        }
+        return 0;
+    case KT_SPEC:
+        switch (entry) {
+        case K_ENTER:
+            return IBUS_KEY_Return;
+        case K_CAPS:
+            return IBUS_KEY_Caps_Lock;
+        case K_NUM:
+        case K_BARENUMLOCK:
+            return IBUS_KEY_Num_Lock;
+        case K_COMPOSE:
+            return IBUS_KEY_Multi_key;
+        default:;
+        }
+        return 0;
+    case KT_PAD:
+        if (value <= 9 && keyboard->num_lock)
+            return IBUS_KEY_KP_0 + value;
+        if (entry == K_PDOT && keyboard->num_lock)
+            return IBUS_KEY_KP_Decimal;
+        if (entry == K_PDOT)
+            return IBUS_KEY_KP_Delete;
+        if (value < G_N_ELEMENTS (pad_keyvals))
+            return pad_keyvals[value];
+        return 0;
+    case KT_DEAD:
+        if (value < G_N_ELEMENTS (dead_keyvals))
+            return dead_keyvals[value];
+        return 0;
+    case KT_DEAD2:
+        return fb_keyboard_dead_to_keyval (value);
+    case KT_CUR:
+        if (value < G_N_ELEMENTS (cur_keyvals))
+            return cur_keyvals[value];
+        return 0;
+    case KT_SHIFT:
+        if (value < G_N_ELEMENTS (shift_keyvals))
+            return shift_keyvals[value];
+        return 0;
+    default:;
+    }
+    return 0;
+}
+
+static guint
+fb_keyboard_get_modifiers (FbKeyboard *keyboard)
+{
+    guint modifiers = 0;
+
+    if (keyboard->shift_state & SHIFT_BITS)
+        modifiers |= IBUS_SHIFT_MASK;
+    if (keyboard->shift_state & CTRL_BITS)
+        modifiers |= IBUS_CONTROL_MASK;
+    if (keyboard->shift_state & (1 << KG_ALT))
+        modifiers |= IBUS_MOD1_MASK;
+    if (keyboard->shift_state & (1 << KG_ALTGR))
+        modifiers |= IBUS_MOD5_MASK;
+    if (keyboard->super_down)
+        modifiers |= IBUS_SUPER_MASK;
+    if (keyboard->caps_lock)
+        modifiers |= IBUS_LOCK_MASK;
+    if (keyboard->num_lock)
+        modifiers |= IBUS_MOD2_MASK;
+    return modifiers;
+}
+
+static void
+fb_keyboard_update_shift (FbKeyboard *keyboard,
+                          guint       value,
+                          gboolean    release)
+{
+    if (value > KG_CAPSSHIFT)
+        return;
+
+    if (!release) {
+        if (keyboard->shift_down[value] < G_MAXUINT8)
+            keyboard->shift_down[value]++;
+    } else if (keyboard->shift_down[value] > 0) {
+        keyboard->shift_down[value]--;
+    }
+
+    if (keyboard->shift_down[value])
+        keyboard->shift_state |= 1 << value;
+    else
+        keyboard->shift_state &= ~(1 << value);
+}
+
+gboolean
+fb_keyboard_feed (FbKeyboard *keyboard,
+                  guchar      scancode,
+                  FbKeyEvent *event)
+{
+    guint keycode;
+    gboolean release;
+    guint table;
+    guint16 entry;
+
+    g_return_val_if_fail (keyboard != NULL, FALSE);
+    g_return_val_if_fail (event != NULL, FALSE);
+
+    /* The keycodes >= 128 are sent with three bytes:
+     * the release bit, 0x80 | (keycode >> 7), 0x80 | (keycode & 0x7f)
+     */
+    if (keyboard->pending) {
+        keyboard->pending_keycode <<= 7;
+        keyboard->pending_keycode |= scancode & 0x7f;
+        if (--keyboard->pending)
+            return FALSE;
+        keycode = keyboard->pending_keycode;
+        release = keyboard->pending_release;
+    } else if ((scancode & 0x7f) == 0) {
+        keyboard->pending = 2;
+        keyboard->pending_keycode = 0;
+        keyboard->pending_release = (scancode & 0x80) != 0;
+        return FALSE;
+    } else {
+        keycode = scancode & 0x7f;
+        release = (scancode & 0x80) != 0;
+    }
+
+    if (keycode >= NR_KEYS)
+        return FALSE;
+
+    event->keycode = keycode;
+    event->modifiers = fb_keyboard_get_modifiers (keyboard);
+    if (release)
+        event->modifiers |= IBUS_RELEASE_MASK;
+
+    /* The kernel keymap has no super modifier. */
+    if (keycode == KEYCODE_LEFTMETA || keycode == KEYCODE_RIGHTMETA) {
+        keyboard->super_down = !release;
+        event->keyval = (keycode == KEYCODE_LEFTMETA) ? IBUS_KEY_Super_L
+                                                      : IBUS_KEY_Super_R;
+        return TRUE;
+    }
+
+    table = 0;
+    if (keyboard->shift_state & SHIFT_BITS)
+        table |= 1 << KG_SHIFT;
+    if (keyboard->shift_state & (1 << KG_ALTGR))
+        table |= 1 << KG_ALTGR;
+    entry = fb_keyboard_lookup (keyboard, table, keycode);
+
+    /* The Unicode keysyms are characters and do not change the state. */
+    switch (KTYP (entry) < NR_TYPES ? KTYP (entry) : NR_TYPES) {
+    case KT_SHIFT:
+        fb_keyboard_update_shift (keyboard, KVAL (entry), release);
+        break;
+    case KT_LETTER:
+        if (keyboard->caps_lock)
+            entry = fb_keyboard_lookup (keyboard, table ^ (1 << KG_SHIFT),
+                                        keycode);
+        break;
+    case KT_SPEC:
+        if (release)
+            break;
+        if (entry == K_CAPS)
+            keyboard->caps_lock = !keyboard->caps_lock;
+        else if (entry == K_NUM || entry == K_BARENUMLOCK)
+            keyboard->num_lock = !keyboard->num_lock;
+        break;
+    default:;
+    }
+
+    event->keyval = fb_keyboard_entry_to_keyval (keyboard, entry);
+    return event->keyval != 0;
+}
+
+static const gchar *
+fb_keyboard_get_func_string (FbKeyboard *keyboard,
+                             guint       keyval)
+{
+    guint func = NR_FUNC_STRINGS;
+
+    if (keyval >= IBUS_KEY_F1 && keyval <= IBUS_KEY_F20) {
+        func = keyval - IBUS_KEY_F1;
+    } else {
+        switch (keyval) {
+        case IBUS_KEY_Home:
+        case IBUS_KEY_KP_Home:
+            func = KVAL (K_FIND);
+            break;
+        case IBUS_KEY_Insert:
+        case IBUS_KEY_KP_Insert:
+            func = KVAL (K_INSERT);
+            break;
+        case IBUS_KEY_Delete:
+        case IBUS_KEY_KP_Delete:
+            func = KVAL (K_REMOVE);
+            break;
+        case IBUS_KEY_End:
+        case IBUS_KEY_KP_End:
+            func = KVAL (K_SELECT);
+            break;
+        case IBUS_KEY_Page_Up:
+        case IBUS_KEY_KP_Page_Up:
+            func = KVAL (K_PGUP);
+            break;
+        case IBUS_KEY_Page_Down:
+        case IBUS_KEY_KP_Page_Down:
+            func = KVAL (K_PGDN);
+            break;
+        case IBUS_KEY_Help:
+            func = KVAL (K_HELP);
+            break;
+        case IBUS_KEY_Pause:
+            func = KVAL (K_PAUSE);
+            break;
+        default:;
+        }
+    }
+
+    if (func >= NR_FUNC_STRINGS)
+        return NULL;
+    return keyboard->func_strings[func];
+}
+
+void
+fb_keyboard_set_modes (FbKeyboard *keyboard,
+                       guint       modes)
+{
+    g_return_if_fail (keyboard != NULL);
+
+    keyboard->modes = modes;
+}
+
+/* The keypad characters follow app_map in drivers/tty/vt/keyboard.c */
+static gchar
+fb_keyboard_get_applic_keypad_char (guint keyval)
+{
+    switch (keyval) {
+    case IBUS_KEY_KP_0:
+    case IBUS_KEY_KP_Insert:
+        return 'p';
+    case IBUS_KEY_KP_1:
+    case IBUS_KEY_KP_End:
+        return 'q';
+    case IBUS_KEY_KP_2:
+    case IBUS_KEY_KP_Down:
+        return 'r';
+    case IBUS_KEY_KP_3:
+    case IBUS_KEY_KP_Page_Down:
+        return 's';
+    case IBUS_KEY_KP_4:
+    case IBUS_KEY_KP_Left:
+        return 't';
+    case IBUS_KEY_KP_5:
+    case IBUS_KEY_KP_Begin:
+        return 'u';
+    case IBUS_KEY_KP_6:
+    case IBUS_KEY_KP_Right:
+        return 'v';
+    case IBUS_KEY_KP_7:
+    case IBUS_KEY_KP_Home:
+        return 'w';
+    case IBUS_KEY_KP_8:
+    case IBUS_KEY_KP_Up:
+        return 'x';
+    case IBUS_KEY_KP_9:
+    case IBUS_KEY_KP_Page_Up:
+        return 'y';
+    case IBUS_KEY_KP_Add:
+        return 'l';
+    case IBUS_KEY_KP_Subtract:
+        return 'S';
+    case IBUS_KEY_KP_Multiply:
+        return 'R';
+    case IBUS_KEY_KP_Divide:
+        return 'Q';
+    case IBUS_KEY_KP_Enter:
+        return 'M';
+    case IBUS_KEY_KP_Decimal:
+    case IBUS_KEY_KP_Delete:
+        return 'n';
+    default:;
+    }
+    return 0;
+}
+
+const gchar *
+fb_keyboard_event_to_string (FbKeyboard       *keyboard,
+                             const FbKeyEvent *event,
+                             gsize            *length)
+{
+    GString *string;
+    const gchar *func_string;
+    const gchar *cursor_prefix;
+    guint keyval;
+    gunichar ch;
+    gchar pad_char;
+
+    g_return_val_if_fail (keyboard != NULL, NULL);
+    g_return_val_if_fail (event != NULL, NULL);
+
+    string = keyboard->string;
+    g_string_truncate (string, 0);
+    keyval = event->keyval;
+
+    if (event->modifiers & IBUS_RELEASE_MASK)
+        goto out;
+
+    /* The alt key is the escape prefix of the Linux console. */
+    if (event->modifiers & IBUS_MOD1_MASK)
+        g_string_append_c (string, '\033');
+
+    if ((keyboard->modes & FB_KEYBOARD_MODE_APPLIC_KEYPAD) &&
+        !(event->modifiers & IBUS_SHIFT_MASK) &&
+        (pad_char = fb_keyboard_get_applic_keypad_char (keyval))) {
+        g_string_append (string, "\033O");
+        g_string_append_c (string, pad_char);
+        goto out;
+    }
+
+    cursor_prefix = (keyboard->modes & FB_KEYBOARD_MODE_CURSOR_KEY_ESC_O) ?
+            "\033O" : "\033[";
+
+    switch (keyval) {
+    case IBUS_KEY_Up:
+    case IBUS_KEY_KP_Up:
+        g_string_append (string, cursor_prefix);
+        g_string_append_c (string, 'A');
+        goto out;
+    case IBUS_KEY_Down:
+    case IBUS_KEY_KP_Down:
+        g_string_append (string, cursor_prefix);
+        g_string_append_c (string, 'B');
+        goto out;
+    case IBUS_KEY_Right:
+    case IBUS_KEY_KP_Right:
+        g_string_append (string, cursor_prefix);
+        g_string_append_c (string, 'C');
+        goto out;
+    case IBUS_KEY_Left:
+    case IBUS_KEY_KP_Left:
+        g_string_append (string, cursor_prefix);
+        g_string_append_c (string, 'D');
+        goto out;
+    case IBUS_KEY_KP_Begin:
+        g_string_append (string, "\033[G");
+        goto out;
+    case IBUS_KEY_BackSpace:
+        g_string_append_c (string, 0x7f);
+        goto out;
+    case IBUS_KEY_Return:
+    case IBUS_KEY_KP_Enter:
+        g_string_append_c (string, '\r');
+        if (keyboard->modes & FB_KEYBOARD_MODE_CR_WITH_LF)
+            g_string_append_c (string, '\n');
+        goto out;
+    default:;
+    }
+
+    if ((func_string = fb_keyboard_get_func_string (keyboard, keyval))) {
+        g_string_append (string, func_string);
+        goto out;
+    }
+
+    ch = ibus_keyval_to_unicode (keyval);
+    if (ch == 0) {
+        g_string_truncate (string, 0);
+        goto out;
+    }
+
+    /* The control characters are mapped from ASCII only. */
+    if ((event->modifiers & IBUS_CONTROL_MASK) && ch < 0x80) {
+        if (ch == ' ' || ch == '@' || ch == '2')
+            ch = 0;
+        else if (ch == '?' || ch == '8')
+            ch = 0x7f;
+        else if (ch >= '@' && ch <= 0x7f)
+            ch &= 0x1f;
+        else if (ch >= '3' && ch <= '7')
+            ch = 0x1b + ch - '3';
+        g_string_append_c (string, (gchar) ch);
+        goto out;
+    }
+
+    g_string_append_unichar (string, ch);
+
+out:
+    if (length)
+        *length = string->len;
+    return string->str;
+}
@@ -0,0 +1,130 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_KEYBOARD_H_
+#define __FB_KEYBOARD_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+typedef struct _FbKeyboard FbKeyboard;
+typedef struct _FbKeyEvent FbKeyEvent;
+
+/**
+ * FbKeyboardMode:
+ * @FB_KEYBOARD_MODE_CURSOR_KEY_ESC_O: The cursor keys send ESC O.
+ * @FB_KEYBOARD_MODE_APPLIC_KEYPAD: The keypad sends ESC O.
+ * @FB_KEYBOARD_MODE_CR_WITH_LF: The return key sends CR LF.
+ *
+ * The console modes which change the input sequences.
+ */
+typedef enum {
+    FB_KEYBOARD_MODE_CURSOR_KEY_ESC_O = 1 << 0,
+    FB_KEYBOARD_MODE_APPLIC_KEYPAD    = 1 << 1,
+    FB_KEYBOARD_MODE_CR_WITH_LF       = 1 << 2
+} FbKeyboardMode;
+
+/**
+ * FbKeyEvent:
+ * @keycode: The Linux keycode.
+ * @keyval: The IBus keyval.
+ * @modifiers: The #IBusModifierType including %IBUS_RELEASE_MASK
+ *             for the key release.
+ *
+ * <structname>FbKeyEvent</structname> is a key event decoded from
+ * the K_MEDIUMRAW scancodes.
+ */
+struct _FbKeyEvent {
+    guint keycode;
+    guint keyval;
+    guint modifiers;
+};
+
+/**
+ * fb_keyboard_new:
+ * @fd: The console file descriptor to read the kernel keymap.
+ *
+ * Creates a new keyboard state machine for the K_MEDIUMRAW mode.
+ *
+ * Returns: A newly allocated #FbKeyboard
+ */
+FbKeyboard      *fb_keyboard_new                   (int                fd);
+void             fb_keyboard_free                  (FbKeyboard        *keyboard);
+
+/**
+ * fb_keyboard_load_keymap:
+ * @keyboard: A #FbKeyboard
+ *
+ * Reads the keymap tables and the function key strings from the kernel.
+ * The console needs to be in K_UNICODE mode because the kernel hides
+ * Unicode keysyms in the other modes.
+ */
+void             fb_keyboard_load_keymap           (FbKeyboard        *keyboard);
+
+/**
+ * fb_keyboard_reset:
+ * @keyboard: A #FbKeyboard
+ *
+ * Releases the modifiers and reads the lock states.  This is called
+ * when the VT is entered since the key release events are lost
+ * while the other VT is active.
+ */
+void             fb_keyboard_reset                 (FbKeyboard        *keyboard);
+
+/**
+ * fb_keyboard_feed:
+ * @keyboard: A #FbKeyboard
+ * @scancode: A byte read from the console in K_MEDIUMRAW mode.
+ * @event: (out): The decoded key event.
+ *
+ * Returns: %TRUE if @event is filled, %FALSE if more bytes are needed
+ *          or the key is unknown.
+ */
+gboolean         fb_keyboard_feed                  (FbKeyboard        *keyboard,
+                                                    guchar             scancode,
+                                                    FbKeyEvent        *event);
+
+/**
+ * fb_keyboard_set_modes:
+ * @keyboard: A #FbKeyboard
+ * @modes: The #FbKeyboardMode flags of the active shell.
+ *
+ * The kernel does not translate the keys in K_MEDIUMRAW mode and
+ * the modes of the shell are applied by fb_keyboard_event_to_string().
+ */
+void             fb_keyboard_set_modes             (FbKeyboard        *keyboard,
+                                                    guint              modes);
+
+/**
+ * fb_keyboard_event_to_string:
+ * @keyboard: A #FbKeyboard
+ * @event: A key press event
+ * @length: (out): The length of the returned string.
+ *
+ * Translates @event to the input sequence of the Linux console.
+ *
+ * Returns: (transfer none): The internal buffer of @keyboard.
+ */
+const gchar     *fb_keyboard_event_to_string       (FbKeyboard        *keyboard,
+                                                    const FbKeyEvent  *event,
+                                                    gsize             *length);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,332 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#include "fbscrollback.h"
+
+#define SCROLLBACK_SIZE_ENV     "IBUS_FBTERM_SCROLLBACK_SIZE"
+/* The default memory limit of all the shells in KiB */
+#define SCROLLBACK_SIZE_DEFAULT 4096
+#define BLOCK_LINES             128
+/* The newest blocks are not compressed since they are read often. */
+#define HOT_BLOCKS              2
+
+/* The lines are stored with the guint32 length prefix. */
+typedef struct {
+    guint8  *data;
+    gsize    size;
+    gsize    allocated;
+    gsize    raw_size;
+    guint    n_lines;
+    gboolean compressed;
+} Block;
+
+struct _FbScrollback {
+    /* The ring of the blocks from the oldest.  The last block is
+     * appended until it has BLOCK_LINES lines.
+     */
+    GPtrArray *blocks;
+    guint      n_lines;
+    /* Not decreased when the blocks are dropped */
+    guint64    n_pushed;
+    /* The allocated bytes of the blocks and the cache */
+    gsize      size;
+    /* The decompressed block which is read last */
+    Block     *cached_block;
+    guint8    *cache;
+    gsize      cache_allocated;
+};
+
+static GSList *scrollbacks;
+static gsize total_size;
+static gsize max_size = G_MAXSIZE;
+
+static void
+fb_scrollback_load_max_size (void)
+{
+    const gchar *env;
+    guint64 size = SCROLLBACK_SIZE_DEFAULT;
+
+    if (max_size != G_MAXSIZE)
+        return;
+    if ((env = g_getenv (SCROLLBACK_SIZE_ENV)) != NULL)
+        size = g_ascii_strtoull (env, NULL, 10);
+    max_size = MIN (size, G_MAXSIZE / 1024 - 1) * 1024;
+}
+
+/* Replaces @old_size bytes of @scrollback with @new_size bytes in
+ * the counts of the limit.
+ */
+static void
+fb_scrollback_resize (FbScrollback *scrollback,
+                      gsize         old_size,
+                      gsize         new_size)
+{
+    scrollback->size = scrollback->size - old_size + new_size;
+    total_size = total_size - old_size + new_size;
+}
+
+static void
+fb_scrollback_free_block (Block *block)
+{
+    g_free (block->data);
+    g_slice_free (Block, block);
+}
+
+FbScrollback *
+fb_scrollback_new (void)
+{
+    FbScrollback *scrollback = g_slice_new0 (FbScrollback);
+
+    fb_scrollback_load_max_size ();
+    scrollback->blocks = g_ptr_array_new_with_free_func (
+            (GDestroyNotify) fb_scrollback_free_block);
+    scrollbacks = g_slist_prepend (scrollbacks, scrollback);
+    return scrollback;
+}
+
+void
+fb_scrollback_free (FbScrollback *scrollback)
+{
+    g_return_if_fail (scrollback != NULL);
+
+    scrollbacks = g_slist_remove (scrollbacks, scrollback);
+    total_size -= scrollback->size;
+    g_ptr_array_unref (scrollback->blocks);
+    g_free (scrollback->cache);
+    g_slice_free (FbScrollback, scrollback);
+}
+
+/* The block is full and not appended any more.  The spare bytes of
+ * the block are released if it is not compressed.
+ */
+static void
+fb_scrollback_compress_block (FbScrollback *scrollback,
+                              Block        *block)
+{
+#ifdef HAVE_LZ4
+    int bound = LZ4_compressBound (block->size);
+    guint8 *data = g_malloc (bound);
+    int size;
+
+    size = LZ4_compress_default ((const char *) block->data, (char *) data,
+                                 block->size, bound);
+    if (size > 0 && (gsize) size < block->size) {
+        fb_scrollback_resize (scrollback, block->allocated, size);
+        g_free (block->data);
+        block->data = g_realloc (data, size);
+        block->size = block->allocated = size;
+        block->compressed = TRUE;
+        return;
+    }
+    g_free (data);
+#endif
+
+    fb_scrollback_resize (scrollback, block->allocated, block->size);
+    block->data = g_realloc (block->data, block->size);
+    block->allocated = block->size;
+}
+
+static void
+fb_scrollback_drop_block (FbScrollback *scrollback)
+{
+    Block *block = g_ptr_array_index (scrollback->blocks, 0);
+
+    if (scrollback->cached_block == block)
+        scrollback->cached_block = NULL;
+    scrollback->n_lines -= block->n_lines;
+    fb_scrollback_resize (scrollback, block->allocated, 0);
+    g_ptr_array_remove_index (scrollback->blocks, 0);
+}
+
+/* Drop the oldest blocks of the largest store until all the stores fit in
+ * the limit.  The block which is being appended is not dropped.
+ */
+static void
+fb_scrollback_shrink (void)
+{
+    while (total_size > max_size) {
+        FbScrollback *largest = NULL;
+        GSList *l;
+
+        for (l = scrollbacks; l; l = l->next) {
+            FbScrollback *scrollback = l->data;
+
+            if (scrollback->blocks->len < 2)
+                continue;
+            if (largest == NULL || scrollback->size > largest->size)
+                largest = scrollback;
+        }
+        if (largest == NULL)
+            break;
+        fb_scrollback_drop_block (largest);
+    }
+}
+
+void
+fb_scrollback_push_line (FbScrollback *scrollback,
+                         const gchar  *line,
+                         gsize         length)
+{
+    Block *block = NULL;
+    guint32 prefix = length;
+
+    g_return_if_fail (scrollback != NULL);
+
+    if (max_size == 0)
+        return;
+
+    if (scrollback->blocks->len > 0) {
+        block = g_ptr_array_index (scrollback->blocks,
+                                   scrollback->blocks->len - 1);
+    }
+    if (block == NULL || block->n_lines == BLOCK_LINES) {
+        if (scrollback->blocks->len >= HOT_BLOCKS) {
+            fb_scrollback_compress_block (
+                    scrollback,
+                    g_ptr_array_index (scrollback->blocks,
+                                       scrollback->blocks->len - HOT_BLOCKS));
+        }
+        block = g_slice_new0 (Block);
+        g_ptr_array_add (scrollback->blocks, block);
+    }
+
+    if (block->size + sizeof (prefix) + length > block->allocated) {
+        gsize allocated = MAX (block->allocated * 2,
+                               block->size + sizeof (prefix) + length);
+
+        fb_scrollback_resize (scrollback, block->allocated, allocated);
+        block->allocated = allocated;
+        block->data = g_realloc (block->data, block->allocated);
+    }
+    memcpy (block->data + block->size, &prefix, sizeof (prefix));
+    memcpy (block->data + block->size + sizeof (prefix), line, length);
+    block->size += sizeof (prefix) + length;
+    block->raw_size = block->size;
+    block->n_lines++;
+    scrollback->n_lines++;
+    scrollback->n_pushed++;
+    if (scrollback->cached_block == block)
+        scrollback->cached_block = NULL;
+
+    fb_scrollback_shrink ();
+}
+
+guint
+fb_scrollback_get_n_lines (FbScrollback *scrollback)
+{
+    g_return_val_if_fail (scrollback != NULL, 0);
+
+    return scrollback->n_lines;
+}
+
+guint64
+fb_scrollback_get_n_pushed (FbScrollback *scrollback)
+{
+    g_return_val_if_fail (scrollback != NULL, 0);
+
+    return scrollback->n_pushed;
+}
+
+gsize
+fb_scrollback_get_size (FbScrollback *scrollback)
+{
+    g_return_val_if_fail (scrollback != NULL, 0);
+
+    return scrollback->size;
+}
+
+static const guint8 *
+fb_scrollback_load_block (FbScrollback *scrollback,
+                          Block        *block)
+{
+    if (!block->compressed)
+        return block->data;
+
+#ifdef HAVE_LZ4
+    if (scrollback->cached_block != block) {
+        /* The cache is counted and fb_scrollback_shrink() of the next
+         * push drops the blocks for it.
+         */
+        if (block->raw_size > scrollback->cache_allocated) {
+            fb_scrollback_resize (scrollback,
+                                  scrollback->cache_allocated,
+                                  block->raw_size);
+            scrollback->cache_allocated = block->raw_size;
+            scrollback->cache = g_realloc (scrollback->cache,
+                                           scrollback->cache_allocated);
+        }
+        if (LZ4_decompress_safe ((const char *) block->data,
+                                 (char *) scrollback->cache,
+                                 block->size,
+                                 block->raw_size) != block->raw_size) {
+            scrollback->cached_block = NULL;
+            return NULL;
+        }
+        scrollback->cached_block = block;
+    }
+    return scrollback->cache;
+#else
+    return NULL;
+#endif
+}
+
+gboolean
+fb_scrollback_get_line (FbScrollback *scrollback,
+                        guint         index,
+                        GString      *line)
+{
+    Block *block;
+    const guint8 *data;
+    gsize offset = 0;
+    guint i;
+
+    g_return_val_if_fail (scrollback != NULL, FALSE);
+    g_return_val_if_fail (line != NULL, FALSE);
+
+    if (index >= scrollback->n_lines)
+        return FALSE;
+
+    /* Only the last block has less than BLOCK_LINES lines. */
+    block = g_ptr_array_index (scrollback->blocks, index / BLOCK_LINES);
+    if ((data = fb_scrollback_load_block (scrollback, block)) == NULL)
+        return FALSE;
+
+    for (i = 0; ; i++) {
+        guint32 length;
+
+        memcpy (&length, data + offset, sizeof (length));
+        offset += sizeof (length);
+        if (i == index % BLOCK_LINES) {
+            g_string_append_len (line, (const gchar *) data + offset, length);
+            return TRUE;
+        }
+        offset += length;
+    }
+}
@@ -0,0 +1,95 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_SCROLLBACK_H_
+#define __FB_SCROLLBACK_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+typedef struct _FbScrollback FbScrollback;
+
+/**
+ * fb_scrollback_new:
+ *
+ * Creates a store of the lines which are scrolled off the top of
+ * the screen.  The lines are kept in the blocks of the fixed number of
+ * the lines and the blocks out of the recent lines are compressed.
+ * All the stores share the memory limit of
+ * %IBUS_FBTERM_SCROLLBACK_SIZE and the oldest blocks of the largest
+ * store are dropped.
+ *
+ * Returns: A newly allocated #FbScrollback
+ */
+FbScrollback    *fb_scrollback_new                 (void);
+void             fb_scrollback_free                (FbScrollback *scrollback);
+
+/**
+ * fb_scrollback_push_line:
+ * @scrollback: A #FbScrollback
+ * @line: The characters and the SGR sequences of the line.
+ * @length: The length of @line.
+ *
+ * Appends the newest line.
+ */
+void             fb_scrollback_push_line           (FbScrollback *scrollback,
+                                                    const gchar  *line,
+                                                    gsize         length);
+
+/**
+ * fb_scrollback_get_n_lines:
+ * @scrollback: A #FbScrollback
+ *
+ * Returns: The number of the kept lines.
+ */
+guint            fb_scrollback_get_n_lines         (FbScrollback *scrollback);
+
+/**
+ * fb_scrollback_get_n_pushed:
+ * @scrollback: A #FbScrollback
+ *
+ * Returns: The number of the lines pushed so far including the dropped
+ *          lines.  This is never decreased.
+ */
+guint64          fb_scrollback_get_n_pushed        (FbScrollback *scrollback);
+
+/**
+ * fb_scrollback_get_size:
+ * @scrollback: A #FbScrollback
+ *
+ * Returns: The allocated bytes of the kept lines and the decompressed
+ *          block which are counted for IBUS_FBTERM_SCROLLBACK_SIZE.
+ */
+gsize            fb_scrollback_get_size            (FbScrollback *scrollback);
+
+/**
+ * fb_scrollback_get_line:
+ * @scrollback: A #FbScrollback
+ * @index: The index of the line from the oldest line.
+ * @line: The #GString to append the line.
+ *
+ * Returns: %TRUE if the line is appended.
+ */
+gboolean         fb_scrollback_get_line            (FbScrollback *scrollback,
+                                                    guint         index,
+                                                    GString      *line);
+
+G_END_DECLS
+#endif
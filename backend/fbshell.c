@@ -28,23 +28,51 @@
 #include <fcntl.h>
 #include <pty.h>
 #include <pwd.h>
+#include <spawn.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
-#include <sys/wait.h>
 
-#include <linux/kd.h>
 #include <linux/keyboard.h>
 
+#include "fbarena.h"
+#include "fbchild.h"
 #include "fbcontext.h"
+#include "fbkeyboard.h"
+#include "fbscrollback.h"
 #include "fbshell.h"
 #include "fbshellman.h"
 #include "fbterm.h"
+#include "fbtrace.h"
+#include "fbvt.h"
+#include "fbwidth.h"
 
 
 extern FbContext* ibus_fb_context_new (void);
+extern guint32  *fb_cache_lookup_keymap (int     *length);
+extern void      fb_cache_store_keymap  (guint32 *keymap,
+                                         int      length);
 
-#define WRITE_STR(fd, string) write ((fd), (string), strlen ((string)))
+
+/* The cached keymap is used when these keycodes of '1', 'q', 'w', 'y',
+ * 'a', ';', 'z' and space match the console keymap.  All the entries
+ * are verified later in the idle time.
+ */
+static const int keymap_sample_keycodes[] = { 2, 16, 17, 21, 30, 39, 44, 57 };
+
+/* The kernel redirects the console messages to one pty only. */
+static FbShell *console_shell = NULL;
+
+/* Bumped when the console keymap can be changed by loadkeys or on
+ * the other VCs.  A shell reads the keymap again on the first lookup
+ * after the bump.
+ */
+static guint keymap_serial = 1;
+
+/* Bumped when the VC is entered since the settings can be changed
+ * in the other sessions.
+ */
+static guint settings_serial = 1;
 
 typedef enum {
     CursorVisible = 1 << 0,
@@ -64,29 +92,99 @@ enum {
     PROP_FBTERM
 };
 
+typedef enum {
+    PreeditAttrNone    = 0,
+    PreeditAttrInverse = 1 << 0,
+    PreeditAttrBlueBg  = 1 << 1
+} PreeditAttr;
+
+/* The overlays which are redrawn in the next frame */
+typedef enum {
+    DirtyPreedit     = 1 << 0,
+    DirtyLookupTable = 1 << 1,
+    DirtyStatus      = 1 << 2,
+    DirtyStatusLabel = 1 << 3
+} DirtyType;
+
+/* A property label which is drawn as " label" from @column
+ * in the status line.
+ */
 typedef struct {
-    gchar *key;
-    gchar *label;
+    gchar   *key;
+    gchar   *label;
+    int      column;
+    int      width;
+    gboolean dirty;
 } StatusLabel;
 
+/* A candidate of the lookup table page which is rendered as
+ * " label. candidate" from @column.  The strings are allocated in
+ * the lookup_arena until the page is changed.
+ */
+typedef struct {
+    gchar *label;
+    gchar *candidate;
+    gchar *text;
+    int    column;
+} LookupCell;
+
+/* A rendered preedit character */
+typedef struct {
+    gunichar ch;
+    guint8   attr;
+    guint8   width;
+} PreeditCell;
+
 struct _FbShellPrivate {
     int             pid;
     gboolean        first_shell;
     FbShellManager *manager;
-    int             tty0_fd;
     FbTermObject   *fbterm;
     struct winsize  size;
     FbContext      *context;
-    gchar          *preedit_text;
-    gchar          *lookup_table_head;
-    gchar          *lookup_table_middle;
-    gchar          *lookup_table_end;
+    GArray         *preedit_cells;
+    GArray         *preedit_next;
+    gboolean        preedit_pending;
+    int             preedit_width;
+    gboolean        preedit_stale;
+    GArray         *lookup_cells;
+    FbArena        *lookup_arena;
+    guint           lookup_page_start;
+    gboolean        lookup_page_changed;
+    int             lookup_cursor;
+    int             lookup_cursor_drawn;
     int             lookup_table_x;
     int             lookup_table_y;
+    gboolean        lookup_table_drawn;
     int             switcher_engine_index;
-    guint32         keymap[NR_KEYS];
-    StatusLabel   **status_label;
+    IBusEngineDesc **switcher_engines;
+    int             switcher_length;
+    gchar         **switcher_names;
+    int            *switcher_widths;
+    GString        *switcher_line;
+    GString        *output;
+    /* The shell waits in the pool of FbShellManager and its output
+     * only updates the screen model as the inactive shells do.
+     */
+    gboolean        parked;
+    FbVt           *vt;
+    /* NR_KEYS keysyms or NULL until the first lookup */
+    guint32        *keymap;
+    GPtrArray      *status_labels;
+    GHashTable     *status_label_table;
+    gboolean        status_line_drawn;
     gchar          *engine_name;
+    guint           dirty;
+    guint           render_id;
+    FbScrollback   *scrollback;
+    /* The number of the lines scrolled back or 0 for the live screen */
+    guint           scroll_offset;
+    guint           keymap_serial;
+    guint           settings_serial;
+    guint           load_settings_id;
+    guint           verify_keymap_id;
+    /* The monotonic time when the shell lost the focus */
+    gint64          leave_time;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (FbShell,
@@ -106,9 +204,12 @@ static void         fb_shell_set_property         (FbShell         *shell,
                                                    const GValue    *value,
                                                    GParamSpec      *pspec);
 static void         fb_shell_destroy              (FbShell         *shell);
-static void         wait_child_process_exit       (int              pid);
+static void         fb_shell_reset_lookup_table   (FbShell         *shell);
+static void         fb_shell_free_status_label    (StatusLabel     *label);
 static void         fb_shell_create_shell_process (FbShell         *shell,
                                                    gchar          **command);
+static void         fb_shell_redirect_console     (FbShell         *shell,
+                                                   FbShell         *target);
 static void         fb_shell_change_mode          (FbShell         *shell,
                                                    ModeType         type,
                                                    guint16          val);
@@ -118,10 +219,6 @@ static void         fb_shell_ready_read           (FbIo            *io,
 static void         fb_context_warning_cb         (FbContext       *context,
                                                    const gchar     *message,
                                                    FbShell         *shell);
-static void         fb_context_cursor_position_cb (FbContext       *context,
-                                                   int              x,
-                                                   int              y,
-                                                   FbShell         *shell);
 static int          fb_context_switcher_switch_cb (FbContext       *context,
                                                    IBusEngineDesc **engines,
                                                    int              length,
@@ -163,24 +260,15 @@ static void         fb_context_forward_key_event_cb
                                                    FbShell         *shell);
 
 static void
-fb_shell_init (FbShell *shell)
+fb_shell_create_context (FbShell *shell)
 {
-    FbShellPrivate *priv =
-            fb_shell_get_instance_private (shell);
-
-    shell->priv = priv;
+    FbShellPrivate *priv = shell->priv;
 
-    priv->pid = -1;
-    priv->first_shell = TRUE;
-    priv->tty0_fd = -1;
     priv->context = (FbContext *)ibus_fb_context_new ();
     g_object_connect (priv->context,
                       "signal::user-warning",
                       (GCallback)fb_context_warning_cb,
                       shell,
-                      "signal::cursor-position",
-                      (GCallback)fb_context_cursor_position_cb,
-                      shell,
                       "signal::switcher-switch",
                       (GCallback)fb_context_switcher_switch_cb,
                       shell,
@@ -190,6 +278,9 @@ fb_shell_init (FbShell *shell)
                       "signal::engine-changed",
                       (GCallback)fb_context_engine_changed_cb,
                       shell,
+                      "signal::keymap-changed",
+                      (GCallback)fb_context_keymap_changed_cb,
+                      shell,
                       "signal::commit",
                       (GCallback)fb_context_commit_cb,
                       shell,
@@ -211,6 +302,34 @@ fb_shell_init (FbShell *shell)
                       NULL);
 }
 
+static void
+fb_shell_init (FbShell *shell)
+{
+    FbShellPrivate *priv =
+            fb_shell_get_instance_private (shell);
+
+    shell->priv = priv;
+
+    priv->pid = -1;
+    priv->first_shell = TRUE;
+    priv->preedit_cells = g_array_new (FALSE, FALSE, sizeof (PreeditCell));
+    priv->preedit_next = g_array_new (FALSE, FALSE, sizeof (PreeditCell));
+    priv->lookup_cells = g_array_new (FALSE, FALSE, sizeof (LookupCell));
+    priv->lookup_arena = fb_arena_new (4096);
+    priv->lookup_cursor = -1;
+    priv->lookup_cursor_drawn = -1;
+    priv->status_labels =
+            g_ptr_array_new_with_free_func (
+                    (GDestroyNotify) fb_shell_free_status_label);
+    priv->status_label_table = g_hash_table_new (g_str_hash, g_str_equal);
+    priv->switcher_line = g_string_new (NULL);
+    priv->output = g_string_new (NULL);
+    priv->vt = fb_vt_new ();
+    priv->scrollback = fb_scrollback_new ();
+    fb_vt_set_scrollback (priv->vt, priv->scrollback);
+    fb_shell_create_context (shell);
+}
+
 static void
 fb_shell_class_init (FbShellClass *class)
 {
@@ -320,69 +439,210 @@ fb_shell_set_property (FbShell      *shell,
     }
 }
 
-static void
-wait_child_process_exit (int pid)
+static gboolean
+fb_shell_read_keymap_entry (FbShell *shell,
+                            int      keycode,
+                            guint32 *keysym)
 {
-    int retval;
-    int i;
+    FbConsole *console = fbterm_object_get_console (shell->priv->fbterm);
 
-    if (pid < 0)
-        return;
-
-    kill (pid, SIGTERM);
-    sched_yield ();
+    return fb_console_read_keymap_entry (console, keycode, keysym);
+}
 
-    retval = waitpid (pid, 0, WNOHANG);
-    if (retval > 0 || (retval == -1 && errno == ECHILD))
-        return;
+/* Reads all the entries of the console keymap and refreshes the cache
+ * if the cached keymap differs in the other keycodes than the samples.
+ * The cached keymap is kept if any entry cannot be read.
+ */
+static gboolean
+fb_shell_verify_keymap_idle (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    guint32 *keymap;
+    int keycode;
 
-    for (i = 5; i--;) {
-        usleep (100 * 1000);
+    priv->verify_keymap_id = 0;
+    if (priv->keymap == NULL)
+        return G_SOURCE_REMOVE;
 
-        retval = waitpid (pid, 0, WNOHANG);
-        if (retval > 0)
-        break;
+    keymap = g_new0 (guint32, NR_KEYS);
+    for (keycode = 0; keycode < NR_KEYS; keycode++) {
+        if (!fb_shell_read_keymap_entry (shell, keycode, &keymap[keycode])) {
+            g_debug ("Failed to read the keycode %d of the keymap", keycode);
+            g_free (keymap);
+            return G_SOURCE_REMOVE;
+        }
     }
-
-    if (retval <= 0) {
-        kill (pid, SIGKILL);
-        waitpid (pid, 0, 0);
+    if (memcmp (keymap, priv->keymap, sizeof (guint32) * NR_KEYS) != 0) {
+        g_debug ("The cached keymap is stale");
+        memcpy (priv->keymap, keymap, sizeof (guint32) * NR_KEYS);
+        fb_cache_store_keymap (priv->keymap, NR_KEYS);
     }
+    g_free (keymap);
+    return G_SOURCE_REMOVE;
 }
 
 static void
 fb_shell_load_keymap (FbShell *shell)
 {
     FbShellPrivate *priv;
+    guint32 *cached;
+    int length = 0;
     int keycode;
+    int i;
+    gboolean loaded = FALSE;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
 
+    cached = fb_cache_lookup_keymap (&length);
+    if (cached != NULL && length == NR_KEYS) {
+        for (i = 0; i < G_N_ELEMENTS (keymap_sample_keycodes); i++) {
+            guint32 keysym = 0;
+            keycode = keymap_sample_keycodes[i];
+            if (!fb_shell_read_keymap_entry (shell, keycode, &keysym) ||
+                keysym != cached[keycode]) {
+                break;
+            }
+        }
+        if (i == G_N_ELEMENTS (keymap_sample_keycodes)) {
+            memcpy (priv->keymap, cached, sizeof (guint32) * NR_KEYS);
+            g_free (cached);
+            if (priv->verify_keymap_id == 0) {
+                priv->verify_keymap_id =
+                        g_idle_add_full (G_PRIORITY_LOW,
+                                         (GSourceFunc) fb_shell_verify_keymap_idle,
+                                         shell,
+                                         NULL);
+            }
+            return;
+        }
+    }
+    g_free (cached);
+
     memset (priv->keymap, 0, sizeof (guint32) * NR_KEYS);
 
     for (keycode = 0; keycode < NR_KEYS; keycode++) {
-        struct kbentry entry;
+        if (fb_shell_read_keymap_entry (shell, keycode, &priv->keymap[keycode]))
+            loaded = TRUE;
+    }
 
-        entry.kb_table = 0;
-        entry.kb_index = keycode;
-        /* tty0 is needed to get keysyms instead of tty */
-        if (ioctl (priv->tty0_fd, KDGKBENT, &entry) < 0)
-            continue;
-        priv->keymap[keycode] = KVAL(entry.kb_value);
+    if (loaded)
+        fb_cache_store_keymap (priv->keymap, NR_KEYS);
+}
+
+static void
+fb_shell_ensure_keymap (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+
+    if (priv->keymap_serial == keymap_serial)
+        return;
+    if (priv->keymap == NULL)
+        priv->keymap = g_new0 (guint32, NR_KEYS);
+    fb_shell_load_keymap (shell);
+    priv->keymap_serial = keymap_serial;
+}
+
+#if HAVE_DECL_POSIX_SPAWN_SETSID
+/* posix_spawn() does not copy the page tables of this process which maps
+ * GLib, libibus and the D-Bus connection.  The child calls setsid() and
+ * the slave pty becomes the controlling tty when it is opened.
+ */
+static gboolean
+fb_shell_spawn_shell_process (FbShell *shell, gchar **command)
+{
+    FbShellPrivate *priv = shell->priv;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    char slave_name[64];
+    gchar **envp;
+    short flags;
+    int fd;
+    int retval = -1;
+    pid_t pid = -1;
+
+    fd = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return FALSE;
+    if (grantpt (fd) < 0 || unlockpt (fd) < 0 ||
+        ptsname_r (fd, slave_name, sizeof (slave_name)) != 0) {
+        close (fd);
+        return FALSE;
+    }
+
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO,
+                                      slave_name, O_RDWR, 0);
+    posix_spawn_file_actions_adddup2 (&actions, STDIN_FILENO, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2 (&actions, STDIN_FILENO, STDERR_FILENO);
+
+    posix_spawnattr_init (&attr);
+    fbterm_object_init_spawn_attr (priv->fbterm, &attr);
+    posix_spawnattr_getflags (&attr, &flags);
+    posix_spawnattr_setflags (&attr, flags | POSIX_SPAWN_SETSID);
+
+    envp = g_environ_setenv (g_get_environ (), "TERM", "linux", TRUE);
+
+    if (command) {
+        retval = posix_spawnp (&pid, command[0], &actions, &attr,
+                               command, envp);
+    } else {
+        struct passwd *userpd = NULL;
+        const gchar *shell_str = getenv ("SHELL");
+        gchar *argv[2] = { NULL, NULL };
+
+        if (shell_str) {
+            argv[0] = (gchar *) shell_str;
+            retval = posix_spawnp (&pid, argv[0], &actions, &attr,
+                                   argv, envp);
+        }
+        if (retval != 0 && (userpd = getpwuid (getuid ())) != NULL) {
+            argv[0] = userpd->pw_shell;
+            retval = posix_spawnp (&pid, argv[0], &actions, &attr,
+                                   argv, envp);
+        }
+        if (retval != 0) {
+            argv[0] = "/bin/sh";
+            retval = posix_spawnp (&pid, argv[0], &actions, &attr,
+                                   argv, envp);
+        }
     }
+
+    g_strfreev (envp);
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&actions);
+
+    if (retval != 0) {
+        close (fd);
+        return FALSE;
+    }
+
+    priv->pid = pid;
+    fb_io_set_fd (FB_IO (shell), fd);
+    return TRUE;
 }
+#endif
 
 static void
 fb_shell_create_shell_process (FbShell *shell, gchar **command)
 {
     int fd;
     FbShellPrivate *priv;
+    gint64 start_time;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
+    start_time = g_get_monotonic_time ();
+
+#if HAVE_DECL_POSIX_SPAWN_SETSID
+    if (fb_shell_spawn_shell_process (shell, command)) {
+        g_debug ("Spawned the shell %d in %" G_GINT64_FORMAT " usec",
+                 priv->pid, g_get_monotonic_time () - start_time);
+        return;
+    }
+#endif
 
     priv->pid = forkpty (&fd, NULL, NULL, NULL);
 
@@ -411,10 +671,63 @@ fb_shell_create_shell_process (FbShell *shell, gchar **command)
         break;
     default:
         fb_io_set_fd (FB_IO (shell), fd);
+        g_debug ("Forked the shell %d in %" G_GINT64_FORMAT " usec",
+                 priv->pid, g_get_monotonic_time () - start_time);
         break;
     }
 }
 
+static void
+fb_shell_write (FbShell     *shell,
+                const gchar *buff,
+                gssize       length)
+{
+    g_string_append_len (shell->priv->output, buff, length);
+}
+
+static void
+fb_shell_write_str (FbShell     *shell,
+                    const gchar *str)
+{
+    g_string_append (shell->priv->output, str);
+}
+
+static void
+fb_shell_write_console (const gchar *buff,
+                        gsize        length)
+{
+    fb_trace (FB_TRACE_CONSOLE_WRITE, length);
+    while (length) {
+        gssize retval = write (STDOUT_FILENO, buff, length);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        buff += retval;
+        length -= retval;
+    }
+}
+
+/* Write the buffered escape sequences with a single write().  The
+ * inactive shells only update the screen model.
+ */
+static void
+fb_shell_flush (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    GString *output = priv->output;
+
+    if (priv->vt)
+        fb_vt_feed (priv->vt, output->str, output->len);
+
+    if (priv->manager != NULL &&
+        fb_shell_manager_active_shell (priv->manager) == shell) {
+        fb_shell_write_console (output->str, output->len);
+    }
+    g_string_truncate (output, 0);
+}
+
 static void
 fb_shell_change_mode (FbShell  *shell,
                       ModeType  type,
@@ -430,11 +743,9 @@ fb_shell_change_mode (FbShell  *shell,
         str = (val ? "\e=" : "\e>");
     else if (type == CRWithLF)
         str = (val ? "\e[20h" : "\e[20l");
-    else if (type == ClearScreen)
-        str = "\033[H\033[J";
 
     if (str)
-        WRITE_STR (STDIN_FILENO, str);
+        fb_shell_write_str (shell, str);
 }
 
 static void
@@ -442,27 +753,47 @@ fb_shell_ready_read (FbIo        *io,
                      const gchar *buff,
                      guint        length)
 {
+    FbShellPrivate *priv;
+
     g_return_if_fail (FB_IS_SHELL (io));
 
-    write (STDOUT_FILENO, buff, length);
+    priv = FB_SHELL (io)->priv;
+    fb_trace (FB_TRACE_PTY_READ, length);
+
+    /* The inactive shell only updates the screen model and the screen
+     * is drawn when the shell is switched.  The scrollback view is not
+     * changed by the output.
+     */
+    if (priv->scroll_offset > 0) {
+        guint64 n_pushed = fb_scrollback_get_n_pushed (priv->scrollback);
+
+        fb_vt_feed (priv->vt, buff, length);
+        /* Keep the view on the same lines.  The number of the lines can
+         * be decreased when the old blocks are dropped and the view is
+         * clamped to the oldest line then.
+         */
+        n_pushed = fb_scrollback_get_n_pushed (priv->scrollback) - n_pushed;
+        priv->scroll_offset = MIN (priv->scroll_offset + n_pushed,
+                                   fb_scrollback_get_n_lines (priv->scrollback));
+        priv->preedit_stale = TRUE;
+        return;
+    }
+    if (fb_shell_manager_active_shell (priv->manager) == FB_SHELL (io))
+        fb_shell_write_console (buff, length);
+    fb_vt_feed (priv->vt, buff, length);
+    priv->preedit_stale = TRUE;
 }
 
 static void
 fb_shell_save_cursor (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033\067");
+    fb_shell_write_str (shell, "\033\067");
 }
 
 static void
 fb_shell_restore_cursor (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033\070");
-}
-
-static void
-fb_shell_get_cursor (FbShell *shell)
-{
-    WRITE_STR (STDIN_FILENO, "\033[6n");
+    fb_shell_write_str (shell, "\033\070");
 }
 
 static void
@@ -470,40 +801,38 @@ fb_shell_move_cursor (FbShell *shell,
                       int      x,
                       int      y)
 {
-    gchar *str = g_strdup_printf ("\033[%d;%dH", x, y);
-    WRITE_STR (STDIN_FILENO, str);
-    g_free (str);
+    g_string_append_printf (shell->priv->output, "\033[%d;%dH", x, y);
 }
 
 static void
 fb_shell_draw_inverse_color (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033[7m");
+    fb_shell_write_str (shell, "\033[7m");
 }
 
 static void
 fb_shell_draw_blue_color_bg (FbShell *shell)
 {
     /* underline "\033[4m" is not underline actually */
-    WRITE_STR (STDIN_FILENO, "\033[44m");
+    fb_shell_write_str (shell, "\033[44m");
 }
 
 static void
 fb_shell_blink_color (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033[5m");
+    fb_shell_write_str (shell, "\033[5m");
 }
 
 static void
 fb_shell_reset_color (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033[m");
+    fb_shell_write_str (shell, "\033[m");
 }
 
 static void
 fb_shell_erase_cursor_line (FbShell *shell)
 {
-    WRITE_STR (STDIN_FILENO, "\033[K");
+    fb_shell_write_str (shell, "\033[K");
 }
 
 static void
@@ -511,17 +840,99 @@ fb_shell_set_scrolling_region (FbShell *shell,
                                int      top,
                                int      bottom)
 {
-    char *str = g_strdup_printf("\033[%d;%dr", top, bottom);
-    WRITE_STR (STDIN_FILENO, str);
-    g_free (str);
+    /* Setting the region moves the cursor to the home. */
+    g_string_append_printf (shell->priv->output,
+                            "\033\067\033[%d;%dr\033\070",
+                            top, bottom);
+}
+
+/* Writes the prefix of @str which fits in @columns and subtracts
+ * the written width from @columns.
+ */
+static void
+fb_shell_write_fit (FbShell     *shell,
+                    const gchar *str,
+                    int         *columns)
+{
+    int width = 0;
+    gsize bytes;
+
+    bytes = fb_width_utf8 (str, -1, *columns, &width);
+    fb_shell_write (shell, str, bytes);
+    *columns -= width;
+}
+
+/* Returns -1 before the size is known so that nothing is truncated. */
+static int
+fb_shell_get_columns (FbShell *shell)
+{
+    return shell->priv->size.ws_col > 0 ? shell->priv->size.ws_col : -1;
+}
+
+static void
+fb_shell_free_switcher_cache (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    int i;
+
+    for (i = 0; i < priv->switcher_length; i++)
+        g_object_unref (priv->switcher_engines[i]);
+    g_free (priv->switcher_engines);
+    priv->switcher_engines = NULL;
+    g_strfreev (priv->switcher_names);
+    priv->switcher_names = NULL;
+    g_free (priv->switcher_widths);
+    priv->switcher_widths = NULL;
+    priv->switcher_length = 0;
+}
+
+/* The engine names and the widths are rendered once per engine list.
+ * The engines are referred so that the pointers are not reused.
+ */
+static void
+fb_shell_update_switcher_cache (FbShell         *shell,
+                                IBusEngineDesc **engines,
+                                int              length)
+{
+    FbShellPrivate *priv = shell->priv;
+    int i;
+
+    if (priv->switcher_length == length) {
+        for (i = 0; i < length; i++) {
+            if (priv->switcher_engines[i] != engines[i])
+                break;
+        }
+        if (i == length)
+            return;
+    }
+
+    fb_shell_free_switcher_cache (shell);
+    priv->switcher_engines = g_new0 (IBusEngineDesc *, length);
+    priv->switcher_names = g_new0 (gchar *, length + 1);
+    priv->switcher_widths = g_new0 (int, length);
+    for (i = 0; i < length; i++) {
+        priv->switcher_engines[i] = g_object_ref (engines[i]);
+        priv->switcher_names[i] =
+                g_strdup (ibus_engine_desc_get_longname (engines[i]));
+        fb_width_utf8 (priv->switcher_names[i],
+                       -1,
+                       -1,
+                       &priv->switcher_widths[i]);
+    }
+    priv->switcher_length = length;
 }
 
 static void
 fb_shell_show_switcher (FbShell         *shell,
-                        IBusEngineDesc **engines)
+                        IBusEngineDesc **engines,
+                        int              length)
 {
     FbShellPrivate *priv;
+    GString *line;
     int engine_index;
+    int columns;
+    int start;
+    int width;
     int i;
 
     g_return_if_fail (FB_IS_SHELL (shell));
@@ -529,24 +940,52 @@ fb_shell_show_switcher (FbShell         *shell,
     priv = shell->priv;
     engine_index = priv->switcher_engine_index;
 
-    fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
-    for (i = 0; engines[i] != NULL; i++) {
-        IBusEngineDesc *engine = engines[i];
-        const gchar *longname = ibus_engine_desc_get_longname (engine);
-        gchar *str;
-        if (i == 0)
-            str = g_strdup (longname);
+    fb_shell_update_switcher_cache (shell, engines, length);
+    if (engine_index < 0 || engine_index >= length)
+        return;
+
+    columns = priv->size.ws_col > 0 ? priv->size.ws_col : G_MAXINT;
+
+    /* Scroll the list to the left only if the selected engine is out of
+     * the row. */
+    width = priv->switcher_widths[engine_index];
+    for (start = engine_index; start > 0; start--) {
+        if (width + 1 + priv->switcher_widths[start - 1] > columns)
+            break;
+        width += 1 + priv->switcher_widths[start - 1];
+    }
+
+    line = priv->switcher_line;
+    g_string_truncate (line, 0);
+    width = 0;
+    for (i = start; i < length && width < columns; i++) {
+        const gchar *name = priv->switcher_names[i];
+        int name_width = priv->switcher_widths[i];
+        int bytes;
+
+        if (i > start) {
+            g_string_append_c (line, ' ');
+            width++;
+        }
+        if (width + name_width > columns)
+            bytes = fb_width_utf8 (name, -1, columns - width, &name_width);
         else
-            str = g_strdup_printf (" %s", longname);
+            bytes = strlen (name);
         if (i == engine_index)
-            fb_shell_draw_inverse_color (shell);
-        WRITE_STR (STDIN_FILENO, str);
+            g_string_append (line, "\033[7m");
+        g_string_append_len (line, name, bytes);
         if (i == engine_index)
-            fb_shell_reset_color (shell);
-        g_free (str);
+            g_string_append (line, "\033[m");
+        width += name_width;
     }
+
+    priv->status_line_drawn = FALSE;
+    fb_shell_save_cursor (shell);
+    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
+    fb_shell_write (shell, line->str, line->len);
+    fb_shell_erase_cursor_line (shell);
     fb_shell_restore_cursor (shell);
+    fb_shell_flush (shell);
 }
 
 static void
@@ -559,82 +998,143 @@ fb_shell_erase_switcher (FbShell         *shell,
 
     priv = shell->priv;
 
+    priv->status_line_drawn = FALSE;
     fb_shell_save_cursor (shell);
     fb_shell_move_cursor (shell, priv->size.ws_row, 0);
     fb_shell_erase_cursor_line (shell);
     fb_shell_restore_cursor (shell);
+    fb_shell_flush (shell);
 }
 
 static void
 fb_shell_destroy (FbShell *shell)
 {
     FbShellPrivate *priv;
+    FbShell *active_shell;
+    gboolean is_active;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
 
+    /* The scrolling region is reset only if the console still shows
+     * the shell.  The parked shells and the inactive shells, and
+     * the active shell which the next shell replaces, do not touch
+     * the console.
+     */
+    is_active = fb_shell_manager_active_shell (priv->manager) == shell;
     fb_shell_manager_shell_exited (priv->manager, shell);
+    active_shell = fb_shell_manager_active_shell (priv->manager);
+    is_active = is_active && (active_shell == NULL || active_shell == shell);
     fb_io_set_fd (FB_IO (shell), -1);
-    wait_child_process_exit (priv->pid);
+    /* The child is reaped in the main loop. */
+    fb_child_terminate (priv->pid);
 
-    g_free (priv->preedit_text);
-    priv->preedit_text = NULL;
+    if (priv->render_id) {
+        g_source_remove (priv->render_id);
+        priv->render_id = 0;
+    }
+    if (priv->load_settings_id) {
+        g_source_remove (priv->load_settings_id);
+        priv->load_settings_id = 0;
+    }
+    if (priv->verify_keymap_id) {
+        g_source_remove (priv->verify_keymap_id);
+        priv->verify_keymap_id = 0;
+    }
+    if (console_shell == shell)
+        fb_shell_redirect_console (shell, NULL);
+    g_clear_pointer (&priv->preedit_cells, g_array_unref);
+    g_clear_pointer (&priv->preedit_next, g_array_unref);
+    g_clear_pointer (&priv->lookup_cells, g_array_unref);
+    g_clear_pointer (&priv->lookup_arena, fb_arena_free);
+    g_clear_pointer (&priv->status_label_table, g_hash_table_unref);
+    g_clear_pointer (&priv->status_labels, g_ptr_array_unref);
+    g_clear_pointer (&priv->keymap, g_free);
 
     g_object_unref (priv->manager);
     priv->manager = NULL;
     g_object_unref (priv->fbterm);
     priv->fbterm = NULL;
 
-    fb_shell_set_scrolling_region (shell, 0, priv->size.ws_row);
+    if (is_active) {
+        fb_shell_set_scrolling_region (shell, 0, priv->size.ws_row);
+        fb_shell_write_console (priv->output->str, priv->output->len);
+        g_string_truncate (priv->output, 0);
+    }
+
+    if (priv->context != NULL)
+        g_signal_handlers_disconnect_by_data (priv->context, shell);
+    fb_shell_free_switcher_cache (shell);
+
+    fb_vt_free (priv->vt);
+    priv->vt = NULL;
+    g_clear_pointer (&priv->scrollback, fb_scrollback_free);
 }
 
 static void
-fb_shell_reset_preedit (FbShell *shell)
+fb_shell_move_cursor_right (FbShell *shell,
+                            int      n)
 {
-    FbShellPrivate *priv;
-    gunichar *ucs;
-    glong i, read, written;
-    GError *error = NULL;
-    int width = 0;
-    gchar *cleared_text = NULL;
-
-    g_return_if_fail (FB_IS_SHELL (shell));
-
-    priv = shell->priv;
-
-    if (priv->preedit_text == NULL)
-        return;
+    g_string_append_printf (shell->priv->output, "\033[%dC", n);
+}
 
-    ucs = g_utf8_to_ucs4 (priv->preedit_text, -1, &read, &written, &error);
-    if (ucs == NULL) {
-        g_warning ("Invalid string %s: %s", priv->preedit_text, error->message);
-        g_error_free (error);
-        g_free (priv->preedit_text);
-        priv->preedit_text = NULL;
-        return;
-    }
-    for (i = 0; i < read; i++) {
-        width += (g_unichar_iswide (ucs[i]) ? 2 : 1);
-    }
+static void
+fb_shell_set_preedit_attr (FbShell *shell,
+                           guint8   attr)
+{
+    fb_shell_reset_color (shell);
+    if (attr & PreeditAttrInverse)
+        fb_shell_draw_inverse_color (shell);
+    if (attr & PreeditAttrBlueBg)
+        fb_shell_draw_blue_color_bg (shell);
+}
 
-    g_free (ucs);
-    g_free (priv->preedit_text);
-    priv->preedit_text = NULL;
+/* The whole preedit is drawn in the inverse color and the sub segment,
+ * e.g. the converted clause, is drawn in the blue background.
+ */
+static void
+fb_shell_preedit_to_cells (IBusText *text,
+                           GArray   *cells)
+{
+    glong n_chars = g_utf8_strlen (text->text, -1);
+    guint sub_start = 0;
+    guint sub_end = 0;
+    guint8 whole_attr = PreeditAttrNone;
+    const gchar *p;
+    guint i;
 
-    if (!width)
-        return;
+    if (text->attrs) {
+        for (i = 0; ; i++) {
+            IBusAttribute *attr = ibus_attr_list_get (text->attrs, i);
 
-    cleared_text = g_new0 (gchar, width + 1);
-    memset (cleared_text, ' ', sizeof (gchar) * width);
-    cleared_text[width] = '\0';
+            if (attr == NULL)
+                break;
+            if (attr->type != IBUS_ATTR_TYPE_UNDERLINE &&
+                attr->type != IBUS_ATTR_TYPE_FOREGROUND &&
+                attr->type != IBUS_ATTR_TYPE_BACKGROUND)
+                continue;
 
-    fb_shell_save_cursor (shell);
+            if (attr->start_index == 0 && attr->end_index >= n_chars) {
+                whole_attr = PreeditAttrInverse;
+            } else {
+                sub_start = attr->start_index;
+                sub_end = attr->end_index;
+            }
+        }
+    }
 
-    WRITE_STR (STDOUT_FILENO, cleared_text);
-    g_free (cleared_text);
+    g_array_set_size (cells, 0);
+    for (p = text->text, i = 0; *p; p = g_utf8_next_char (p), i++) {
+        PreeditCell cell;
 
-    fb_shell_restore_cursor (shell);
+        cell.ch = g_utf8_get_char (p);
+        cell.width = fb_width_unichar (cell.ch);
+        cell.attr = whole_attr;
+        if (i >= sub_start && i < sub_end)
+            cell.attr |= PreeditAttrBlueBg;
+        g_array_append_val (cells, cell);
+    }
 }
 
 static void
@@ -646,20 +1146,92 @@ fb_shell_reset_lookup_table (FbShell *shell)
 
     priv = shell->priv;
 
-    if (priv->lookup_table_head == NULL)
+    if (priv->lookup_cells == NULL || priv->lookup_cells->len == 0)
         return;
 
-    g_free (priv->lookup_table_head);
-    g_free (priv->lookup_table_middle);
-    g_free (priv->lookup_table_end);
-    priv->lookup_table_head = NULL;
-    priv->lookup_table_middle = NULL;
-    priv->lookup_table_end = NULL;
+    g_array_set_size (priv->lookup_cells, 0);
+    fb_arena_reset (priv->lookup_arena);
+    priv->lookup_cursor = -1;
+}
 
-    fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, priv->lookup_table_x, priv->lookup_table_y);
-    fb_shell_erase_cursor_line (shell);
-    fb_shell_restore_cursor (shell);
+/* The rendered page is reused while the page start, the labels and
+ * the candidates are not changed.
+ */
+static gboolean
+fb_shell_lookup_page_is_cached (FbShell         *shell,
+                                IBusLookupTable *table,
+                                guint            page_start,
+                                guint            page_end)
+{
+    FbShellPrivate *priv = shell->priv;
+    GArray *cells = priv->lookup_cells;
+    guint i;
+
+    if (cells->len == 0 || priv->lookup_page_start != page_start ||
+        cells->len != page_end - page_start) {
+        return FALSE;
+    }
+
+    for (i = 0; i < cells->len; i++) {
+        LookupCell *cell = &g_array_index (cells, LookupCell, i);
+        IBusText *candidate =
+                ibus_lookup_table_get_candidate (table, page_start + i);
+        IBusText *label = ibus_lookup_table_get_label (table, i);
+        gchar index_str[16];
+
+        if (g_strcmp0 (cell->candidate, candidate->text) != 0)
+            return FALSE;
+        if (label == NULL) {
+            g_snprintf (index_str, sizeof (index_str), "%u", i);
+            if (g_strcmp0 (cell->label, index_str) != 0)
+                return FALSE;
+        } else if (g_strcmp0 (cell->label, label->text) != 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void
+fb_shell_build_lookup_page (FbShell         *shell,
+                            IBusLookupTable *table,
+                            guint            page_start,
+                            guint            page_end)
+{
+    FbShellPrivate *priv = shell->priv;
+    FbArena *arena = priv->lookup_arena;
+    GArray *cells = priv->lookup_cells;
+    int column = 0;
+    guint i;
+
+    fb_shell_reset_lookup_table (shell);
+
+    for (i = page_start; i < page_end; i++) {
+        IBusText *candidate = ibus_lookup_table_get_candidate (table, i);
+        guint index = i - page_start;
+        IBusText *label = ibus_lookup_table_get_label (table, index);
+        LookupCell cell;
+        int width = 0;
+
+        if (label)
+            cell.label = fb_arena_strdup (arena, label->text);
+        else
+            cell.label = fb_arena_strdup_printf (arena, "%u", index);
+        cell.candidate = fb_arena_strdup (arena, candidate->text);
+        cell.text = fb_arena_strdup_printf (arena,
+                                            index == 0 ? "%s. %s"
+                                                       : " %s. %s",
+                                            cell.label,
+                                            cell.candidate);
+        cell.column = column;
+
+        fb_width_utf8 (cell.text, -1, -1, &width);
+        column += width;
+        g_array_append_val (cells, cell);
+    }
+
+    priv->lookup_page_start = page_start;
+    priv->lookup_page_changed = TRUE;
 }
 
 static void
@@ -668,46 +1240,363 @@ fb_context_warning_cb (FbContext   *context,
                        FbShell     *shell)
 {
     FbShellPrivate *priv;
+    int columns;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
+    columns = fb_shell_get_columns (shell);
+
+    /* The warning is shown until the next status change. */
+    priv->dirty &= ~(DirtyStatus | DirtyStatusLabel);
+    priv->status_line_drawn = FALSE;
 
     fb_shell_save_cursor (shell);
     fb_shell_move_cursor (shell, priv->size.ws_row, 0);
     fb_shell_blink_color (shell);
-    WRITE_STR (STDOUT_FILENO, message);
+    fb_shell_write_fit (shell, message, &columns);
     fb_shell_reset_color (shell);
     fb_shell_restore_cursor (shell);
+    fb_shell_flush (shell);
 }
 
+/* Redraws one candidate in place when only the cursor is moved.
+ * The candidates over the terminal width are clipped.
+ */
 static void
-fb_context_cursor_position_cb (FbContext *context,
-                               int        x,
-                               int        y,
-                               FbShell   *shell)
+fb_shell_draw_lookup_cell (FbShell *shell,
+                           int      index,
+                           gboolean highlight)
 {
-    FbShellPrivate *priv;
-    int lookup_table_x = x + 1;
-    int lookup_table_y = 1;
+    FbShellPrivate *priv = shell->priv;
+    LookupCell *cell = &g_array_index (priv->lookup_cells, LookupCell, index);
+    int columns = fb_shell_get_columns (shell);
 
-    g_return_if_fail (FB_IS_SHELL (shell));
+    if (columns >= 0) {
+        if (cell->column >= columns)
+            return;
+        columns -= cell->column;
+    }
 
-    priv = shell->priv;
+    fb_shell_move_cursor (shell,
+                          priv->lookup_table_x,
+                          priv->lookup_table_y + cell->column);
+    if (highlight)
+        fb_shell_draw_inverse_color (shell);
+    fb_shell_write_fit (shell, cell->text, &columns);
+    if (highlight)
+        fb_shell_reset_color (shell);
+}
 
-    if (priv->lookup_table_head == NULL)
-        return;
+/* The lookup table is drawn on the next line of the cursor and
+ * the previous one is erased.
+ */
+static gboolean
+fb_shell_draw_lookup_table (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    gboolean erased = FALSE;
+    int row = 0;
+    int columns;
+    guint i;
+
+    if (priv->lookup_cells->len > 0) {
+        fb_vt_get_cursor (priv->vt, &row, NULL);
+
+        if (priv->lookup_table_drawn && !priv->lookup_page_changed &&
+            priv->lookup_table_x == row + 2) {
+            if (priv->lookup_cursor == priv->lookup_cursor_drawn)
+                return FALSE;
+            if (priv->lookup_cursor_drawn >= 0) {
+                fb_shell_draw_lookup_cell (shell,
+                                           priv->lookup_cursor_drawn,
+                                           FALSE);
+            }
+            if (priv->lookup_cursor >= 0)
+                fb_shell_draw_lookup_cell (shell, priv->lookup_cursor, TRUE);
+            priv->lookup_cursor_drawn = priv->lookup_cursor;
+            return TRUE;
+        }
+    }
+
+    if (priv->lookup_table_drawn) {
+        fb_shell_move_cursor (shell,
+                              priv->lookup_table_x,
+                              priv->lookup_table_y);
+        fb_shell_erase_cursor_line (shell);
+        priv->lookup_table_drawn = FALSE;
+        priv->lookup_cursor_drawn = -1;
+        erased = TRUE;
+    }
+
+    if (priv->lookup_cells->len == 0)
+        return erased;
+
+    priv->lookup_table_x = row + 2;
+    priv->lookup_table_y = 1;
+    columns = fb_shell_get_columns (shell);
+
+    fb_shell_move_cursor (shell, priv->lookup_table_x, priv->lookup_table_y);
+    for (i = 0; i < priv->lookup_cells->len && columns != 0; i++) {
+        LookupCell *cell = &g_array_index (priv->lookup_cells, LookupCell, i);
+
+        if ((int) i == priv->lookup_cursor) {
+            fb_shell_draw_inverse_color (shell);
+            fb_shell_write_fit (shell, cell->text, &columns);
+            fb_shell_reset_color (shell);
+        } else {
+            fb_shell_write_fit (shell, cell->text, &columns);
+        }
+    }
+    priv->lookup_table_drawn = TRUE;
+    priv->lookup_page_changed = FALSE;
+    priv->lookup_cursor_drawn = priv->lookup_cursor;
+    return TRUE;
+}
+
+/* Draws the pending preedit from the cursor position.
+ * The unchanged prefix is kept on the screen unless the shell output
+ * could overwrite it.
+ */
+static gboolean
+fb_shell_draw_preedit (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    GArray *cells = priv->preedit_next;
+    GArray *old_cells = priv->preedit_cells;
+    guint start = 0;
+    guint i;
+    int start_width = 0;
+    int width;
+    guint8 attr = PreeditAttrNone;
+
+    if (!priv->preedit_pending)
+        return FALSE;
+
+    if (!priv->preedit_stale) {
+        for (; start < old_cells->len && start < cells->len; start++) {
+            PreeditCell *old_cell = &g_array_index (old_cells,
+                                                    PreeditCell,
+                                                    start);
+            PreeditCell *cell = &g_array_index (cells, PreeditCell, start);
+            if (old_cell->ch != cell->ch || old_cell->attr != cell->attr)
+                break;
+            start_width += cell->width;
+        }
+    }
+    width = start_width;
+    for (i = start; i < cells->len; i++)
+        width += g_array_index (cells, PreeditCell, i).width;
+
+    /* The arrays are swapped and reused for the next preedit. */
+    priv->preedit_cells = cells;
+    priv->preedit_next = old_cells;
+    priv->preedit_pending = FALSE;
+
+    if (start == cells->len && width == priv->preedit_width &&
+        !priv->preedit_stale) {
+        return FALSE;
+    }
+
+    if (start_width > 0) {
+        int columns = priv->size.ws_col > 0 ? priv->size.ws_col : G_MAXINT;
+        int row = 0;
+        int col = 0;
+
+        fb_vt_get_cursor (priv->vt, &row, &col);
+        if (col + start_width < columns) {
+            fb_shell_move_cursor_right (shell, start_width);
+        } else {
+            fb_shell_move_cursor (shell,
+                                  row + (col + start_width) / columns + 1,
+                                  (col + start_width) % columns + 1);
+        }
+    }
+
+    for (i = start; i < cells->len; i++) {
+        PreeditCell *cell = &g_array_index (cells, PreeditCell, i);
+        if (i == start || cell->attr != attr) {
+            attr = cell->attr;
+            fb_shell_set_preedit_attr (shell, attr);
+        }
+        g_string_append_unichar (priv->output, cell->ch);
+    }
+    if (start < cells->len)
+        fb_shell_reset_color (shell);
+
+    /* Erase the leftover cells of the previous preedit. */
+    if (priv->preedit_width > width) {
+        g_string_append_printf (priv->output, "%*s",
+                                priv->preedit_width - width, "");
+    }
+
+    priv->preedit_width = width;
+    priv->preedit_stale = FALSE;
+    return TRUE;
+}
+
+static void
+fb_shell_free_status_label (StatusLabel *label)
+{
+    g_free (label->key);
+    g_free (label->label);
+    g_slice_free (StatusLabel, label);
+}
+
+/* Writes @label from @column where the cursor is placed and
+ * returns the next column.
+ */
+static int
+fb_shell_draw_status_label (FbShell     *shell,
+                            StatusLabel *label,
+                            int          column)
+{
+    int columns = fb_shell_get_columns (shell);
+    int width = 0;
+
+    fb_width_utf8 (label->label, -1, -1, &width);
+    label->column = column;
+    label->width = width + 1;
+    label->dirty = FALSE;
+
+    if (columns >= 0) {
+        if (column >= columns)
+            return column + label->width;
+        columns -= column;
+    }
+    fb_shell_write_fit (shell, " ", &columns);
+    fb_shell_write_fit (shell, label->label, &columns);
+    return column + label->width;
+}
+
+/* The status line shows the engine name and the property labels
+ * on the last row.
+ */
+static gboolean
+fb_shell_draw_status_line (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    int column = 0;
+    int columns;
+    guint i;
+
+    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
+    fb_shell_erase_cursor_line (shell);
+    if (priv->engine_name != NULL) {
+        columns = fb_shell_get_columns (shell);
+        fb_width_utf8 (priv->engine_name, -1, -1, &column);
+        fb_shell_draw_inverse_color (shell);
+        fb_shell_write_fit (shell, priv->engine_name, &columns);
+        fb_shell_reset_color (shell);
+    }
+
+    for (i = 0; i < priv->status_labels->len; i++) {
+        column = fb_shell_draw_status_label (
+                shell,
+                g_ptr_array_index (priv->status_labels, i),
+                column);
+    }
+    priv->status_line_drawn = TRUE;
+    return TRUE;
+}
+
+/* Repaints the changed labels only.  The following labels are also
+ * repainted if the width of a label is changed.
+ */
+static gboolean
+fb_shell_draw_status_labels (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    gboolean drawn = FALSE;
+    guint i;
+
+    if (!priv->status_line_drawn)
+        return fb_shell_draw_status_line (shell);
+
+    for (i = 0; i < priv->status_labels->len; i++) {
+        StatusLabel *label = g_ptr_array_index (priv->status_labels, i);
+        int old_width = label->width;
+        int column;
+
+        if (!label->dirty)
+            continue;
+
+        fb_shell_move_cursor (shell, priv->size.ws_row, label->column + 1);
+        column = fb_shell_draw_status_label (shell, label, label->column);
+        drawn = TRUE;
+        if (label->width == old_width)
+            continue;
+
+        for (i++; i < priv->status_labels->len; i++) {
+            column = fb_shell_draw_status_label (
+                    shell,
+                    g_ptr_array_index (priv->status_labels, i),
+                    column);
+        }
+        fb_shell_erase_cursor_line (shell);
+        break;
+    }
+    return drawn;
+}
+
+/* All the overlays changed by a key are drawn in one frame with
+ * a single write() after the IBus signals are dispatched.
+ */
+static gboolean
+fb_shell_render (gpointer user_data)
+{
+    FbShell *shell = FB_SHELL (user_data);
+    FbShellPrivate *priv = shell->priv;
+    guint dirty = priv->dirty;
+    gsize start = priv->output->len;
+    gboolean drawn = FALSE;
+
+    priv->render_id = 0;
+    /* Draw after the scrollback view is closed. */
+    if (priv->scroll_offset > 0)
+        return G_SOURCE_REMOVE;
+    priv->dirty = 0;
 
     fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, lookup_table_x, lookup_table_y);
-    priv->lookup_table_x = lookup_table_x;
-    priv->lookup_table_y = lookup_table_y;
-    WRITE_STR (STDOUT_FILENO, priv->lookup_table_head);
-    fb_shell_draw_inverse_color (shell);
-    WRITE_STR (STDOUT_FILENO, priv->lookup_table_middle);
-    fb_shell_reset_color (shell);
-    WRITE_STR (STDOUT_FILENO, priv->lookup_table_end);
-    fb_shell_restore_cursor (shell);
+    if ((dirty & DirtyStatus) && fb_shell_draw_status_line (shell)) {
+        fb_shell_restore_cursor (shell);
+        drawn = TRUE;
+    } else if ((dirty & DirtyStatusLabel) &&
+               fb_shell_draw_status_labels (shell)) {
+        fb_shell_restore_cursor (shell);
+        drawn = TRUE;
+    }
+    if ((dirty & DirtyPreedit) && fb_shell_draw_preedit (shell)) {
+        fb_shell_restore_cursor (shell);
+        drawn = TRUE;
+    }
+    if ((dirty & DirtyLookupTable) && fb_shell_draw_lookup_table (shell)) {
+        fb_shell_restore_cursor (shell);
+        drawn = TRUE;
+    }
+    if (!drawn)
+        g_string_truncate (priv->output, start);
+    fb_shell_flush (shell);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* The idle source of G_PRIORITY_HIGH_IDLE runs after the pending
+ * D-Bus messages and before the main loop sleeps.
+ */
+static void
+fb_shell_queue_render (FbShell  *shell,
+                       DirtyType type)
+{
+    FbShellPrivate *priv = shell->priv;
+
+    priv->dirty |= type;
+    if (priv->render_id)
+        return;
+    priv->render_id = g_idle_add_full (G_PRIORITY_HIGH_IDLE,
+                                       fb_shell_render,
+                                       shell,
+                                       NULL);
 }
 
 static int
@@ -736,14 +1625,14 @@ fb_context_switcher_switch_cb (FbContext         *context,
         if (index < 0)
             index = length -1;
         priv->switcher_engine_index = index;
-        fb_shell_show_switcher (shell, engines);
+        fb_shell_show_switcher (shell, engines, length);
         return -1;
     case IBUS_KEY_Right:
         index++;
         if (index >= length)
             index = 0;
         priv->switcher_engine_index = index;
-        fb_shell_show_switcher (shell, engines);
+        fb_shell_show_switcher (shell, engines, length);
         return -1;
     case IBUS_KEY_Return:
         priv->switcher_engine_index = 0;
@@ -766,6 +1655,9 @@ fb_context_keysym_to_keycode_cb (FbContext *context,
 
     priv = shell->priv;
 
+    fb_shell_ensure_keymap (shell);
+    if (priv->keymap == NULL)
+        return 0;
     for (keycode = 0; keycode < NR_KEYS; keycode++) {
         if (priv->keymap[keycode] == keysym)
             return keycode;
@@ -787,14 +1679,20 @@ fb_context_engine_changed_cb (FbContext      *context,
 
     g_free (priv->engine_name);
     priv->engine_name = g_strdup (ibus_engine_desc_get_longname (engine));
+    fb_shell_queue_render (shell, DirtyStatus);
+}
 
-    fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
-    fb_shell_erase_cursor_line (shell);
-    fb_shell_draw_inverse_color (shell);
-    WRITE_STR (STDOUT_FILENO, priv->engine_name);
-    fb_shell_reset_color (shell);
-    fb_shell_restore_cursor (shell);
+/* The keymap is read again only when loadkeys changed it because
+ * the keys typed while the console is in K_UNICODE are lost.
+ */
+static void
+fb_context_keymap_changed_cb (FbContext *context,
+                              FbShell   *shell)
+{
+    g_return_if_fail (FB_IS_SHELL (shell));
+
+    keymap_serial++;
+    fbterm_object_keymap_changed (shell->priv->fbterm);
 }
 
 static void
@@ -804,6 +1702,8 @@ fb_context_commit_cb (FbContext *context,
 {
     g_return_if_fail (FB_IS_SHELL (shell));
 
+    fb_trace (FB_TRACE_COMMIT, strlen (text->text));
+    fb_trace (FB_TRACE_PTY_WRITE, strlen (text->text));
     fb_io_write (FB_IO (shell), text->text, strlen (text->text));
 }
 
@@ -815,80 +1715,16 @@ fb_context_preedit_changed_cb (FbContext *context,
                                FbShell   *shell)
 {
     FbShellPrivate *priv;
-    int text_length;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
 
-    fb_shell_reset_preedit (shell);
-    fb_shell_save_cursor (shell);
-
-    text_length = strlen (text->text);
-
-    if (text->attrs) {
-        int i;
-        gchar *start_pointer, *end_pointer;
-        gchar *substr;
-        gboolean has_whole_preedit = FALSE;
-        gboolean has_sub_preedit = FALSE;
-
-        for (i = 0; ; i++) {
-            IBusAttribute *attr = ibus_attr_list_get (text->attrs, i);
-            gchar *s, *e;
-
-            if (attr == NULL)
-                break;
-            if (attr->type != IBUS_ATTR_TYPE_UNDERLINE &&
-                attr->type != IBUS_ATTR_TYPE_FOREGROUND &&
-                attr->type != IBUS_ATTR_TYPE_BACKGROUND)
-                continue;
-
-            s = g_utf8_offset_to_pointer (text->text, attr->start_index);
-            e = g_utf8_offset_to_pointer (text->text, attr->end_index);
-
-            if ((e - s) == text_length) {
-                has_whole_preedit = TRUE;
-                continue;
-            } else {
-                has_sub_preedit = TRUE;
-                start_pointer = s;
-                end_pointer = e;
-                continue;
-            }
-        }
-        if (has_whole_preedit)
-            fb_shell_draw_inverse_color (shell);
-        if (has_sub_preedit) {
-            if (start_pointer > text->text) {
-                substr = g_strndup (text->text, start_pointer - text->text);
-                WRITE_STR (STDOUT_FILENO, substr);
-                g_free (substr);
-            }
-
-            fb_shell_draw_blue_color_bg (shell);
-            substr = g_strndup (start_pointer, end_pointer - start_pointer);
-            WRITE_STR (STDOUT_FILENO, substr);
-            g_free (substr);
-            fb_shell_reset_color (shell);
-            if (has_whole_preedit)
-                fb_shell_draw_inverse_color (shell);
-
-            if (text->text + text_length > end_pointer) {
-                substr = g_strndup (end_pointer,
-                                    text->text + text_length - end_pointer);
-                WRITE_STR (STDOUT_FILENO, substr);
-                g_free (substr);
-            }
-        } else {
-            write (STDOUT_FILENO, text->text, text_length);
-        }
-    } else {
-        write (STDOUT_FILENO, text->text, text_length);
-    }
-
-    priv->preedit_text = g_strdup (text->text);
-    fb_shell_restore_cursor (shell);
+    fb_trace (FB_TRACE_PREEDIT, strlen (text->text));
+    /* Only the last preedit in a burst is drawn. */
+    fb_shell_preedit_to_cells (text, priv->preedit_next);
+    priv->preedit_pending = TRUE;
+    fb_shell_queue_render (shell, DirtyPreedit);
 }
 
 static void
@@ -901,74 +1737,60 @@ fb_context_update_lookup_table_cb (FbContext       *context,
     guint page_size;
     guint ncandidates;
     guint cursor;
-    guint cursor_in_page = 0;
     guint page_start_pos;
     guint page_end_pos;
-    guint i;
-    gboolean show_cursor = TRUE;
-    GString *candidate_list_head;
-    GString *candidate_list_middle;
-    GString *candidate_list_end;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
+    fb_trace (FB_TRACE_LOOKUP,
+              table ? ibus_lookup_table_get_number_of_candidates (table) : 0);
     if (!visible) {
         fb_shell_reset_lookup_table (shell);
+        fb_shell_queue_render (shell, DirtyLookupTable);
         return;
     }
 
     priv = shell->priv;
 
-    page_size = ibus_lookup_table_get_page_size (table);
+    page_size = MAX (ibus_lookup_table_get_page_size (table), 1);
     ncandidates = ibus_lookup_table_get_number_of_candidates (table);
     cursor = ibus_lookup_table_get_cursor_pos (table);
-    cursor_in_page = ibus_lookup_table_get_cursor_in_page (table);
     page_start_pos = cursor / page_size * page_size;
     page_end_pos = MIN (page_start_pos + page_size, ncandidates);
-    show_cursor = ibus_lookup_table_is_cursor_visible (table);
-    candidate_list_head = g_string_new (NULL);
-    candidate_list_middle = g_string_new (NULL);
-    candidate_list_end = g_string_new (NULL);
-
-    for (i = page_start_pos; i < page_end_pos; i++) {
-        IBusText *candidate = ibus_lookup_table_get_candidate (table, i);
-        guint index = i - page_start_pos;
-        IBusText *label = ibus_lookup_table_get_label (table, index);
-        gchar *label_str;
-        gchar *candidate_cell;
 
-        if (label)
-            label_str = g_strdup (label->text);
-        else
-            label_str = g_strdup_printf ("%d", index);
-
-        if (index == 0) {
-            candidate_cell = g_strdup_printf ("%s. %s",
-                                              label_str, candidate->text);
-        } else {
-            candidate_cell = g_strdup_printf (" %s. %s",
-                                              label_str, candidate->text);
-        }
+    if (!fb_shell_lookup_page_is_cached (shell,
+                                         table,
+                                         page_start_pos,
+                                         page_end_pos)) {
+        fb_shell_build_lookup_page (shell,
+                                    table,
+                                    page_start_pos,
+                                    page_end_pos);
+    }
 
-        if (show_cursor) {
-            if (index < cursor_in_page)
-                g_string_append (candidate_list_head, candidate_cell);
-            else if (index == cursor_in_page)
-                g_string_append (candidate_list_middle, candidate_cell);
-            else
-                g_string_append (candidate_list_end, candidate_cell);
-        } else {
-            g_string_append (candidate_list_head, candidate_cell);
-        }
-        g_free (candidate_cell);
-        g_free (label_str);
+    if (ibus_lookup_table_is_cursor_visible (table) &&
+        page_end_pos > page_start_pos) {
+        priv->lookup_cursor = ibus_lookup_table_get_cursor_in_page (table);
+        if (priv->lookup_cursor >= (int) (page_end_pos - page_start_pos))
+            priv->lookup_cursor = -1;
+    } else {
+        priv->lookup_cursor = -1;
     }
+    fb_shell_queue_render (shell, DirtyLookupTable);
+}
 
-    fb_shell_reset_lookup_table (shell);
-    priv->lookup_table_head = g_string_free (candidate_list_head, FALSE);
-    priv->lookup_table_middle = g_string_free (candidate_list_middle, FALSE);
-    priv->lookup_table_end = g_string_free (candidate_list_end, FALSE);
-    fb_shell_get_cursor (shell);
+static void
+fb_shell_add_status_label (FbShell     *shell,
+                           const gchar *key,
+                           const gchar *text)
+{
+    FbShellPrivate *priv = shell->priv;
+    StatusLabel *label = g_slice_new0 (StatusLabel);
+
+    label->key = g_strdup (key);
+    label->label = g_strdup (text);
+    g_ptr_array_add (priv->status_labels, label);
+    g_hash_table_replace (priv->status_label_table, label->key, label);
 }
 
 static void
@@ -978,72 +1800,26 @@ fb_context_register_properties_cb (FbContext    *context,
 {
     FbShellPrivate *priv;
     int i;
-    GString *str = NULL;
-    gchar *status_line = NULL;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
 
-    if (priv->status_label) {
-        for (i = 0; priv->status_label[i]; i++) {
-            g_free (priv->status_label[i]->key);
-            g_free (priv->status_label[i]->label);
-            g_free (priv->status_label[i]);
-        }
-        g_free (priv->status_label);
-        priv->status_label = NULL;
-    }
-
-    fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
-    fb_shell_erase_cursor_line (shell);
-    if (priv->engine_name != NULL) {
-        fb_shell_draw_inverse_color (shell);
-        WRITE_STR (STDOUT_FILENO, priv->engine_name);
-        fb_shell_reset_color (shell);
-    }
-
-    for (i = 0; ; i++) {
-        IBusProperty *prop = ibus_prop_list_get (props, i);
-        if (prop == NULL)
-            break;
-    }
-
-    if (i == 0)
-        goto reset_cursor;
-
-    priv->status_label = g_new0 (StatusLabel*, i + 1);
+    g_hash_table_remove_all (priv->status_label_table);
+    g_ptr_array_set_size (priv->status_labels, 0);
 
     for (i = 0; ; i++) {
         IBusProperty *prop = ibus_prop_list_get (props, i);
-        IBusText *text;
 
         if (prop == NULL)
             break;
 
-        priv->status_label[i] = g_new0 (StatusLabel, 1);
-        priv->status_label[i]->key = g_strdup (ibus_property_get_key (prop));
-
-        text = ibus_property_get_label (prop);
-        priv->status_label[i]->label = g_strdup (text->text);
-        if (!str)
-            str = g_string_new ("");
-        str = g_string_append_c (str, ' ');
-        str = g_string_append (str, text->text);
+        fb_shell_add_status_label (shell,
+                                   ibus_property_get_key (prop),
+                                   ibus_property_get_label (prop)->text);
     }
 
-    if (!str)
-        goto reset_cursor;
-
-    status_line = g_string_free (str, FALSE);
-
-    WRITE_STR (STDIN_FILENO, status_line);
-    g_free (status_line);
-
-reset_cursor:
-    fb_shell_restore_cursor (shell);
-    return;
+    fb_shell_queue_render (shell, DirtyStatus);
 }
 
 static void
@@ -1053,58 +1829,38 @@ fb_context_update_property_cb (FbContext    *context,
 {
     FbShellPrivate *priv;
     IBusText *text;
-    const gchar *key;
-    int i;
-    GString *str = NULL;
-    gchar *status_line = NULL;
+    StatusLabel *label;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
     priv = shell->priv;
 
-    fb_shell_save_cursor (shell);
-    fb_shell_move_cursor (shell, priv->size.ws_row, 0);
-    fb_shell_erase_cursor_line (shell);
-    if (priv->engine_name != NULL) {
-        fb_shell_draw_inverse_color (shell);
-        WRITE_STR (STDOUT_FILENO, priv->engine_name);
-        fb_shell_reset_color (shell);
-    }
-
     text = ibus_property_get_label (prop);
-    key = ibus_property_get_key (prop);
-
-    if (!priv->status_label) {
-        priv->status_label = g_new0 (StatusLabel*, 2);
-        priv->status_label[0] = g_new0 (StatusLabel, 1);
-        priv->status_label[0]->key = g_strdup (key);
-        priv->status_label[0]->label = g_strdup (text->text);
-        str = g_string_new (" ");
-        str = g_string_append (str, text->text);
-    } else {
-        for (i = 0; priv->status_label[i]; i++) {
-            if (g_strcmp0 (priv->status_label[i]->key, key) == 0) {
-                g_free (priv->status_label[i]->label);
-                priv->status_label[i]->label = g_strdup (text->text);
-            }
-            if (!str)
-                str = g_string_new ("");
-            str = g_string_append_c (str, ' ');
-            str = g_string_append (str, priv->status_label[i]->label);
-        }
-    }
+    label = g_hash_table_lookup (priv->status_label_table,
+                                 ibus_property_get_key (prop));
 
-    if (!str) {
-        fb_shell_restore_cursor (shell);
+    /* The first property is the label if no properties are registered.
+     * The unknown keys of the sub properties and the menu items are
+     * ignored after the labels are registered.
+     */
+    if (label == NULL) {
+        if (priv->status_labels->len > 0)
+            return;
+        fb_shell_add_status_label (shell,
+                                   ibus_property_get_key (prop),
+                                   text->text);
+        fb_shell_queue_render (shell, DirtyStatus);
         return;
     }
 
-    status_line = g_string_free (str, FALSE);
-
-    WRITE_STR (STDIN_FILENO, status_line);
-    g_free (status_line);
+    /* Some engines update the properties on every key. */
+    if (g_strcmp0 (label->label, text->text) == 0)
+        return;
 
-    fb_shell_restore_cursor (shell);
+    g_free (label->label);
+    label->label = g_strdup (text->text);
+    label->dirty = TRUE;
+    fb_shell_queue_render (shell, DirtyStatusLabel);
 }
 
 static void
@@ -1136,6 +1892,7 @@ void
 fb_shell_mode_changed (FbShell *shell, ModeType type)
 {
     FbShellPrivate *priv;
+    guint modes;
 
     g_return_if_fail (FB_IS_SHELL (shell));
 
@@ -1144,66 +1901,150 @@ fb_shell_mode_changed (FbShell *shell, ModeType type)
     if (fb_shell_manager_active_shell (priv->manager) != shell)
         return;
 
-    if (type & CursorKeyEscO)
-        fb_shell_change_mode (shell, CursorKeyEscO, FALSE);
+    /* Restore the modes which the shell set last. */
+    modes = fb_vt_get_modes (priv->vt);
 
-    if (type & AutoRepeatKey)
-        fb_shell_change_mode (shell, AutoRepeatKey, TRUE);
+    if (type & CursorKeyEscO) {
+        fb_shell_change_mode (shell, CursorKeyEscO,
+                              !!(modes & FB_VT_MODE_CURSOR_KEY_ESC_O));
+    }
 
-    if (type & ApplicKeypad)
-        fb_shell_change_mode (shell, ApplicKeypad, FALSE);
+    if (type & AutoRepeatKey) {
+        fb_shell_change_mode (shell, AutoRepeatKey,
+                              !!(modes & FB_VT_MODE_AUTO_REPEAT));
+    }
 
-    if (type & CRWithLF)
-        fb_shell_change_mode (shell, CRWithLF, FALSE);
+    if (type & ApplicKeypad) {
+        fb_shell_change_mode (shell, ApplicKeypad,
+                              !!(modes & FB_VT_MODE_APPLIC_KEYPAD));
+    }
 
+    if (type & CRWithLF) {
+        fb_shell_change_mode (shell, CRWithLF,
+                              !!(modes & FB_VT_MODE_CR_WITH_LF));
+    }
+
+    /* Clear the screen and draw the screen model of the shell. */
     if (type & ClearScreen)
-        fb_shell_change_mode (shell, ClearScreen, TRUE);
+        fb_vt_repaint (priv->vt, NULL, priv->output);
+
+    fb_shell_flush (shell);
 }
 
-void
-fb_shell_switch_vt (FbShell *shell, gboolean enter, FbShell *peer)
+/* Redirect the console messages to the pty of @target or back to
+ * the console if @target is %NULL.
+ */
+static void
+fb_shell_redirect_console (FbShell *shell,
+                           FbShell *target)
 {
-    FbShellPrivate *priv;
+    FbConsole *console = fbterm_object_get_console (shell->priv->fbterm);
+    int pty_fd = target ? fb_io_get_fd (FB_IO (target)) : -1;
 
-    g_return_if_fail (FB_IS_SHELL (shell));
+    if (console_shell == target)
+        return;
 
-    priv = shell->priv;
+    console_shell = fb_console_redirect (console, pty_fd) ? target : NULL;
+}
 
-    if (priv->tty0_fd == -1)
-        priv->tty0_fd = open ("/dev/tty0", O_RDWR);
-    if (priv->tty0_fd != -1) {
-        int tty_fd = -1;
+static void
+fb_shell_update_size (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
 
-        seteuid (0);
+    fb_shell_manager_get_winsize (priv->manager, &priv->size);
+    fb_vt_resize (priv->vt, priv->size.ws_row, priv->size.ws_col);
+    priv->preedit_stale = TRUE;
+    priv->status_line_drawn = FALSE;
+    fb_shell_set_scrolling_region (shell, 0, priv->size.ws_row - 1);
+}
 
-        /* Need tty instead of tty0 to get the right size. */
-        tty_fd = open ("/dev/tty", O_RDONLY);
-        ioctl (tty_fd, TIOCGWINSZ, &priv->size);
-        close (tty_fd);
+static gboolean
+fb_shell_load_settings_idle (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
 
-        fb_shell_set_scrolling_region (shell, 0, priv->size.ws_row - 1);
-        ioctl (priv->tty0_fd, TIOCCONS, 0);
-        if (enter) {
-            int slavefd = open (ptsname (fb_io_get_fd (FB_IO (shell))), O_RDWR);
-            ioctl (slavefd, TIOCCONS, 0);
-            close (slavefd);
-        }
-        seteuid (getuid ());
+    priv->load_settings_id = 0;
+    priv->settings_serial = settings_serial;
+    if (priv->context != NULL) {
+        FB_CONTEXT_GET_INTERFACE (priv->context)->load_settings(
+                FB_CONTEXT (priv->context));
     }
+    return G_SOURCE_REMOVE;
+}
+
+void
+fb_shell_switch_vt (FbShell *shell, gboolean enter, FbShell *peer)
+{
+    FbShellPrivate *priv;
+    gint64 start_time;
+
+    g_return_if_fail (FB_IS_SHELL (shell));
+
+    priv = shell->priv;
+    start_time = g_get_monotonic_time ();
+    priv->leave_time = enter ? 0 : start_time;
 
     if (enter) {
-        fb_shell_mode_changed (shell, AllModes);
-        fb_shell_load_keymap (shell);
-        if (priv->context != NULL) {
-            FB_CONTEXT_GET_INTERFACE (priv->context)->load_settings(
-                    FB_CONTEXT (priv->context));
+        /* The keymap and the settings can be changed on the other VCs. */
+        if (peer == NULL) {
+            keymap_serial++;
+            settings_serial++;
+        }
+        if (priv->context == NULL)
+            fb_shell_create_context (shell);
+        fb_shell_update_size (shell);
+        fb_shell_redirect_console (shell, shell);
+
+        /* Draw only the cells which differ from the screen of @peer
+         * unless the console shows the scrollback view of @peer.
+         */
+        if (peer != NULL && peer->priv->vt != NULL &&
+            peer->priv->scroll_offset == 0) {
+            fb_shell_mode_changed (shell, AllModes & ~ClearScreen);
+            fb_vt_repaint (priv->vt, peer->priv->vt, priv->output);
+        } else {
+            fb_shell_mode_changed (shell, AllModes);
+        }
+        if (peer != NULL)
+            peer->priv->scroll_offset = 0;
+
+        /* The settings are loaded synchronously for the first time
+         * to bind the hotkeys and later after the screen is drawn.
+         */
+        if (priv->settings_serial == 0) {
+            fb_shell_load_settings_idle (shell);
+        } else if (priv->settings_serial != settings_serial &&
+                   priv->load_settings_id == 0) {
+            priv->load_settings_id =
+                    g_idle_add_full (G_PRIORITY_LOW,
+                                     (GSourceFunc) fb_shell_load_settings_idle,
+                                     shell,
+                                     NULL);
         }
     } else if (!peer) {
+        priv->scroll_offset = 0;
+        fb_shell_redirect_console (shell, NULL);
+        /* Reset the modes for the other consoles without changing
+         * the modes of the shell in the screen model.
+         */
+        fb_shell_set_scrolling_region (shell, 0, priv->size.ws_row - 1);
+        fb_shell_flush (shell);
         fb_shell_change_mode (shell, CursorKeyEscO, FALSE);
         fb_shell_change_mode (shell, ApplicKeypad, FALSE);
         fb_shell_change_mode (shell, CRWithLF, FALSE);
         fb_shell_change_mode (shell, AutoRepeatKey, TRUE);
+        fb_shell_write_console (priv->output->str, priv->output->len);
+        g_string_truncate (priv->output, 0);
     }
+    /* Leaving for @peer needs nothing since @peer redirects the console
+     * and draws the whole screen.
+     */
+    fb_shell_flush (shell);
+
+    g_debug ("%s the shell %d in %" G_GINT64_FORMAT " usec",
+             enter ? "Entered" : "Left",
+             priv->pid, g_get_monotonic_time () - start_time);
 }
 
 void
@@ -1215,14 +2056,113 @@ fb_shell_init_shell_process (FbShell *shell)
 
     priv = shell->priv;
 
-    if (priv->tty0_fd != -1)
-        close (priv->tty0_fd);
     fbterm_object_init_child_process (priv->fbterm);
 
     if (!priv->first_shell)
         return;
 }
 
+/* Draw the rows from @scroll_offset lines above the screen.  The view is
+ * written without fb_shell_flush() so that the screen model keeps
+ * the live screen.
+ */
+static void
+fb_shell_draw_scrollback (FbShell *shell)
+{
+    FbShellPrivate *priv = shell->priv;
+    GString *view;
+    guint n_lines;
+    guint top;
+    int rows;
+    int row;
+
+    fb_vt_get_size (priv->vt, &rows, NULL);
+    n_lines = fb_scrollback_get_n_lines (priv->scrollback);
+    top = n_lines - priv->scroll_offset;
+    /* The last row is the status line. */
+    rows = MAX (rows - 1, 1);
+
+    view = g_string_new ("\033[?25l");
+    for (row = 0; row < rows; row++) {
+        guint index = top + row;
+
+        g_string_append_printf (view, "\033[%d;1H\033[0m", row + 1);
+        if (index < n_lines)
+            fb_scrollback_get_line (priv->scrollback, index, view);
+        else
+            fb_vt_append_row (priv->vt, index - n_lines, view);
+        g_string_append (view, "\033[0m\033[K");
+    }
+    fb_shell_write_console (view->str, view->len);
+    g_string_free (view, TRUE);
+}
+
+void
+fb_shell_resize (FbShell *shell)
+{
+    g_return_if_fail (FB_IS_SHELL (shell));
+
+    fb_shell_update_size (shell);
+    if (shell->priv->scroll_offset > 0)
+        fb_shell_draw_scrollback (shell);
+    else
+        fb_shell_mode_changed (shell, AllModes);
+}
+
+/* Scroll the view by @lines and the positive @lines are the older lines.
+ * The live screen is drawn again when the view reaches the bottom.
+ */
+static void
+fb_shell_scroll_view (FbShell *shell,
+                      int      lines)
+{
+    FbShellPrivate *priv = shell->priv;
+    guint n_lines = fb_scrollback_get_n_lines (priv->scrollback);
+    guint offset;
+
+    if (lines < 0)
+        offset = priv->scroll_offset - MIN (priv->scroll_offset, -lines);
+    else
+        offset = MIN (priv->scroll_offset + lines, n_lines);
+    if (offset == priv->scroll_offset)
+        return;
+
+    priv->scroll_offset = offset;
+    if (offset > 0) {
+        fb_shell_draw_scrollback (shell);
+        return;
+    }
+
+    fb_vt_repaint (priv->vt, NULL, priv->output);
+    fb_shell_flush (shell);
+    priv->preedit_stale = TRUE;
+    priv->status_line_drawn = FALSE;
+    priv->lookup_page_changed = TRUE;
+    fb_shell_queue_render (shell,
+                           DirtyPreedit | DirtyLookupTable | DirtyStatus);
+}
+
+static int
+fb_shell_get_scroll_page (FbShell *shell)
+{
+    int rows;
+
+    fb_vt_get_size (shell->priv->vt, &rows, NULL);
+    return MAX (rows / 2, 1);
+}
+
+void
+fb_shell_scroll_page (FbShell  *shell,
+                      gboolean  back)
+{
+    int page;
+
+    g_return_if_fail (FB_IS_SHELL (shell));
+
+    page = fb_shell_get_scroll_page (shell);
+    fb_shell_scroll_view (shell, back ? page : -page);
+}
+
 void
 fb_shell_key_input (FbShell     *shell,
                     const gchar *buff,
@@ -1235,15 +2175,213 @@ fb_shell_key_input (FbShell     *shell,
 
     priv = shell->priv;
 
+    /* Any keys close the scrollback view. */
+    fb_shell_scroll_view (shell, -(int) priv->scroll_offset);
+
     retval = FB_CONTEXT_GET_INTERFACE (priv->context)->filter_keypress(
             FB_CONTEXT (priv->context), buff, length, &dispatched);
+    fb_trace (FB_TRACE_KEY_FILTERED, retval);
     if (!retval)
         return;
 
+    fb_trace (FB_TRACE_PTY_WRITE, retval);
     fb_io_write (FB_IO (shell), dispatched, retval);
     g_free (dispatched);
 }
 
+void
+fb_shell_key_event (FbShell          *shell,
+                    FbKeyboard       *keyboard,
+                    const FbKeyEvent *event)
+{
+    FbShellPrivate *priv;
+    const gchar *str;
+    gsize length = 0;
+    guint modes;
+
+    g_return_if_fail (FB_IS_SHELL (shell));
+    g_return_if_fail (event != NULL);
+
+    priv = shell->priv;
+
+    if (!(event->modifiers & IBUS_RELEASE_MASK) &&
+        (event->modifiers & IBUS_MOD1_MASK) &&
+        (event->keyval == IBUS_KEY_Page_Up ||
+         event->keyval == IBUS_KEY_Page_Down)) {
+        fb_shell_scroll_page (shell, event->keyval == IBUS_KEY_Page_Up);
+        return;
+    }
+    /* Any other keys except the modifiers close the scrollback view. */
+    if (!(event->modifiers & IBUS_RELEASE_MASK) &&
+        !(event->keyval >= IBUS_KEY_Shift_L &&
+          event->keyval <= IBUS_KEY_Hyper_R)) {
+        fb_shell_scroll_view (shell, -(int) priv->scroll_offset);
+    }
+
+    if (FB_CONTEXT_GET_INTERFACE (priv->context)->process_key_event (
+            FB_CONTEXT (priv->context),
+            event->keyval,
+            event->keycode,
+            event->modifiers)) {
+        fb_trace (FB_TRACE_KEY_FILTERED, 0);
+        return;
+    }
+    fb_trace (FB_TRACE_KEY_FILTERED, 1);
+
+    if (event->modifiers & IBUS_RELEASE_MASK)
+        return;
+
+    modes = fb_vt_get_modes (priv->vt);
+    fb_keyboard_set_modes (
+            keyboard,
+            ((modes & FB_VT_MODE_CURSOR_KEY_ESC_O) ?
+                    FB_KEYBOARD_MODE_CURSOR_KEY_ESC_O : 0) |
+            ((modes & FB_VT_MODE_APPLIC_KEYPAD) ?
+                    FB_KEYBOARD_MODE_APPLIC_KEYPAD : 0) |
+            ((modes & FB_VT_MODE_CR_WITH_LF) ?
+                    FB_KEYBOARD_MODE_CR_WITH_LF : 0));
+    str = fb_keyboard_event_to_string (keyboard, event, &length);
+    if (length > 0) {
+        fb_trace (FB_TRACE_PTY_WRITE, length);
+        fb_io_write (FB_IO (shell), str, length);
+    }
+}
+
+int
+fb_shell_get_pid (FbShell *shell)
+{
+    g_return_val_if_fail (FB_IS_SHELL (shell), -1);
+
+    return shell->priv->pid;
+}
+
+void
+fb_shell_set_parked (FbShell *shell, gboolean parked)
+{
+    FbShellPrivate *priv;
+
+    g_return_if_fail (FB_IS_SHELL (shell));
+
+    priv = shell->priv;
+    if (parked == priv->parked)
+        return;
+
+    priv->parked = parked;
+    if (!parked)
+        return;
+
+    /* The prompt printed in the pool is drawn from the screen model
+     * when the shell is switched.
+     */
+    fb_shell_manager_get_winsize (priv->manager, &priv->size);
+    if (priv->size.ws_row > 0 && priv->size.ws_col > 0)
+        fb_vt_resize (priv->vt, priv->size.ws_row, priv->size.ws_col);
+}
+
+gint64
+fb_shell_get_leave_time (FbShell *shell)
+{
+    g_return_val_if_fail (FB_IS_SHELL (shell), 0);
+
+    return shell->priv->leave_time;
+}
+
+gsize
+fb_shell_get_resident_size (FbShell *shell)
+{
+    FbShellPrivate *priv;
+    gsize size;
+    guint i;
+
+    g_return_val_if_fail (FB_IS_SHELL (shell), 0);
+
+    priv = shell->priv;
+
+    size = sizeof (FbShellPrivate);
+    size += priv->output->allocated_len;
+    size += priv->switcher_line->allocated_len;
+    size += sizeof (PreeditCell) * priv->preedit_cells->len;
+    size += sizeof (PreeditCell) * priv->preedit_next->len;
+    size += sizeof (LookupCell) * priv->lookup_cells->len;
+    size += fb_arena_get_size (priv->lookup_arena);
+    for (i = 0; i < priv->status_labels->len; i++) {
+        StatusLabel *label = g_ptr_array_index (priv->status_labels, i);
+        size += sizeof (StatusLabel);
+        size += label->key ? strlen (label->key) + 1 : 0;
+        size += label->label ? strlen (label->label) + 1 : 0;
+    }
+    for (i = 0; i < priv->switcher_length; i++) {
+        size += sizeof (IBusEngineDesc *) + sizeof (int);
+        size += strlen (priv->switcher_names[i]) + 1;
+    }
+    if (priv->keymap != NULL)
+        size += sizeof (guint32) * NR_KEYS;
+    if (priv->vt != NULL)
+        size += fb_vt_get_allocated_size (priv->vt);
+    if (priv->scrollback != NULL)
+        size += fb_scrollback_get_size (priv->scrollback);
+    return size;
+}
+
+gsize
+fb_shell_trim (FbShell *shell)
+{
+    FbShellPrivate *priv;
+    gsize resident;
+    gsize trimmed;
+
+    g_return_val_if_fail (FB_IS_SHELL (shell), 0);
+
+    priv = shell->priv;
+    if (priv->context == NULL || priv->leave_time == 0)
+        return 0;
+
+    resident = fb_shell_get_resident_size (shell);
+
+    if (priv->load_settings_id) {
+        g_source_remove (priv->load_settings_id);
+        priv->load_settings_id = 0;
+    }
+    /* The context is created and the settings are loaded again
+     * when the shell is entered.
+     */
+    g_signal_handlers_disconnect_by_data (priv->context, shell);
+    g_clear_object (&priv->context);
+    priv->settings_serial = 0;
+
+    if (priv->verify_keymap_id) {
+        g_source_remove (priv->verify_keymap_id);
+        priv->verify_keymap_id = 0;
+    }
+    g_clear_pointer (&priv->keymap, g_free);
+    priv->keymap_serial = 0;
+
+    /* The overlays are drawn again with the new context. */
+    fb_shell_reset_lookup_table (shell);
+    fb_arena_free (priv->lookup_arena);
+    priv->lookup_arena = fb_arena_new (4096);
+    g_array_unref (priv->preedit_cells);
+    priv->preedit_cells = g_array_new (FALSE, FALSE, sizeof (PreeditCell));
+    g_array_unref (priv->preedit_next);
+    priv->preedit_next = g_array_new (FALSE, FALSE, sizeof (PreeditCell));
+    priv->preedit_pending = FALSE;
+    priv->preedit_width = 0;
+    g_hash_table_remove_all (priv->status_label_table);
+    g_ptr_array_set_size (priv->status_labels, 0);
+    fb_shell_free_switcher_cache (shell);
+    g_string_free (priv->switcher_line, TRUE);
+    priv->switcher_line = g_string_new (NULL);
+    g_string_free (priv->output, TRUE);
+    priv->output = g_string_new (NULL);
+
+    priv->leave_time = 0;
+    trimmed = resident - fb_shell_get_resident_size (shell);
+    g_debug ("Trimmed %" G_GSIZE_FORMAT " bytes of the shell %d and "
+             "%" G_GSIZE_FORMAT " bytes are resident",
+             trimmed, priv->pid, resident - trimmed);
+    return trimmed;
+}
+
 gboolean
 fb_shell_child_process_exited (FbShell *shell, int pid)
 {
@@ -1253,6 +2391,10 @@ fb_shell_child_process_exited (FbShell *shell, int pid)
 
     priv = shell->priv;
     if (pid == priv->pid) {
+        /* The pid was reaped and fb_child_terminate() must not signal
+         * the reused pid in the destroy.
+         */
+        priv->pid = -1;
         ibus_object_destroy (IBUS_OBJECT (shell));
         return TRUE;
     }
@@ -25,6 +25,7 @@
 #include <ibus.h>
 
 #include "fbio.h"
+#include "fbkeyboard.h"
 
 /*
  * Type macros.
@@ -39,12 +40,6 @@
 
 
 G_BEGIN_DECLS
-typedef enum {
-    Single = 0,
-    DoubleLeft,
-    DoubleRight
-} CharType;
-
 typedef enum {
     Bell, BellFrequencySet, BellDurationSet,
     PaletteSet, PaletteClear,
@@ -53,8 +48,6 @@ typedef enum {
     VcSwitch, VesaPowerIntervalSet,
 } RequestType;
 
-typedef struct _CharAttr CharAttr;
-typedef struct _Cursor Cursor;
 typedef struct _FbShell FbShell;
 typedef struct _FbShellPrivate FbShellPrivate;
 typedef struct _FbShellClass FbShellClass;
@@ -62,25 +55,6 @@ typedef struct _FbShellClass FbShellClass;
 typedef struct _FbShellManager FbShellManager;
 typedef struct _FbTermObject FbTermObject;
 
-struct _CharAttr {
-    guint16  fcolor;
-    guint16  bcolor;
-    guint16  intensity;
-    guint16  italic;
-    guint16  underline;
-    guint16  blink;
-    guint16  reverse;
-    CharType type;
-};
-
-struct _Cursor {
-    gboolean showed;
-    guint16  x;
-    guint16  y;
-    guint16  code;
-    CharAttr attr;
-};
-
 /**
  * FbShell:
  *
@@ -117,6 +91,14 @@ void             fb_shell_switch_vt             (FbShell  *shell,
                                                  gboolean  enter,
                                                  FbShell  *peer);
 
+/**
+ * fb_shell_resize:
+ * @shell: A #FbShell
+ *
+ * Redraws the active @shell with the current size of the console.
+ */
+void             fb_shell_resize                (FbShell  *shell);
+
 /**
  * fb_shell_init_shell_process:
  *  @shell: A #FbShell
@@ -137,6 +119,77 @@ void             fb_shell_key_input             (FbShell     *shell,
                                                  const gchar *buff,
                                                  guint        length);
 
+/**
+ * fb_shell_scroll_page:
+ *  @shell: A #FbShell
+ *  @back: %TRUE to show the older lines.
+ *
+ * Scroll the view by half a screen for Alt-PageUp and Alt-PageDown.
+ */
+void             fb_shell_scroll_page           (FbShell     *shell,
+                                                 gboolean     back);
+
+/**
+ * fb_shell_key_event:
+ *  @shell: A #FbShell
+ *  @keyboard: A #FbKeyboard
+ *  @event: A decoded key event.
+ *
+ * Sends @event to the input context and input the key sequence
+ * on the shell if the event is not processed.
+ */
+void             fb_shell_key_event             (FbShell          *shell,
+                                                 FbKeyboard       *keyboard,
+                                                 const FbKeyEvent *event);
+
+/**
+ * fb_shell_get_pid:
+ *  @shell: A #FbShell
+ *
+ * Returns: The process id of the shell or -1 if the fork failed.
+ */
+int              fb_shell_get_pid               (FbShell *shell);
+
+/**
+ * fb_shell_set_parked:
+ *  @shell: A #FbShell
+ *  @parked: %TRUE if @shell waits in the pool.
+ *
+ * The parked shell keeps the output instead of drawing it on
+ * the console.  The kept output is drawn when @parked is %FALSE.
+ */
+void             fb_shell_set_parked            (FbShell *shell,
+                                                 gboolean parked);
+
+/**
+ * fb_shell_get_leave_time:
+ *  @shell: A #FbShell
+ *
+ * Returns: The monotonic time when @shell lost the focus or 0 if
+ *          @shell has the focus or is trimmed.
+ */
+gint64           fb_shell_get_leave_time        (FbShell *shell);
+
+/**
+ * fb_shell_get_resident_size:
+ *  @shell: A #FbShell
+ *
+ * Returns: The bytes of the screen, the scrollback and the caches
+ *          of @shell.  The input context is not counted.
+ */
+gsize            fb_shell_get_resident_size     (FbShell *shell);
+
+/**
+ * fb_shell_trim:
+ *  @shell: A #FbShell
+ *
+ * Releases the input context and the caches of @shell which does not
+ * have the focus.  They are created again when @shell is entered.
+ *
+ * Returns: The released bytes.
+ */
+gsize            fb_shell_trim                  (FbShell *shell);
+
 /**
  * fb_shell_child_process_exited:
  *  @shell: A #FbShell
@@ -27,15 +27,36 @@
 #include "fbshellman.h"
 #include "fbterm.h"
 
-#define NR_SHELLS 10
 #define SHELL_ANY ((FbShell *)-1)
+#define SHELL_POOL_ENV "IBUS_FBTERM_SHELL_POOL"
+#define SHELL_POOL_MAX 8
+#define IDLE_TRIM_ENV "IBUS_FBTERM_IDLE_TRIM"
+/* 30 minutes */
+#define IDLE_TRIM_DEFAULT 1800
 
 struct _FbShellManagerPrivate {
     gboolean        vc_current;
     int             shell_count;
     int             cur_shell;
     FbShell        *active_shell;
-    FbShell        *shell_list[NR_SHELLS];
+    /* The slots of the shells.  The exited shells leave NULL so that
+     * the other shells keep the numbers.
+     */
+    GPtrArray      *shell_list;
+    /* pid -> FbShell */
+    GHashTable     *pid_table;
+    /* FbShell -> the slot index + 1 */
+    GHashTable     *index_table;
+    /* The parked shells which are spawned in advance */
+    GQueue         *pool;
+    guint           pool_size;
+    guint           fill_pool_id;
+    /* The seconds without the focus until a shell is trimmed */
+    guint           trim_timeout;
+    guint           trim_id;
+    /* The console size which is shared by all the shells */
+    struct winsize  size;
+    gboolean        size_valid;
     FbTermObject   *fbterm;
 };
 
@@ -44,6 +65,8 @@ G_DEFINE_TYPE_WITH_PRIVATE (FbShellManager,
                             IBUS_TYPE_OBJECT);
 
 static void         fb_shell_manager_destroy (IBusObject *object);
+static gboolean     fb_shell_manager_trim_idle_shells
+                                             (gpointer        user_data);
 static int          fb_shell_manager_get_index (FbShellManager *shell_manager,
                                                 FbShell        *shell,
                                                 gboolean        forward,
@@ -54,13 +77,32 @@ fb_shell_manager_init (FbShellManager *shell_manager)
 {
     FbShellManagerPrivate *priv =
             fb_shell_manager_get_instance_private (shell_manager);
+    const gchar *env;
+
     shell_manager->priv = priv;
 
     priv->vc_current = FALSE;
     priv->shell_count = 0;
     priv->cur_shell = 0;
     priv->active_shell = NULL;
-    memset (priv->shell_list, 0, sizeof (priv->shell_list));
+    priv->shell_list = g_ptr_array_new ();
+    priv->pid_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->index_table = g_hash_table_new (g_direct_hash, g_direct_equal);
+    priv->pool = g_queue_new ();
+    if ((env = g_getenv (SHELL_POOL_ENV)) != NULL)
+        priv->pool_size = MIN (g_ascii_strtoull (env, NULL, 10),
+                               SHELL_POOL_MAX);
+    priv->trim_timeout = IDLE_TRIM_DEFAULT;
+    if ((env = g_getenv (IDLE_TRIM_ENV)) != NULL)
+        priv->trim_timeout = MIN (g_ascii_strtoull (env, NULL, 10),
+                                  G_MAXUINT / 4);
+    /* 0 disables the trimming. */
+    if (priv->trim_timeout > 0) {
+        priv->trim_id = g_timeout_add_seconds (
+                CLAMP (priv->trim_timeout / 4, 1, 60),
+                fb_shell_manager_trim_idle_shells,
+                shell_manager);
+    }
 }
 
 static void
@@ -72,6 +114,43 @@ fb_shell_manager_class_init (FbShellManagerClass *class)
 static void
 fb_shell_manager_destroy (IBusObject *object)
 {
+    FbShellManagerPrivate *priv = FB_SHELL_MANAGER (object)->priv;
+    FbShell *shell;
+
+    if (priv->fill_pool_id) {
+        g_source_remove (priv->fill_pool_id);
+        priv->fill_pool_id = 0;
+    }
+    if (priv->trim_id) {
+        g_source_remove (priv->trim_id);
+        priv->trim_id = 0;
+    }
+    if (priv->pool) {
+        while ((shell = g_queue_pop_head (priv->pool)) != NULL) {
+            g_hash_table_remove (priv->pid_table,
+                                 GINT_TO_POINTER (fb_shell_get_pid (shell)));
+            ibus_object_destroy (IBUS_OBJECT (shell));
+            g_object_unref (shell);
+        }
+        g_queue_free (priv->pool);
+        priv->pool = NULL;
+    }
+    if (priv->shell_list) {
+        GPtrArray *shell_list = priv->shell_list;
+        guint i;
+
+        /* fb_shell_manager_shell_exited() ignores the shells now. */
+        priv->shell_list = NULL;
+        for (i = 0; i < shell_list->len; i++) {
+            if ((shell = g_ptr_array_index (shell_list, i)) == NULL)
+                continue;
+            ibus_object_destroy (IBUS_OBJECT (shell));
+            g_object_unref (shell);
+        }
+        g_ptr_array_free (shell_list, TRUE);
+    }
+    g_clear_pointer (&priv->pid_table, g_hash_table_unref);
+    g_clear_pointer (&priv->index_table, g_hash_table_unref);
 }
 
 static int
@@ -81,29 +160,45 @@ fb_shell_manager_get_index (FbShellManager *shell_manager,
                             gboolean        stepfirst)
 {
     FbShellManagerPrivate *priv;
-    int index, temp, i;
+    int length;
+    int index = 0;
+    int temp, i;
 
     g_return_val_if_fail (FB_IS_SHELL_MANAGER (shell_manager), 0);
 
+    priv = shell_manager->priv;
+
+    if (shell != NULL && shell != SHELL_ANY) {
+        return GPOINTER_TO_INT (g_hash_table_lookup (priv->index_table,
+                                                     shell)) - 1;
+    }
+
+    length = priv->shell_list->len;
+    if (length == 0)
+        return 0;
+
 #define STEP() do { \
     if (forward) temp++; \
     else temp--; \
 } while (0)
 
-    priv = shell_manager->priv;
-    temp = priv->cur_shell + NR_SHELLS;
+    temp = priv->cur_shell + length;
 
     if (stepfirst)
         STEP ();
 
-    for (i = NR_SHELLS; i--;) {
-        index = temp % NR_SHELLS;
-        if ((shell == SHELL_ANY && priv->shell_list[index]) ||
-            shell == priv->shell_list[index])
-            break;
+    for (i = length; i--;) {
+        index = temp % length;
+        if ((shell == SHELL_ANY) ==
+            (g_ptr_array_index (priv->shell_list, index) != NULL)) {
+            return index;
+        }
         STEP ();
     }
 
+    /* No empty slots */
+    if (shell == NULL)
+        return length;
     return index;
 }
 
@@ -115,38 +210,124 @@ fb_shell_manager_new (FbTermObject *fbterm)
     return shell_manager;
 } 
 
+/* Release the input contexts and the caches of the shells which
+ * have not had the focus for trim_timeout seconds.
+ */
+static gboolean
+fb_shell_manager_trim_idle_shells (gpointer user_data)
+{
+    FbShellManager *shell_manager = FB_SHELL_MANAGER (user_data);
+    FbShellManagerPrivate *priv = shell_manager->priv;
+    gint64 now = g_get_monotonic_time ();
+    guint i;
+
+    for (i = 0; i < priv->shell_list->len; i++) {
+        FbShell *shell = g_ptr_array_index (priv->shell_list, i);
+        gint64 leave_time;
+
+        if (shell == NULL || shell == priv->active_shell)
+            continue;
+        leave_time = fb_shell_get_leave_time (shell);
+        if (leave_time == 0 ||
+            now - leave_time < (gint64) priv->trim_timeout * G_USEC_PER_SEC)
+            continue;
+        fb_shell_trim (shell);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+/* Spawn one parked shell in each idle time so that the rc files of
+ * the shells do not run at once.
+ */
+static gboolean
+fb_shell_manager_fill_pool (gpointer user_data)
+{
+    FbShellManager *shell_manager = FB_SHELL_MANAGER (user_data);
+    FbShellManagerPrivate *priv = shell_manager->priv;
+    FbShell *shell;
+
+    if (priv->pool->length >= priv->pool_size) {
+        priv->fill_pool_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    shell = fb_shell_new (shell_manager, priv->fbterm);
+    fb_shell_set_parked (shell, TRUE);
+    g_queue_push_tail (priv->pool, shell);
+    g_hash_table_insert (priv->pid_table,
+                         GINT_TO_POINTER (fb_shell_get_pid (shell)),
+                         shell);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+fb_shell_manager_queue_fill_pool (FbShellManager *shell_manager)
+{
+    FbShellManagerPrivate *priv = shell_manager->priv;
+
+    if (priv->fill_pool_id || priv->pool->length >= priv->pool_size)
+        return;
+    priv->fill_pool_id = g_idle_add_full (G_PRIORITY_LOW,
+                                          fb_shell_manager_fill_pool,
+                                          shell_manager,
+                                          NULL);
+}
+
 void
 fb_shell_manager_create_shell (FbShellManager *shell_manager)
 {
     FbShellManagerPrivate *priv;
+    FbShell *shell;
     int index;
 
     g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
 
     priv = shell_manager->priv;
 
-    if (priv->shell_count == NR_SHELLS)
-        return;
     priv->shell_count++;
-    index = fb_shell_manager_get_index (shell_manager, 0, TRUE, FALSE);
-    priv->shell_list[index] = fb_shell_new (shell_manager,
-                                            priv->fbterm);
+    index = fb_shell_manager_get_index (shell_manager, NULL, TRUE, FALSE);
+    if (index >= priv->shell_list->len)
+        g_ptr_array_set_size (priv->shell_list, index + 1);
+    /* The pooled shell is already in pid_table. */
+    if ((shell = g_queue_pop_head (priv->pool)) == NULL) {
+        shell = fb_shell_new (shell_manager, priv->fbterm);
+        g_hash_table_insert (priv->pid_table,
+                             GINT_TO_POINTER (fb_shell_get_pid (shell)),
+                             shell);
+    }
+    g_ptr_array_index (priv->shell_list, index) = shell;
+    g_hash_table_insert (priv->index_table, shell, GINT_TO_POINTER (index + 1));
     fb_shell_manager_switch_shell (shell_manager, index);
+    fb_shell_set_parked (shell, FALSE);
+    fb_shell_manager_queue_fill_pool (shell_manager);
 }
 
 void
 fb_shell_manager_delete_shell (FbShellManager *shell_manager)
 {
     FbShellManagerPrivate *priv;
+    FbShell *shell;
+    int pid;
     int i;
 
     g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
 
     priv = shell_manager->priv;
     i = priv->cur_shell;
-    if (priv->shell_list[i]) {
-        g_object_unref (priv->shell_list[i]);
-        priv->shell_list[i] = NULL;
+    if (i >= priv->shell_list->len)
+        return;
+    if ((shell = g_ptr_array_index (priv->shell_list, i)) == NULL)
+        return;
+
+    pid = fb_shell_get_pid (shell);
+    g_object_unref (shell);
+    /* The slot is cleared by fb_shell_manager_shell_exited() if the shell
+     * is destroyed.
+     */
+    if (g_ptr_array_index (priv->shell_list, i) == shell) {
+        g_ptr_array_index (priv->shell_list, i) = NULL;
+        g_hash_table_remove (priv->index_table, shell);
+        g_hash_table_remove (priv->pid_table, GINT_TO_POINTER (pid));
     }
 }
 
@@ -172,16 +353,18 @@ fb_shell_manager_switch_shell (FbShellManager *shell_manager,
 {
     FbShellManagerPrivate *priv;
 
-    if (num >= NR_SHELLS)
-        return;
-
     g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
 
     priv = shell_manager->priv;
+
+    if (num < 0 || num >= priv->shell_list->len)
+        return;
+
     priv->cur_shell = num;
     if (priv->vc_current) {
         fb_shell_manager_set_active (shell_manager,
-                                     priv->shell_list[num]);
+                                     g_ptr_array_index (priv->shell_list,
+                                                        num));
     }
 }
 
@@ -197,7 +380,9 @@ fb_shell_manager_switch_vc (FbShellManager *shell_manager,
     priv->vc_current = enter;
     fb_shell_manager_set_active (
             shell_manager,
-            enter ? priv->shell_list[priv->cur_shell] : 0);
+            enter && priv->cur_shell < priv->shell_list->len ?
+                    g_ptr_array_index (priv->shell_list, priv->cur_shell) :
+                    NULL);
 }
 
 void
@@ -212,8 +397,24 @@ fb_shell_manager_shell_exited (FbShellManager *shell_manager,
 
     g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
     priv = shell_manager->priv;
+    /* The manager is already destroyed. */
+    if (priv->shell_list == NULL)
+        return;
+    /* The pooled shell is not refilled here in case the rc files
+     * fail every time.
+     */
+    if (g_queue_remove (priv->pool, shell)) {
+        g_hash_table_remove (priv->pid_table,
+                             GINT_TO_POINTER (fb_shell_get_pid (shell)));
+        return;
+    }
     index = fb_shell_manager_get_index (shell_manager, shell, TRUE, FALSE);
-    priv->shell_list[index] = NULL;
+    if (index < 0)
+        return;
+    g_ptr_array_index (priv->shell_list, index) = NULL;
+    g_hash_table_remove (priv->index_table, shell);
+    g_hash_table_remove (priv->pid_table,
+                         GINT_TO_POINTER (fb_shell_get_pid (shell)));
 
     if (index == priv->cur_shell)
         fb_shell_manager_prev_shell (shell_manager);
@@ -253,17 +454,23 @@ fb_shell_manager_child_process_exited (FbShellManager *shell_manager,
                                        int             pid)
 {
     FbShellManagerPrivate *priv;
-    int i;
+    FbShell *shell;
+    gboolean pooled;
 
     g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
 
     priv = shell_manager->priv;
 
-    for (i = 0; i <= NR_SHELLS; i++) {
-        if (priv->shell_list[i] &&
-        fb_shell_child_process_exited (priv->shell_list[i], pid))
-        break;
-    }
+    shell = g_hash_table_lookup (priv->pid_table, GINT_TO_POINTER (pid));
+    if (shell == NULL)
+        return;
+    /* The shell forgets @pid before fb_shell_manager_shell_exited(). */
+    g_hash_table_remove (priv->pid_table, GINT_TO_POINTER (pid));
+    pooled = g_queue_find (priv->pool, shell) != NULL;
+    fb_shell_child_process_exited (shell, pid);
+    /* fb_shell_manager_shell_exited() removed it from the pool. */
+    if (pooled)
+        g_object_unref (shell);
 }
 
 FbShell *
@@ -273,3 +480,37 @@ fb_shell_manager_active_shell (FbShellManager *shell_manager)
 
     return shell_manager->priv->active_shell;
 }
+
+void
+fb_shell_manager_get_winsize (FbShellManager *shell_manager,
+                              struct winsize *size)
+{
+    FbShellManagerPrivate *priv;
+
+    g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
+    g_return_if_fail (size != NULL);
+
+    priv = shell_manager->priv;
+
+    if (!priv->size_valid) {
+        FbConsole *console = fbterm_object_get_console (priv->fbterm);
+
+        memset (&priv->size, 0, sizeof (priv->size));
+        priv->size_valid = fb_console_get_winsize (console, &priv->size);
+    }
+    *size = priv->size;
+}
+
+void
+fb_shell_manager_resize (FbShellManager *shell_manager)
+{
+    FbShellManagerPrivate *priv;
+
+    g_return_if_fail (FB_IS_SHELL_MANAGER (shell_manager));
+
+    priv = shell_manager->priv;
+
+    priv->size_valid = FALSE;
+    if (priv->active_shell != NULL)
+        fb_shell_resize (priv->active_shell);
+}
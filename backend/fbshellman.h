@@ -23,6 +23,7 @@
 
 #include <glib-object.h>
 #include <ibus.h>
+#include <sys/ioctl.h>
 
 #include "fbshell.h"
 #include "fbterm.h"
@@ -97,5 +98,25 @@ void             fb_shell_manager_child_process_exited
                                                  int             pid);
 FbShell *        fb_shell_manager_active_shell  (FbShellManager *shell_manager);
 
+/**
+ * fb_shell_manager_get_winsize:
+ * @shell_manager: A #FbShellManager
+ * @size: (out): The size of the console
+ *
+ * Gets the size of the console.  The size is queried once and kept
+ * until fb_shell_manager_resize() is called.
+ */
+void             fb_shell_manager_get_winsize   (FbShellManager *shell_manager,
+                                                 struct winsize *size);
+
+/**
+ * fb_shell_manager_resize:
+ * @shell_manager: A #FbShellManager
+ *
+ * Queries the size of the console again on SIGWINCH and redraws
+ * the active shell with the new size.
+ */
+void             fb_shell_manager_resize        (FbShellManager *shell_manager);
+
 G_END_DECLS
 #endif
@@ -21,20 +21,21 @@
 
 #include <glib.h>
 
-#include <linux/kdev_t.h> /* MINOR() */
-#include <linux/vt.h>
 #include <locale.h>
 #include <stdlib.h>
-#include <sys/ioctl.h>
 #include <sys/signalfd.h>
-#include <sys/stat.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include "fbchild.h"
+#include "fbimclient.h"
 #include "fbshellman.h"
 #include "fbterm.h"
+#include "fbtrace.h"
 #include "fbtty.h"
 
+extern FbContext* ibus_fb_context_new (void);
+
 enum {
     PROP_0 = 0,
     PROP_FBTERM
@@ -50,6 +51,7 @@ struct _FbTermObjectPrivate {
     FbSignalIo         *io;
     gboolean            is_running;
     FbShellManager     *manager;
+    FbConsole          *console;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (FbSignalIo,
@@ -200,7 +202,6 @@ fbterm_object_constructor (GType                  type,
     GObject *object;
     FbTermObject *fbterm;
     FbTermObjectPrivate *priv;
-    struct vt_mode vtm;
     sigset_t sigmask;
 
     object = G_OBJECT_CLASS (fbterm_object_parent_class)->constructor (
@@ -211,15 +212,13 @@ fbterm_object_constructor (GType                  type,
     fbterm = FBTERM_OBJECT (object);
     priv = fbterm->priv;
 
+    priv->console = g_object_ref_sink (fb_console_new ());
+    if (fb_console_is_headless (priv->console))
+        g_debug ("Run without a virtual console");
     priv->manager = fb_shell_manager_new (fbterm);
-    priv->tty = fb_tty_new (priv->manager);
+    priv->tty = fb_tty_new (priv->manager, priv->console);
 
-    vtm.mode = VT_PROCESS;
-    vtm.waitv = 0;
-    vtm.relsig = SIGUSR1;
-    vtm.acqsig = SIGUSR2;
-    vtm.frsig = 0;
-    ioctl (STDIN_FILENO, VT_SETMODE, &vtm);
+    fb_console_setup (priv->console);
 
     sigemptyset (&sigmask);
 
@@ -228,6 +227,7 @@ fbterm_object_constructor (GType                  type,
     sigaddset (&sigmask, SIGUSR2);
     sigaddset (&sigmask, SIGTERM);
     sigaddset (&sigmask, SIGHUP);
+    sigaddset (&sigmask, SIGWINCH);
 
     sigprocmask (SIG_BLOCK, &sigmask, &priv->old_sigmask);
     priv->io = fb_signal_io_new (sigmask, fbterm);
@@ -248,20 +248,22 @@ fbterm_object_destroy (FbTermObject *fbterm)
 
     ibus_object_destroy (IBUS_OBJECT (priv->io));
     priv->io = NULL;
+    /* The shells queue their children for fb_child_kill_pending(). */
+    ibus_object_destroy (IBUS_OBJECT (priv->manager));
+    priv->manager = NULL;
     ibus_object_destroy (IBUS_OBJECT (priv->tty));
     priv->tty = NULL;
+    if (priv->console) {
+        ibus_object_destroy (IBUS_OBJECT (priv->console));
+        g_object_unref (priv->console);
+        priv->console = NULL;
+    }
 }
 
 static gboolean
 fbterm_object_is_active_term (FbTermObject *fbterm)
 {
-    struct vt_stat vtstat;
-    struct stat ttystat;
-
-    ioctl (STDIN_FILENO, VT_GETSTATE, &vtstat);
-    fstat (STDIN_FILENO, &ttystat);
-    return vtstat.v_active == MINOR (ttystat.st_rdev);
-
+    return fb_console_is_active (fbterm->priv->console);
 }
 
 FbSignalIo *
@@ -301,16 +303,22 @@ fbterm_object_process_signal (FbTermObject *fbterm, int signo)
     case SIGUSR1:
         fb_shell_manager_switch_vc (priv->manager, FALSE);
         fb_tty_switch_vc (priv->tty, FALSE);
-        ioctl (STDIN_FILENO, VT_RELDISP, 1);
+        fb_console_release (priv->console);
         break;
     case SIGUSR2:
         fb_tty_switch_vc (priv->tty, TRUE);
         fb_shell_manager_switch_vc (priv->manager, TRUE);
         break;
+    case SIGWINCH:
+        fb_shell_manager_resize (priv->manager);
+        break;
     case SIGCHLD:
+        /* The signals of the children which exit at the same time
+         * are merged into one.
+         */
         if (priv->is_running) {
-            int pid = waitpid (WAIT_ANY, 0, WNOHANG);
-            if (pid > 0)
+            int pid;
+            while ((pid = waitpid (WAIT_ANY, 0, WNOHANG)) > 0)
                 fb_shell_manager_child_process_exited (priv->manager, pid);
         }
         break;
@@ -355,15 +363,73 @@ fbterm_object_init_child_process (FbTermObject *fbterm)
     signal (SIGPIPE, SIG_DFL);
 }
 
+void
+fbterm_object_init_spawn_attr (FbTermObject      *fbterm,
+                               posix_spawnattr_t *attr)
+{
+    FbTermObjectPrivate *priv;
+    sigset_t default_signals;
+
+    g_return_if_fail (FBTERM_IS_OBJECT (fbterm));
+
+    priv = fbterm->priv;
+    sigemptyset (&default_signals);
+    sigaddset (&default_signals, SIGPIPE);
+    posix_spawnattr_setsigmask (attr, &priv->old_sigmask);
+    posix_spawnattr_setsigdefault (attr, &default_signals);
+    posix_spawnattr_setflags (attr,
+                              POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+}
+
+FbConsole *
+fbterm_object_get_console (FbTermObject *fbterm)
+{
+    g_return_val_if_fail (FBTERM_IS_OBJECT (fbterm), NULL);
+
+    return fbterm->priv->console;
+}
+
+void
+fbterm_object_keymap_changed (FbTermObject *fbterm)
+{
+    g_return_if_fail (FBTERM_IS_OBJECT (fbterm));
+
+    fb_tty_reload_keymap (fbterm->priv->tty);
+}
+
+/* fbterm launches the input method with the socket and the terminal
+ * draws the windows of the input method instead of the shells.
+ */
+static int
+fbterm_run_im_client (const gchar *im_socket)
+{
+    FbImClient *client;
+
+    client = fb_im_client_new (atoi (im_socket), ibus_fb_context_new ());
+    if (client == NULL)
+        return 1;
+    g_object_ref_sink (client);
+    ibus_main ();
+    ibus_object_destroy (IBUS_OBJECT (client));
+    g_object_unref (client);
+    return 0;
+}
+
 int
 main (int argc, char *argv[])
 {
     FbTermObject *fbterm;
+    const gchar *im_socket;
 
     setlocale (LC_ALL, "");
     setuid (getuid ());
+    if ((im_socket = g_getenv (FB_IM_SOCKET_ENV)) != NULL)
+        return fbterm_run_im_client (im_socket);
+    fb_trace_init ();
     fbterm  = fbterm_object_new ();
     fbterm_object_run (fbterm);
     ibus_object_destroy (IBUS_OBJECT (fbterm));
+    /* The destroyed shells and the pool queue their children. */
+    fb_child_kill_pending ();
     return 0;
 }
@@ -22,7 +22,9 @@
 #define __FBTERM_OBJECT_H_
 
 #include <glib-object.h>
+#include <spawn.h>
 
+#include "fbconsole.h"
 #include "fbio.h"
 
 /*
@@ -111,6 +113,33 @@ void             fbterm_object_run                (FbTermObject    *fbterm);
 void             fbterm_object_exit               (FbTermObject    *fbterm);
 void             fbterm_object_init_child_process (FbTermObject    *fbterm);
 
+/**
+ * fbterm_object_init_spawn_attr:
+ * @fbterm: A #FbTermObject
+ * @attr: An initialized posix_spawnattr_t
+ *
+ * Sets @attr to restore the signals of the child process as
+ * fbterm_object_init_child_process() does.
+ */
+void             fbterm_object_init_spawn_attr    (FbTermObject      *fbterm,
+                                                   posix_spawnattr_t *attr);
+
+/**
+ * fbterm_object_get_console:
+ * @fbterm: A #FbTermObject
+ *
+ * Returns: (transfer none): The #FbConsole of the standard input.
+ */
+FbConsole       *fbterm_object_get_console        (FbTermObject    *fbterm);
+
+/**
+ * fbterm_object_keymap_changed:
+ * @fbterm: A #FbTermObject
+ *
+ * Notifies the kernel keymap is changed by loadkeys.
+ */
+void             fbterm_object_keymap_changed     (FbTermObject    *fbterm);
+
 
 GType            fb_signal_io_get_type            (void);
 
@@ -0,0 +1,66 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "fbtrace.h"
+
+#define TRACE_FD_ENV "IBUS_FBTERM_TRACE_FD"
+
+int fb_trace_fd = -1;
+
+void
+fb_trace_init (void)
+{
+    const gchar *env = g_getenv (TRACE_FD_ENV);
+    int fd;
+
+    if (env == NULL || *env == '\0')
+        return;
+    fd = atoi (env);
+    if (fd < 0 || fcntl (fd, F_GETFD) == -1)
+        return;
+    /* The shells do not inherit the fd and the backend never waits
+     * for the reader.
+     */
+    fcntl (fd, F_SETFD, FD_CLOEXEC);
+    fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+    fb_trace_fd = fd;
+}
+
+void
+fb_trace_event (FbTraceStage stage,
+                gsize        length)
+{
+    FbTraceEvent event;
+
+    event.time = g_get_monotonic_time ();
+    event.stage = stage;
+    event.length = MIN (length, G_MAXUINT32);
+    /* A record is smaller than PIPE_BUF and written atomically. */
+    if (write (fb_trace_fd, &event, sizeof (event)) != sizeof (event))
+        g_debug ("Dropped the trace event of the stage %u", stage);
+}
@@ -0,0 +1,77 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_TRACE_H_
+#define __FB_TRACE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The points of the input and the output paths */
+typedef enum {
+    FB_TRACE_TTY_READ = 0,
+    FB_TRACE_KEY_FILTERED,
+    FB_TRACE_PREEDIT,
+    FB_TRACE_LOOKUP,
+    FB_TRACE_COMMIT,
+    FB_TRACE_PTY_WRITE,
+    FB_TRACE_PTY_READ,
+    FB_TRACE_CONSOLE_WRITE,
+    FB_TRACE_N_STAGES
+} FbTraceStage;
+
+/* The record which is written to IBUS_FBTERM_TRACE_FD */
+typedef struct {
+    /* g_get_monotonic_time() */
+    gint64  time;
+    guint32 stage;
+    guint32 length;
+} FbTraceEvent;
+
+extern int fb_trace_fd;
+
+/**
+ * fb_trace_init:
+ *
+ * Reads the fd from IBUS_FBTERM_TRACE_FD.  The events are not
+ * written unless the variable is set.
+ */
+void             fb_trace_init                     (void);
+
+/**
+ * fb_trace_event:
+ * @stage: A #FbTraceStage
+ * @length: The bytes which are handled in @stage.
+ *
+ * Writes a #FbTraceEvent.  The event is dropped if the reader
+ * does not read the events in time.
+ */
+void             fb_trace_event                    (FbTraceStage stage,
+                                                    gsize        length);
+
+#define fb_trace(stage, length)                                         \
+    G_STMT_START {                                                      \
+        if (G_UNLIKELY (fb_trace_fd != -1))                             \
+            fb_trace_event ((stage), (length));                         \
+    } G_STMT_END
+
+G_END_DECLS
+#endif
@@ -20,23 +20,34 @@
 #include <config.h>
 
 #include <glib.h>
+#include <ibus.h>
 
+#include <errno.h>
 #include <linux/kd.h>
-#include <sys/ioctl.h>
+#include <linux/keyboard.h>
+#include <string.h>
 #include <termios.h>
 
+#include "fbkeyboard.h"
+#include "fbtrace.h"
 #include "fbtty.h"
 
 enum {
     PROP_0 = 0,
-    PROP_MANAGER
+    PROP_MANAGER,
+    PROP_CONSOLE
 };
 
 struct _FbTtyPrivate {
     FbShellManager *manager;
+    FbConsole      *console;
     gboolean        inited;
     long int        kb_mode;
     struct termios  old_tm;
+    FbKeyboard     *keyboard;
+    /* fb_tty_real_ready_read() is using the keyboard. */
+    gboolean        reading;
+    gboolean        drop_keyboard;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE (FbTty,
@@ -90,6 +101,18 @@ fb_tty_class_init (FbTtyClass *class)
                                  "The object of FbShellManager",
                                  FB_TYPE_SHELL_MANAGER,
                                  G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
+    /**
+     * FbTty:console:
+     *
+     * The console of the standard input
+     */
+    g_object_class_install_property (gobject_class,
+            PROP_CONSOLE,
+            g_param_spec_object ("console",
+                                 "console",
+                                 "The object of FbConsole",
+                                 FB_TYPE_CONSOLE,
+                                 G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 }
 
 static GObject *
@@ -107,6 +130,9 @@ fb_tty_constructor (GType                  type,
     /* Call after fb_io_set_property() */
     fb_io_set_fd (FB_IO (object), dup (STDIN_FILENO));
 
+    if (g_strcmp0 (g_getenv ("IBUS_FBTERM_KEYBOARD_MODE"), "raw") == 0)
+        FB_TTY (object)->priv->keyboard = fb_keyboard_new (STDIN_FILENO);
+
     return object;
 }
 
@@ -122,6 +148,9 @@ fb_tty_get_property (FbTty      *tty,
     case PROP_MANAGER:
         g_value_set_object (value, priv->manager);
         break;
+    case PROP_CONSOLE:
+        g_value_set_object (value, priv->console);
+        break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (tty, prop_id, pspec);
     }
@@ -142,6 +171,12 @@ fb_tty_set_property (FbTty        *tty,
         priv->manager = g_object_ref_sink (manager);
         break;
     }
+    case PROP_CONSOLE: {
+        FbConsole *console = g_value_get_object (value);
+        g_return_if_fail (FB_IS_CONSOLE (console));
+        priv->console = g_object_ref_sink (console);
+        break;
+    }
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (tty, prop_id, pspec);
     }
@@ -156,14 +191,44 @@ fb_tty_destroy (FbTty *tty)
 
     priv = tty->priv;
 
+    if (priv->keyboard) {
+        fb_keyboard_free (priv->keyboard);
+        priv->keyboard = NULL;
+    }
+
     if (!priv->inited)
         return;
 
-    ioctl (STDIN_FILENO, KDSKBMODE, priv->kb_mode);
+    fb_console_set_keyboard_mode (priv->console, priv->kb_mode);
     tcsetattr (STDIN_FILENO, TCSAFLUSH, &priv->old_tm);
 
     g_object_unref (priv->manager);
     priv->manager = NULL;
+    g_object_unref (priv->console);
+    priv->console = NULL;
+}
+
+/* The kernel sends the same sequences for PageUp and Alt-PageUp in
+ * K_UNICODE mode and the Alt key is read from the shift state.
+ */
+static gboolean
+fb_tty_scroll_key (FbTty       *tty,
+                   FbShell     *shell,
+                   const gchar *buff,
+                   guint        length)
+{
+    int state = 0;
+
+    if (length != 4 || memcmp (buff, "\033[", 2) != 0 || buff[3] != '~' ||
+        (buff[2] != '5' && buff[2] != '6')) {
+        return FALSE;
+    }
+    if (!fb_console_get_shift_state (tty->priv->console, &state) ||
+        !(state & (1 << KG_ALT))) {
+        return FALSE;
+    }
+    fb_shell_scroll_page (shell, buff[2] == '5');
+    return TRUE;
 }
 
 static void
@@ -173,23 +238,76 @@ fb_tty_real_ready_read (FbIo       *io,
 {
     FbTtyPrivate *priv;
     FbShell *shell;
+    guint i;
 
     g_return_if_fail (FB_IS_TTY (io));
 
     priv = FB_TTY (io)->priv;
     shell = fb_shell_manager_active_shell (priv->manager);
+    fb_trace (FB_TRACE_TTY_READ, length);
 
-    if (!shell)
+    if (!priv->keyboard) {
+        if (shell && !fb_tty_scroll_key (FB_TTY (io), shell, buff, length))
+            fb_shell_key_input (shell, buff, length);
         return;
+    }
+
+    priv->reading = TRUE;
+    for (i = 0; i < length && !priv->drop_keyboard; i++) {
+        FbKeyEvent event;
+
+        if (!fb_keyboard_feed (priv->keyboard, buff[i], &event))
+            continue;
+
+        /* The kernel does not switch the consoles in K_MEDIUMRAW. */
+        if (!(event.modifiers & IBUS_RELEASE_MASK) &&
+            (event.modifiers & IBUS_MOD1_MASK) &&
+            event.keyval >= IBUS_KEY_F1 && event.keyval <= IBUS_KEY_F12) {
+            fb_console_activate (priv->console,
+                                 event.keyval - IBUS_KEY_F1 + 1);
+            continue;
+        }
 
-    fb_shell_key_input (shell, buff, length);
+        if (shell)
+            fb_shell_key_event (shell, priv->keyboard, &event);
+    }
+    priv->reading = FALSE;
+    /* The keymap can be reloaded by the key events. */
+    if (priv->drop_keyboard) {
+        priv->drop_keyboard = FALSE;
+        fb_keyboard_free (priv->keyboard);
+        priv->keyboard = NULL;
+    }
+}
+
+static void
+fb_tty_load_keymap (FbTty *tty)
+{
+    FbTtyPrivate *priv = tty->priv;
+
+    /* KDGKBENT returns K_HOLE for the Unicode keysyms unless the
+     * console is in K_UNICODE.
+     */
+    fb_console_set_keyboard_mode (priv->console, K_UNICODE);
+    fb_keyboard_load_keymap (priv->keyboard);
+    if (!fb_console_set_keyboard_mode (priv->console, K_MEDIUMRAW)) {
+        g_warning ("Failed to set K_MEDIUMRAW: %s", g_strerror (errno));
+        if (priv->reading) {
+            priv->drop_keyboard = TRUE;
+            return;
+        }
+        fb_keyboard_free (priv->keyboard);
+        priv->keyboard = NULL;
+    }
 }
 
 FbTty *
-fb_tty_new (FbShellManager *manager)
+fb_tty_new (FbShellManager *manager,
+            FbConsole      *console)
 {
     return g_object_new (FB_TYPE_TTY,
                          "shell-manager", manager,
+                         "console", console,
                          NULL);
 }
 
@@ -203,13 +321,26 @@ fb_tty_switch_vc (FbTty *tty,
     g_return_if_fail (FB_IS_TTY (tty));
     priv = tty->priv;
 
-    if (!enter || priv->inited)
+    if (!enter)
+        return;
+
+    /* The key release events are lost while the other VT is active. */
+    if (priv->inited) {
+        if (priv->keyboard)
+            fb_keyboard_reset (priv->keyboard);
         return;
+    }
 
     priv->inited = TRUE;
     tcgetattr (STDIN_FILENO, &priv->old_tm);
-    ioctl (STDIN_FILENO, KDGKBMODE, &priv->kb_mode);
-    ioctl (STDIN_FILENO, KDSKBMODE, K_UNICODE);
+    if (!fb_console_get_keyboard_mode (priv->console, &priv->kb_mode))
+        priv->kb_mode = K_UNICODE;
+    fb_console_set_keyboard_mode (priv->console, K_UNICODE);
+    if (priv->keyboard) {
+        fb_tty_load_keymap (tty);
+        if (priv->keyboard)
+            fb_keyboard_reset (priv->keyboard);
+    }
 
     tm = priv->old_tm;
     cfmakeraw (&tm);
@@ -217,3 +348,14 @@ fb_tty_switch_vc (FbTty *tty,
     tm.c_cc[VTIME] = 0;
     tcsetattr (STDIN_FILENO, TCSAFLUSH, &tm);
 }
+
+void
+fb_tty_reload_keymap (FbTty *tty)
+{
+    g_return_if_fail (FB_IS_TTY (tty));
+
+    if (!tty->priv->inited || !tty->priv->keyboard)
+        return;
+
+    fb_tty_load_keymap (tty);
+}
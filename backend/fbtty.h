@@ -23,6 +23,7 @@
 
 #include <glib-object.h>
 
+#include "fbconsole.h"
 #include "fbio.h"
 #include "fbshellman.h"
 
@@ -85,9 +86,19 @@ GType            fb_tty_get_type                   (void);
  *
  * Returns: A newly allocated #FbTty
  */
-FbTty           *fb_tty_new                        (FbShellManager *manager);
+FbTty           *fb_tty_new                        (FbShellManager *manager,
+                                                    FbConsole      *console);
 void             fb_tty_switch_vc                  (FbTty   *tty,
                                                     gboolean enter);
 
+/**
+ * fb_tty_reload_keymap:
+ * @tty: A #FbTty
+ *
+ * Reads the kernel keymap again after loadkeys is run.
+ * This is effective only when IBUS_FBTERM_KEYBOARD_MODE=raw.
+ */
+void             fb_tty_reload_keymap              (FbTty   *tty);
+
 G_END_DECLS
 #endif
@@ -0,0 +1,1066 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+
+#include <string.h>
+
+#include "fbscrollback.h"
+#include "fbvt.h"
+#include "fbwidth.h"
+
+#define MAX_PARAMS      16
+#define TAB_WIDTH       8
+
+/* The packed attribute of FbVtCell */
+#define ATTR_FG_MASK        0x000f
+#define ATTR_BG_SHIFT       4
+#define ATTR_BG_MASK        0x00f0
+#define ATTR_COLOR_MASK     (ATTR_FG_MASK | ATTR_BG_MASK)
+#define ATTR_BOLD           (1 << 8)
+#define ATTR_HALF_BRIGHT    (1 << 9)
+#define ATTR_UNDERLINE      (1 << 10)
+#define ATTR_BLINK          (1 << 11)
+#define ATTR_REVERSE        (1 << 12)
+/* The right half of the previous wide character */
+#define ATTR_WIDE_TAIL      (1 << 13)
+/* The color index of the console default */
+#define COLOR_DEFAULT       9
+#define ATTR_DEFAULT        (COLOR_DEFAULT | (COLOR_DEFAULT << ATTR_BG_SHIFT))
+
+#define CELL(vt, r, c)      ((vt)->cells[(r) * (vt)->cols + (c)])
+
+/* The states follow vc_con_write() in drivers/tty/vt/vt.c */
+typedef enum {
+    StateNormal = 0,
+    StateEscape,
+    StateCsi,
+    StateSkipOne,
+    StateOsc,
+    StatePalette
+} VtState;
+
+typedef struct {
+    gunichar ch;
+    guint16  attr;
+} FbVtCell;
+
+struct _FbVt {
+    int       rows;
+    int       cols;
+    /* rows * cols cells which the console shows */
+    FbVtCell *cells;
+    guint16   attr;
+    guint16   saved_attr;
+    gboolean  cursor_visible;
+    guint     modes;
+    int       row;
+    int       col;
+    /* The scrolling region is [top, bottom) */
+    int       top;
+    int       bottom;
+    int       saved_row;
+    int       saved_col;
+    gboolean  need_wrap;
+    gboolean  autowrap;
+    gboolean  origin;
+
+    VtState   state;
+    int       params[MAX_PARAMS];
+    int       n_params;
+    gboolean  is_private;
+    int       skip;
+
+    gunichar  utf8_char;
+    int       utf8_count;
+
+    /* The rows scrolled off the top are pushed to the scrollback. */
+    FbScrollback *scrollback;
+    GString  *line;
+};
+
+FbVt *
+fb_vt_new (void)
+{
+    FbVt *vt = g_slice_new0 (FbVt);
+
+    fb_vt_resize (vt, 25, 80);
+    return vt;
+}
+
+void
+fb_vt_free (FbVt *vt)
+{
+    g_return_if_fail (vt != NULL);
+
+    g_free (vt->cells);
+    if (vt->line)
+        g_string_free (vt->line, TRUE);
+    g_slice_free (FbVt, vt);
+}
+
+static void
+fb_vt_append_attr (GString *output,
+                   guint16  attr)
+{
+    g_string_append (output, "\033[0");
+    if (attr & ATTR_BOLD)
+        g_string_append (output, ";1");
+    if (attr & ATTR_HALF_BRIGHT)
+        g_string_append (output, ";2");
+    if (attr & ATTR_UNDERLINE)
+        g_string_append (output, ";4");
+    if (attr & ATTR_BLINK)
+        g_string_append (output, ";5");
+    if (attr & ATTR_REVERSE)
+        g_string_append (output, ";7");
+    if ((attr & ATTR_FG_MASK) != COLOR_DEFAULT)
+        g_string_append_printf (output, ";3%d", attr & ATTR_FG_MASK);
+    if (((attr & ATTR_BG_MASK) >> ATTR_BG_SHIFT) != COLOR_DEFAULT) {
+        g_string_append_printf (output, ";4%d",
+                                (attr & ATTR_BG_MASK) >> ATTR_BG_SHIFT);
+    }
+    g_string_append_c (output, 'm');
+}
+
+void
+fb_vt_append_row (FbVt    *vt,
+                  int      row,
+                  GString *output)
+{
+    guint16 attr = ATTR_DEFAULT;
+    int end;
+    int col;
+
+    g_return_if_fail (vt != NULL);
+    g_return_if_fail (row >= 0 && row < vt->rows);
+
+    /* Trim the trailing blanks. */
+    for (end = vt->cols; end > 0; end--) {
+        const FbVtCell *cell = &CELL (vt, row, end - 1);
+        if (cell->ch != ' ' || cell->attr != ATTR_DEFAULT)
+            break;
+    }
+
+    for (col = 0; col < end; col++) {
+        const FbVtCell *cell = &CELL (vt, row, col);
+        guint16 cell_attr = cell->attr & ~ATTR_WIDE_TAIL;
+
+        /* The left half draws the wide character. */
+        if ((cell->attr & ATTR_WIDE_TAIL) && col > 0)
+            continue;
+        if (cell_attr != attr) {
+            attr = cell_attr;
+            fb_vt_append_attr (output, attr);
+        }
+        if (cell->attr & ATTR_WIDE_TAIL)
+            g_string_append_c (output, ' ');
+        else
+            g_string_append_unichar (output, cell->ch);
+    }
+    if (attr != ATTR_DEFAULT)
+        g_string_append (output, "\033[0m");
+}
+
+void
+fb_vt_set_scrollback (FbVt         *vt,
+                      FbScrollback *scrollback)
+{
+    g_return_if_fail (vt != NULL);
+
+    vt->scrollback = scrollback;
+    if (vt->line == NULL)
+        vt->line = g_string_new (NULL);
+}
+
+/* Erases the cells [@start, @end) of @row with the current colors as
+ * the console does.
+ */
+static void
+fb_vt_erase (FbVt *vt,
+             int   row,
+             int   start,
+             int   end)
+{
+    FbVtCell *cell = &CELL (vt, row, 0);
+    guint16 attr = vt->attr & ATTR_COLOR_MASK;
+    int i;
+
+    /* Do not leave the half of the wide character. */
+    if (end < vt->cols && (cell[end].attr & ATTR_WIDE_TAIL)) {
+        cell[end].ch = ' ';
+        cell[end].attr &= ~ATTR_WIDE_TAIL;
+    }
+    if (start > 0 && start < vt->cols &&
+        (cell[start].attr & ATTR_WIDE_TAIL)) {
+        cell[start - 1].ch = ' ';
+    }
+    for (i = start; i < end; i++) {
+        cell[i].ch = ' ';
+        cell[i].attr = attr;
+    }
+}
+
+static void
+fb_vt_erase_rows (FbVt *vt,
+                  int   top,
+                  int   bottom)
+{
+    int row;
+
+    for (row = top; row < bottom; row++)
+        fb_vt_erase (vt, row, 0, vt->cols);
+}
+
+/* Scrolls up the rows [@top, @bottom) by @n rows. */
+static void
+fb_vt_scroll_up (FbVt *vt,
+                 int   top,
+                 int   bottom,
+                 int   n)
+{
+    n = MIN (n, bottom - top);
+    memmove (&CELL (vt, top, 0),
+             &CELL (vt, top + n, 0),
+             sizeof (FbVtCell) * vt->cols * (bottom - top - n));
+    fb_vt_erase_rows (vt, bottom - n, bottom);
+}
+
+static void
+fb_vt_scroll_down (FbVt *vt,
+                   int   top,
+                   int   bottom,
+                   int   n)
+{
+    n = MIN (n, bottom - top);
+    memmove (&CELL (vt, top + n, 0),
+             &CELL (vt, top, 0),
+             sizeof (FbVtCell) * vt->cols * (bottom - top - n));
+    fb_vt_erase_rows (vt, top, top + n);
+}
+
+static void
+fb_vt_reset (FbVt *vt)
+{
+    vt->row = vt->col = 0;
+    vt->saved_row = vt->saved_col = 0;
+    vt->top = 0;
+    vt->bottom = vt->rows;
+    vt->need_wrap = FALSE;
+    vt->autowrap = TRUE;
+    vt->origin = FALSE;
+    vt->attr = vt->saved_attr = ATTR_DEFAULT;
+    vt->cursor_visible = TRUE;
+    vt->modes = FB_VT_MODE_AUTO_REPEAT;
+    vt->state = StateNormal;
+    vt->utf8_count = 0;
+}
+
+void
+fb_vt_resize (FbVt *vt,
+              int   rows,
+              int   cols)
+{
+    FbVtCell *cells;
+    int row;
+
+    g_return_if_fail (vt != NULL);
+
+    rows = MAX (rows, 1);
+    cols = MAX (cols, 1);
+    if (vt->cells != NULL && rows == vt->rows && cols == vt->cols)
+        return;
+
+    /* Keep the top left of the screen. */
+    cells = g_new (FbVtCell, rows * cols);
+    for (row = 0; row < rows; row++) {
+        int col = 0;
+
+        if (vt->cells != NULL && row < vt->rows) {
+            col = MIN (cols, vt->cols);
+            memcpy (&cells[row * cols], &CELL (vt, row, 0),
+                    sizeof (FbVtCell) * col);
+        }
+        for (; col < cols; col++) {
+            cells[row * cols + col].ch = ' ';
+            cells[row * cols + col].attr = ATTR_DEFAULT;
+        }
+    }
+    g_free (vt->cells);
+    vt->cells = cells;
+
+    if (vt->rows == 0) {
+        vt->rows = rows;
+        vt->cols = cols;
+        fb_vt_reset (vt);
+        return;
+    }
+
+    vt->rows = rows;
+    vt->cols = cols;
+    vt->top = 0;
+    vt->bottom = rows;
+    vt->row = MIN (vt->row, rows - 1);
+    vt->col = MIN (vt->col, cols - 1);
+    vt->saved_row = MIN (vt->saved_row, rows - 1);
+    vt->saved_col = MIN (vt->saved_col, cols - 1);
+    vt->need_wrap = FALSE;
+}
+
+void
+fb_vt_get_cursor (FbVt *vt,
+                  int  *row,
+                  int  *col)
+{
+    g_return_if_fail (vt != NULL);
+
+    if (row)
+        *row = vt->row;
+    if (col)
+        *col = vt->col;
+}
+
+guint
+fb_vt_get_modes (FbVt *vt)
+{
+    g_return_val_if_fail (vt != NULL, 0);
+
+    return vt->modes;
+}
+
+void
+fb_vt_get_size (FbVt *vt,
+                int  *rows,
+                int  *cols)
+{
+    g_return_if_fail (vt != NULL);
+
+    if (rows)
+        *rows = vt->rows;
+    if (cols)
+        *cols = vt->cols;
+}
+
+gsize
+fb_vt_get_allocated_size (FbVt *vt)
+{
+    g_return_val_if_fail (vt != NULL, 0);
+
+    return sizeof (FbVt) +
+           sizeof (FbVtCell) * vt->rows * vt->cols +
+           (vt->line ? vt->line->allocated_len : 0);
+}
+
+static void
+fb_vt_goto (FbVt *vt,
+            int   row,
+            int   col)
+{
+    int min_row = vt->origin ? vt->top : 0;
+    int max_row = vt->origin ? vt->bottom : vt->rows;
+
+    vt->col = CLAMP (col, 0, vt->cols - 1);
+    vt->row = CLAMP (row, min_row, max_row - 1);
+    vt->need_wrap = FALSE;
+}
+
+/* The row is relative to the top with the origin mode. */
+static void
+fb_vt_goto_absolute (FbVt *vt,
+                     int   row,
+                     int   col)
+{
+    fb_vt_goto (vt, vt->origin ? vt->top + row : row, col);
+}
+
+static void
+fb_vt_line_feed (FbVt *vt)
+{
+    if (vt->row + 1 == vt->bottom) {
+        /* Only the rows which the line feeds push out are kept. */
+        if (vt->top == 0 && vt->scrollback != NULL) {
+            g_string_truncate (vt->line, 0);
+            fb_vt_append_row (vt, 0, vt->line);
+            fb_scrollback_push_line (vt->scrollback,
+                                     vt->line->str, vt->line->len);
+        }
+        fb_vt_scroll_up (vt, vt->top, vt->bottom, 1);
+    } else if (vt->row < vt->rows - 1) {
+        vt->row++;
+    }
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_reverse_line_feed (FbVt *vt)
+{
+    if (vt->row == vt->top)
+        fb_vt_scroll_down (vt, vt->top, vt->bottom, 1);
+    else if (vt->row > 0)
+        vt->row--;
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_put_char (FbVt     *vt,
+                gunichar  ch)
+{
+    int width;
+
+    if ((width = fb_width_unichar (ch)) == 0)
+        return;
+
+    if (vt->need_wrap || vt->col + width > vt->cols) {
+        if (vt->autowrap) {
+            vt->col = 0;
+            fb_vt_line_feed (vt);
+        } else {
+            vt->col = MAX (vt->cols - width, 0);
+        }
+    }
+
+    /* A wide character does not fit in a 1 column console. */
+    width = MIN (width, vt->cols);
+    fb_vt_erase (vt, vt->row, vt->col, vt->col + width);
+    CELL (vt, vt->row, vt->col).ch = ch;
+    CELL (vt, vt->row, vt->col).attr = vt->attr;
+    if (width == 2)
+        CELL (vt, vt->row, vt->col + 1).attr = vt->attr | ATTR_WIDE_TAIL;
+
+    vt->col += width;
+    if (vt->col >= vt->cols) {
+        vt->col = vt->cols - 1;
+        vt->need_wrap = vt->autowrap;
+    }
+}
+
+static int
+fb_vt_param (FbVt *vt,
+             int   index,
+             int   default_value)
+{
+    if (index >= vt->n_params || vt->params[index] == 0)
+        return default_value;
+    return vt->params[index];
+}
+
+static void
+fb_vt_toggle_mode (FbVt     *vt,
+                   FbVtMode  mode,
+                   gboolean  on)
+{
+    if (on)
+        vt->modes |= mode;
+    else
+        vt->modes &= ~mode;
+}
+
+static void
+fb_vt_set_mode (FbVt     *vt,
+                gboolean  on)
+{
+    int i;
+
+    if (!vt->is_private) {
+        for (i = 0; i < vt->n_params; i++) {
+            if (vt->params[i] == 20)
+                fb_vt_toggle_mode (vt, FB_VT_MODE_CR_WITH_LF, on);
+        }
+        return;
+    }
+
+    for (i = 0; i < vt->n_params; i++) {
+        switch (vt->params[i]) {
+        case 1:
+            fb_vt_toggle_mode (vt, FB_VT_MODE_CURSOR_KEY_ESC_O, on);
+            break;
+        case 6:
+            vt->origin = on;
+            fb_vt_goto_absolute (vt, 0, 0);
+            break;
+        case 7:
+            vt->autowrap = on;
+            break;
+        case 8:
+            fb_vt_toggle_mode (vt, FB_VT_MODE_AUTO_REPEAT, on);
+            break;
+        case 25:
+            vt->cursor_visible = on;
+            break;
+        default:;
+        }
+    }
+}
+
+static guint16
+fb_vt_set_color (guint16 attr,
+                 int     shift,
+                 int     color)
+{
+    return (attr & ~(ATTR_FG_MASK << shift)) | (color << shift);
+}
+
+/* The attributes follow csi_m() in drivers/tty/vt/vt.c */
+static void
+fb_vt_set_attr (FbVt *vt)
+{
+    int i;
+
+    if (vt->n_params == 0) {
+        vt->attr = ATTR_DEFAULT;
+        return;
+    }
+
+    for (i = 0; i < vt->n_params; i++) {
+        int param = vt->params[i];
+
+        switch (param) {
+        case 0:
+            vt->attr = ATTR_DEFAULT;
+            break;
+        case 1:
+            vt->attr = (vt->attr & ~ATTR_HALF_BRIGHT) | ATTR_BOLD;
+            break;
+        case 2:
+            vt->attr = (vt->attr & ~ATTR_BOLD) | ATTR_HALF_BRIGHT;
+            break;
+        case 4:
+            vt->attr |= ATTR_UNDERLINE;
+            break;
+        case 5:
+            vt->attr |= ATTR_BLINK;
+            break;
+        case 7:
+            vt->attr |= ATTR_REVERSE;
+            break;
+        case 21:
+        case 22:
+            vt->attr &= ~(ATTR_BOLD | ATTR_HALF_BRIGHT);
+            break;
+        case 24:
+            vt->attr &= ~ATTR_UNDERLINE;
+            break;
+        case 25:
+            vt->attr &= ~ATTR_BLINK;
+            break;
+        case 27:
+            vt->attr &= ~ATTR_REVERSE;
+            break;
+        case 38:
+        case 48:
+            /* The 256 colors and the true colors are not kept.  Skip
+             * the arguments.
+             */
+            if (i + 1 < vt->n_params && vt->params[i + 1] == 5)
+                i += 2;
+            else if (i + 1 < vt->n_params && vt->params[i + 1] == 2)
+                i += 4;
+            break;
+        case 39:
+            vt->attr = fb_vt_set_color (vt->attr, 0, COLOR_DEFAULT);
+            break;
+        case 49:
+            vt->attr = fb_vt_set_color (vt->attr, ATTR_BG_SHIFT,
+                                        COLOR_DEFAULT);
+            break;
+        default:
+            if (param >= 30 && param <= 37) {
+                vt->attr = fb_vt_set_color (vt->attr, 0, param - 30);
+            } else if (param >= 40 && param <= 47) {
+                vt->attr = fb_vt_set_color (vt->attr, ATTR_BG_SHIFT,
+                                            param - 40);
+            } else if (param >= 90 && param <= 97) {
+                vt->attr = fb_vt_set_color (vt->attr, 0, param - 90);
+                vt->attr |= ATTR_BOLD;
+            } else if (param >= 100 && param <= 107) {
+                vt->attr = fb_vt_set_color (vt->attr, ATTR_BG_SHIFT,
+                                            param - 100);
+                vt->attr |= ATTR_BLINK;
+            }
+        }
+    }
+}
+
+static void
+fb_vt_erase_display (FbVt *vt)
+{
+    switch (fb_vt_param (vt, 0, 0)) {
+    case 0:
+        fb_vt_erase (vt, vt->row, vt->col, vt->cols);
+        fb_vt_erase_rows (vt, vt->row + 1, vt->rows);
+        break;
+    case 1:
+        fb_vt_erase_rows (vt, 0, vt->row);
+        fb_vt_erase (vt, vt->row, 0, vt->col + 1);
+        break;
+    case 2:
+    case 3:
+        fb_vt_erase_rows (vt, 0, vt->rows);
+        break;
+    default:;
+    }
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_erase_line (FbVt *vt)
+{
+    switch (fb_vt_param (vt, 0, 0)) {
+    case 0:
+        fb_vt_erase (vt, vt->row, vt->col, vt->cols);
+        break;
+    case 1:
+        fb_vt_erase (vt, vt->row, 0, vt->col + 1);
+        break;
+    case 2:
+        fb_vt_erase (vt, vt->row, 0, vt->cols);
+        break;
+    default:;
+    }
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_insert_chars (FbVt *vt,
+                    int   n)
+{
+    FbVtCell *cell = &CELL (vt, vt->row, 0);
+
+    n = MIN (n, vt->cols - vt->col);
+    memmove (&cell[vt->col + n], &cell[vt->col],
+             sizeof (FbVtCell) * (vt->cols - vt->col - n));
+    fb_vt_erase (vt, vt->row, vt->col, vt->col + n);
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_delete_chars (FbVt *vt,
+                    int   n)
+{
+    FbVtCell *cell = &CELL (vt, vt->row, 0);
+
+    n = MIN (n, vt->cols - vt->col);
+    memmove (&cell[vt->col], &cell[vt->col + n],
+             sizeof (FbVtCell) * (vt->cols - vt->col - n));
+    fb_vt_erase (vt, vt->row, vt->cols - n, vt->cols);
+    vt->need_wrap = FALSE;
+}
+
+static void
+fb_vt_do_csi (FbVt  *vt,
+              gchar  final)
+{
+    int top;
+    int bottom;
+
+    switch (final) {
+    case 'A':
+        fb_vt_goto (vt, vt->row - fb_vt_param (vt, 0, 1), vt->col);
+        break;
+    case 'B':
+    case 'e':
+        fb_vt_goto (vt, vt->row + fb_vt_param (vt, 0, 1), vt->col);
+        break;
+    case 'C':
+    case 'a':
+        fb_vt_goto (vt, vt->row, vt->col + fb_vt_param (vt, 0, 1));
+        break;
+    case 'D':
+        fb_vt_goto (vt, vt->row, vt->col - fb_vt_param (vt, 0, 1));
+        break;
+    case 'E':
+        fb_vt_goto (vt, vt->row + fb_vt_param (vt, 0, 1), 0);
+        break;
+    case 'F':
+        fb_vt_goto (vt, vt->row - fb_vt_param (vt, 0, 1), 0);
+        break;
+    case 'G':
+    case '`':
+        fb_vt_goto (vt, vt->row, fb_vt_param (vt, 0, 1) - 1);
+        break;
+    case 'd':
+        fb_vt_goto_absolute (vt, fb_vt_param (vt, 0, 1) - 1, vt->col);
+        break;
+    case 'H':
+    case 'f':
+        fb_vt_goto_absolute (vt,
+                             fb_vt_param (vt, 0, 1) - 1,
+                             fb_vt_param (vt, 1, 1) - 1);
+        break;
+    case 'J':
+        fb_vt_erase_display (vt);
+        break;
+    case 'K':
+        fb_vt_erase_line (vt);
+        break;
+    case 'X':
+        fb_vt_erase (vt, vt->row, vt->col,
+                     MIN (vt->col + fb_vt_param (vt, 0, 1), vt->cols));
+        break;
+    case '@':
+        fb_vt_insert_chars (vt, fb_vt_param (vt, 0, 1));
+        break;
+    case 'P':
+        fb_vt_delete_chars (vt, fb_vt_param (vt, 0, 1));
+        break;
+    case 'L':
+        if (vt->row >= vt->top && vt->row < vt->bottom) {
+            fb_vt_scroll_down (vt, vt->row, vt->bottom,
+                               fb_vt_param (vt, 0, 1));
+        }
+        break;
+    case 'M':
+        if (vt->row >= vt->top && vt->row < vt->bottom) {
+            fb_vt_scroll_up (vt, vt->row, vt->bottom,
+                             fb_vt_param (vt, 0, 1));
+        }
+        break;
+    case 'm':
+        fb_vt_set_attr (vt);
+        break;
+    case 'r':
+        top = fb_vt_param (vt, 0, 1);
+        bottom = fb_vt_param (vt, 1, vt->rows);
+        if (top < bottom && bottom <= vt->rows) {
+            vt->top = top - 1;
+            vt->bottom = bottom;
+            fb_vt_goto_absolute (vt, 0, 0);
+        }
+        break;
+    case 's':
+        vt->saved_row = vt->row;
+        vt->saved_col = vt->col;
+        vt->saved_attr = vt->attr;
+        break;
+    case 'u':
+        fb_vt_goto (vt, vt->saved_row, vt->saved_col);
+        vt->attr = vt->saved_attr;
+        break;
+    case 'h':
+        fb_vt_set_mode (vt, TRUE);
+        break;
+    case 'l':
+        fb_vt_set_mode (vt, FALSE);
+        break;
+    default:;
+    }
+}
+
+static void
+fb_vt_do_escape (FbVt  *vt,
+                 gchar  ch)
+{
+    vt->state = StateNormal;
+
+    switch (ch) {
+    case '[':
+        memset (vt->params, 0, sizeof (vt->params));
+        vt->n_params = 0;
+        vt->is_private = FALSE;
+        vt->state = StateCsi;
+        break;
+    case ']':
+        vt->state = StateOsc;
+        break;
+    case '(':
+    case ')':
+    case '#':
+    case '%':
+        vt->state = StateSkipOne;
+        break;
+    case '7':
+        vt->saved_row = vt->row;
+        vt->saved_col = vt->col;
+        vt->saved_attr = vt->attr;
+        break;
+    case '8':
+        fb_vt_goto (vt, vt->saved_row, vt->saved_col);
+        vt->attr = vt->saved_attr;
+        break;
+    case 'D':
+        fb_vt_line_feed (vt);
+        break;
+    case 'E':
+        vt->col = 0;
+        fb_vt_line_feed (vt);
+        break;
+    case 'M':
+        fb_vt_reverse_line_feed (vt);
+        break;
+    case 'c':
+        fb_vt_reset (vt);
+        fb_vt_erase_rows (vt, 0, vt->rows);
+        break;
+    case '=':
+        vt->modes |= FB_VT_MODE_APPLIC_KEYPAD;
+        break;
+    case '>':
+        vt->modes &= ~FB_VT_MODE_APPLIC_KEYPAD;
+        break;
+    default:;
+    }
+}
+
+static void
+fb_vt_do_control (FbVt  *vt,
+                  gchar  ch)
+{
+    switch (ch) {
+    case '\b':
+        if (vt->col > 0)
+            vt->col--;
+        vt->need_wrap = FALSE;
+        break;
+    case '\t':
+        vt->col = MIN ((vt->col / TAB_WIDTH + 1) * TAB_WIDTH, vt->cols - 1);
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        fb_vt_line_feed (vt);
+        break;
+    case '\r':
+        vt->col = 0;
+        vt->need_wrap = FALSE;
+        break;
+    case 0x18:
+    case 0x1a:
+        vt->state = StateNormal;
+        break;
+    case 0x1b:
+        vt->state = StateEscape;
+        break;
+    default:;
+    }
+}
+
+/* Fills the cells of the row at once without the wrap. */
+static void
+fb_vt_put_ascii (FbVt         *vt,
+                 const guchar *buff,
+                 gsize         length)
+{
+    while (length > 0) {
+        FbVtCell *cell;
+        int n;
+        int i;
+
+        if (vt->need_wrap || !vt->autowrap) {
+            fb_vt_put_char (vt, *buff++);
+            length--;
+            continue;
+        }
+
+        n = MIN (length, (gsize) (vt->cols - vt->col));
+        fb_vt_erase (vt, vt->row, vt->col, vt->col + n);
+        cell = &CELL (vt, vt->row, vt->col);
+        for (i = 0; i < n; i++) {
+            cell[i].ch = buff[i];
+            cell[i].attr = vt->attr;
+        }
+        buff += n;
+        length -= n;
+        vt->col += n;
+        if (vt->col >= vt->cols) {
+            vt->col = vt->cols - 1;
+            vt->need_wrap = TRUE;
+        }
+    }
+}
+
+void
+fb_vt_feed (FbVt        *vt,
+            const gchar *buff,
+            gsize        length)
+{
+    gsize i;
+
+    g_return_if_fail (vt != NULL);
+
+    for (i = 0; i < length; i++) {
+        guchar ch = buff[i];
+
+        /* The plain text is the most of the output. */
+        if (vt->state == StateNormal && ch >= 0x20 && ch < 0x7f) {
+            gsize n = fb_width_ascii_run (buff + i, length - i);
+            vt->utf8_count = 0;
+            fb_vt_put_ascii (vt, (const guchar *) buff + i, n);
+            i += n - 1;
+            continue;
+        }
+
+        /* The console executes the control characters even in
+         * the escape sequences.
+         */
+        if (ch < 0x20 || ch == 0x7f) {
+            vt->utf8_count = 0;
+            fb_vt_do_control (vt, ch);
+            continue;
+        }
+
+        switch (vt->state) {
+        case StateEscape:
+            fb_vt_do_escape (vt, ch);
+            continue;
+        case StateCsi:
+            if (ch == '?') {
+                vt->is_private = TRUE;
+            } else if (ch >= '0' && ch <= '9') {
+                if (vt->n_params == 0)
+                    vt->n_params = 1;
+                if (vt->n_params <= MAX_PARAMS) {
+                    int *param = &vt->params[vt->n_params - 1];
+                    if (*param < 10000)
+                        *param = *param * 10 + (ch - '0');
+                }
+            } else if (ch == ';') {
+                if (vt->n_params == 0)
+                    vt->n_params = 1;
+                if (vt->n_params < MAX_PARAMS)
+                    vt->n_params++;
+            } else if (ch >= 0x40 && ch <= 0x7e) {
+                vt->state = StateNormal;
+                fb_vt_do_csi (vt, ch);
+            }
+            continue;
+        case StateSkipOne:
+            vt->state = StateNormal;
+            continue;
+        case StateOsc:
+            /* ESC ] P nrrggbb sets the palette and ESC ] R resets it. */
+            if (ch == 'P') {
+                vt->skip = 7;
+                vt->state = StatePalette;
+            } else {
+                vt->state = StateNormal;
+            }
+            continue;
+        case StatePalette:
+            if (--vt->skip == 0)
+                vt->state = StateNormal;
+            continue;
+        case StateNormal:
+        default:;
+        }
+
+        if (ch < 0x80) {
+            vt->utf8_count = 0;
+            fb_vt_put_char (vt, ch);
+        } else if ((ch & 0xc0) == 0x80) {
+            if (vt->utf8_count == 0)
+                continue;
+            vt->utf8_char = (vt->utf8_char << 6) | (ch & 0x3f);
+            if (--vt->utf8_count == 0)
+                fb_vt_put_char (vt, vt->utf8_char);
+        } else if ((ch & 0xe0) == 0xc0) {
+            vt->utf8_char = ch & 0x1f;
+            vt->utf8_count = 1;
+        } else if ((ch & 0xf0) == 0xe0) {
+            vt->utf8_char = ch & 0x0f;
+            vt->utf8_count = 2;
+        } else if ((ch & 0xf8) == 0xf0) {
+            vt->utf8_char = ch & 0x07;
+            vt->utf8_count = 3;
+        } else {
+            vt->utf8_count = 0;
+        }
+    }
+}
+
+void
+fb_vt_repaint (FbVt    *vt,
+               FbVt    *displayed,
+               GString *output)
+{
+    static const FbVtCell blank = { ' ', ATTR_DEFAULT };
+    gboolean clear;
+    guint attr;
+    int cursor_row = -1;
+    int cursor_col = -1;
+    int row, col;
+
+    g_return_if_fail (vt != NULL);
+    g_return_if_fail (output != NULL);
+
+    clear = displayed == NULL || displayed == vt ||
+            displayed->rows != vt->rows || displayed->cols != vt->cols;
+
+    /* The cells are drawn with the absolute positions. */
+    if (clear || displayed->origin)
+        g_string_append (output, "\033[?6l");
+    if (clear) {
+        g_string_append (output, "\033[0m\033[H\033[J");
+        attr = ATTR_DEFAULT;
+    } else {
+        /* The attribute of the console is unknown. */
+        attr = G_MAXUINT;
+    }
+
+    for (row = 0; row < vt->rows; row++) {
+        col = 0;
+        while (col < vt->cols) {
+            const FbVtCell *cell = &CELL (vt, row, col);
+            const FbVtCell *old = clear ? &blank : &CELL (displayed, row, col);
+            int width = 1;
+
+            if (cell->ch == old->ch && cell->attr == old->attr) {
+                col++;
+                continue;
+            }
+
+            /* Draw the whole wide character from the left half. */
+            if ((cell->attr & ATTR_WIDE_TAIL) && col > 0) {
+                col--;
+                cell--;
+            }
+            if (col + 1 < vt->cols &&
+                (CELL (vt, row, col + 1).attr & ATTR_WIDE_TAIL)) {
+                width = 2;
+            }
+
+            if (cursor_row != row || cursor_col != col)
+                g_string_append_printf (output, "\033[%d;%dH", row + 1, col + 1);
+            if ((cell->attr & ~ATTR_WIDE_TAIL) != attr) {
+                attr = cell->attr & ~ATTR_WIDE_TAIL;
+                fb_vt_append_attr (output, attr);
+            }
+            if (cell->attr & ATTR_WIDE_TAIL)
+                g_string_append_c (output, ' ');
+            else
+                g_string_append_unichar (output, cell->ch);
+
+            col += width;
+            cursor_row = row;
+            /* The cursor stays on the last column. */
+            cursor_col = col < vt->cols ? col : -1;
+        }
+    }
+
+    if (attr != vt->attr)
+        fb_vt_append_attr (output, vt->attr);
+    if (vt->origin)
+        g_string_append (output, "\033[?6h");
+    g_string_append_printf (output, "\033[%d;%dH",
+                            (vt->origin ? vt->row - vt->top : vt->row) + 1,
+                            vt->col + 1);
+    if (clear || displayed->cursor_visible != vt->cursor_visible)
+        g_string_append (output, vt->cursor_visible ? "\033[?25h" : "\033[?25l");
+}
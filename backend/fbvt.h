@@ -0,0 +1,163 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_VT_H_
+#define __FB_VT_H_
+
+#include <glib.h>
+
+#include "fbscrollback.h"
+
+G_BEGIN_DECLS
+typedef struct _FbVt FbVt;
+
+/**
+ * FbVtMode:
+ * @FB_VT_MODE_CURSOR_KEY_ESC_O: The cursor keys send ESC O (DECCKM).
+ * @FB_VT_MODE_AUTO_REPEAT: The keys repeat (DECARM).
+ * @FB_VT_MODE_APPLIC_KEYPAD: The keypad sends ESC O (DECKPAM).
+ * @FB_VT_MODE_CR_WITH_LF: The return key sends CR LF (LNM).
+ *
+ * The modes which the shell sets with the output.
+ */
+typedef enum {
+    FB_VT_MODE_CURSOR_KEY_ESC_O = 1 << 0,
+    FB_VT_MODE_AUTO_REPEAT      = 1 << 1,
+    FB_VT_MODE_APPLIC_KEYPAD    = 1 << 2,
+    FB_VT_MODE_CR_WITH_LF       = 1 << 3
+} FbVtMode;
+
+/**
+ * fb_vt_new:
+ *
+ * Creates a new tracker of the Linux console state.  It follows the
+ * sequences written to the console and keeps the cells of the screen
+ * so that the cursor position is known without the DSR request and
+ * the screen can be drawn again.
+ *
+ * Returns: A newly allocated #FbVt
+ */
+FbVt            *fb_vt_new                         (void);
+void             fb_vt_free                        (FbVt              *vt);
+
+/**
+ * fb_vt_resize:
+ * @vt: A #FbVt
+ * @rows: The number of the rows.
+ * @cols: The number of the columns.
+ *
+ * Sets the console size.  The top left of the screen is kept and
+ * the scrolling region is reset if the size is changed.
+ */
+void             fb_vt_resize                      (FbVt              *vt,
+                                                    int                rows,
+                                                    int                cols);
+
+/**
+ * fb_vt_feed:
+ * @vt: A #FbVt
+ * @buff: The bytes written to the console.
+ * @length: The length of @buff.
+ *
+ * Updates the state with @buff.  The escape sequences and the UTF-8
+ * characters can be split between the calls.
+ */
+void             fb_vt_feed                        (FbVt              *vt,
+                                                    const gchar       *buff,
+                                                    gsize              length);
+
+/**
+ * fb_vt_get_cursor:
+ * @vt: A #FbVt
+ * @row: (out): The 0-based row of the cursor.
+ * @col: (out): The 0-based column of the cursor.
+ */
+void             fb_vt_get_cursor                  (FbVt              *vt,
+                                                    int               *row,
+                                                    int               *col);
+
+/**
+ * fb_vt_get_modes:
+ * @vt: A #FbVt
+ *
+ * Returns: The #FbVtMode flags which are set.
+ */
+guint            fb_vt_get_modes                   (FbVt              *vt);
+
+/**
+ * fb_vt_get_size:
+ * @vt: A #FbVt
+ * @rows: (out): The number of the rows.
+ * @cols: (out): The number of the columns.
+ */
+void             fb_vt_get_size                    (FbVt              *vt,
+                                                    int               *rows,
+                                                    int               *cols);
+
+/**
+ * fb_vt_get_allocated_size:
+ * @vt: A #FbVt
+ *
+ * Returns: The bytes of the cells and the buffers of @vt.
+ */
+gsize            fb_vt_get_allocated_size          (FbVt              *vt);
+
+/**
+ * fb_vt_set_scrollback:
+ * @vt: A #FbVt
+ * @scrollback: (nullable): A #FbScrollback
+ *
+ * The rows scrolled off the top of the screen are pushed to @scrollback.
+ */
+void             fb_vt_set_scrollback              (FbVt              *vt,
+                                                    FbScrollback      *scrollback);
+
+/**
+ * fb_vt_append_row:
+ * @vt: A #FbVt
+ * @row: The 0-based row.
+ * @output: The #GString to append the row.
+ *
+ * Appends the characters and the SGR sequences of @row without
+ * the trailing blanks.  The attribute starts with and returns to
+ * the default.
+ */
+void             fb_vt_append_row                  (FbVt              *vt,
+                                                    int                row,
+                                                    GString           *output);
+
+/**
+ * fb_vt_repaint:
+ * @vt: A #FbVt
+ * @displayed: (nullable): The #FbVt which the console shows now.
+ * @output: The #GString to append the sequences.
+ *
+ * Appends the sequences which change the console from @displayed to
+ * the screen of @vt.  Only the cells which differ are drawn and
+ * the attribute and the cursor of @vt are restored at the end.
+ * The screen is cleared and drawn if @displayed is %NULL or
+ * the size differs.
+ */
+void             fb_vt_repaint                     (FbVt              *vt,
+                                                    FbVt              *displayed,
+                                                    GString           *output);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,158 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+
+#include <glib.h>
+
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "fbwidth.h"
+#include "fbwidthtable.h"
+
+#define WIDTH_AMBIGUOUS 3
+
+static int ambiguous_width = 0;
+
+static int
+fb_width_get_ambiguous_width (void)
+{
+    if (G_UNLIKELY (ambiguous_width == 0)) {
+        const gchar *env = g_getenv ("IBUS_FBTERM_AMBIGUOUS_WIDTH");
+        ambiguous_width = (g_strcmp0 (env, "2") == 0) ? 2 : 1;
+    }
+    return ambiguous_width;
+}
+
+int
+fb_width_unichar (gunichar ch)
+{
+    int width;
+
+    if (ch >= 0x110000)
+        return 1;
+
+    width = (width_stage2[width_stage1[ch >> 8]][(ch & 0xff) >> 2]
+             >> ((ch & 3) * 2)) & 3;
+    if (width == WIDTH_AMBIGUOUS)
+        return fb_width_get_ambiguous_width ();
+    return width;
+}
+
+gsize
+fb_width_ascii_run (const gchar *str,
+                    gsize        length)
+{
+    gsize i = 0;
+
+#ifdef __SSE2__
+    const __m128i low = _mm_set1_epi8 (0x1f);
+    const __m128i high = _mm_set1_epi8 (0x7f);
+
+    /* The bytes >= 0x80 are negative in the signed comparisons. */
+    for (; i + 16 <= length; i += 16) {
+        __m128i chunk = _mm_loadu_si128 ((const __m128i *)(str + i));
+        __m128i printable = _mm_and_si128 (_mm_cmpgt_epi8 (chunk, low),
+                                           _mm_cmplt_epi8 (chunk, high));
+        int mask = _mm_movemask_epi8 (printable);
+        if (mask != 0xffff)
+            return i + g_bit_nth_lsf (~mask & 0xffff, -1);
+    }
+#else
+    const guint64 ones = G_GUINT64_CONSTANT (0x0101010101010101);
+    const guint64 highs = G_GUINT64_CONSTANT (0x8080808080808080);
+
+    for (; i + sizeof (guint64) <= length; i += sizeof (guint64)) {
+        guint64 chunk;
+        guint64 del;
+
+        memcpy (&chunk, str + i, sizeof (chunk));
+        del = chunk ^ (ones * 0x7f);
+        /* Any byte >= 0x80, < 0x20 or == 0x7f */
+        if ((chunk & highs) ||
+            ((chunk - ones * 0x20) & ~chunk & highs) ||
+            ((del - ones) & ~del & highs)) {
+            break;
+        }
+    }
+#endif
+    for (; i < length; i++) {
+        guchar ch = str[i];
+        if (ch < 0x20 || ch >= 0x7f)
+            break;
+    }
+    return i;
+}
+
+gsize
+fb_width_utf8 (const gchar *str,
+               gssize       length,
+               int          max_width,
+               int         *width)
+{
+    const gchar *p = str;
+    const gchar *end;
+    int w = 0;
+
+    g_return_val_if_fail (str != NULL, 0);
+
+    if (length < 0)
+        length = strlen (str);
+    end = str + length;
+
+    while (p < end) {
+        gsize run = fb_width_ascii_run (p, end - p);
+        gunichar ch;
+        int char_width;
+
+        if (run > 0) {
+            if (max_width >= 0 && run > (gsize)(max_width - w))
+                run = max_width - w;
+            w += run;
+            p += run;
+            if (max_width >= 0 && w >= max_width)
+                break;
+            continue;
+        }
+
+        ch = g_utf8_get_char_validated (p, end - p);
+        if (ch == (gunichar)-1 || ch == (gunichar)-2) {
+            /* An invalid byte is shown as a replacement character. */
+            char_width = 1;
+            if (max_width >= 0 && w + char_width > max_width)
+                break;
+            w += char_width;
+            p++;
+            continue;
+        }
+        char_width = fb_width_unichar (ch);
+        if (max_width >= 0 && w + char_width > max_width)
+            break;
+        w += char_width;
+        p = g_utf8_next_char (p);
+    }
+
+    if (width)
+        *width = w;
+    return p - str;
+}
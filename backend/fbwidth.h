@@ -0,0 +1,73 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_WIDTH_H_
+#define __FB_WIDTH_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * fb_width_unichar:
+ * @ch: A Unicode character
+ *
+ * Returns the columns of @ch on the console.  The East Asian ambiguous
+ * characters are 2 columns if IBUS_FBTERM_AMBIGUOUS_WIDTH=2 and
+ * 1 column otherwise.
+ *
+ * Returns: 0, 1 or 2
+ */
+int              fb_width_unichar                  (gunichar           ch);
+
+/**
+ * fb_width_ascii_run:
+ * @str: The bytes to scan.
+ * @length: The byte length of @str.
+ *
+ * Scans @str a vector at a time with SSE2 if it is available and
+ * a 64 bit word at a time otherwise.
+ *
+ * Returns: The length of the printable ASCII bytes from 0x20 to 0x7e
+ *          at the head of @str.
+ */
+gsize            fb_width_ascii_run                (const gchar       *str,
+                                                    gsize              length);
+
+/**
+ * fb_width_utf8:
+ * @str: A UTF-8 string
+ * @length: The byte length of @str or -1 if @str is nul-terminated.
+ * @max_width: The maximum columns or -1 for no limit.
+ * @width: (out) (allow-none): The columns of the returned prefix.
+ *
+ * Measures @str without allocations.  The runs of ASCII characters
+ * are measured a vector at a time.
+ *
+ * Returns: The byte length of the longest prefix of @str which fits in
+ *          @max_width columns.
+ */
+gsize            fb_width_utf8                     (const gchar       *str,
+                                                    gssize             length,
+                                                    int                max_width,
+                                                    int               *width);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,89 @@
+#!/usr/bin/python3
+# vim:set et sts=4 sw=4:
+#
+# Copyright (c) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+# Copyright (c) 2015-2016 Red Hat, Inc.
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Generates fbwidthtable.h from the unicodedata module of Python:
+#   ./gen-fbwidth-table.py > fbwidthtable.h
+
+import sys
+import unicodedata
+
+WIDTH_ZERO = 0
+WIDTH_NARROW = 1
+WIDTH_WIDE = 2
+WIDTH_AMBIGUOUS = 3
+
+def get_class(code):
+    ch = chr(code)
+    category = unicodedata.category(ch)
+    if category in ('Mn', 'Me', 'Cf', 'Cc') and code != 0xad:
+        return WIDTH_ZERO
+    # Hangul Jamo medial vowels and final consonants
+    if 0x1160 <= code <= 0x11ff or code == 0x200b:
+        return WIDTH_ZERO
+    east_asian_width = unicodedata.east_asian_width(ch)
+    if east_asian_width in ('W', 'F'):
+        return WIDTH_WIDE
+    # The unassigned characters in the CJK planes
+    if category == 'Cn' and (0x20000 <= code <= 0x3fffd):
+        return WIDTH_WIDE
+    if east_asian_width == 'A' and category != 'Co':
+        return WIDTH_AMBIGUOUS
+    return WIDTH_NARROW
+
+def main():
+    blocks = {}
+    stage1 = []
+    stage2 = []
+    for block in range(0x1100):
+        classes = [get_class((block << 8) + i) for i in range(256)]
+        data = bytes(sum(classes[i * 4 + j] << (2 * j) for j in range(4))
+                     for i in range(64))
+        if data not in blocks:
+            blocks[data] = len(stage2)
+            stage2.append(data)
+        stage1.append(blocks[data])
+    assert len(stage2) <= 256
+
+    out = sys.stdout
+    out.write('''/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* This file is generated by gen-fbwidth-table.py.  Do not edit. */
+
+#ifndef __FB_WIDTH_TABLE_H_
+#define __FB_WIDTH_TABLE_H_
+
+/* Unicode %s: 2 bits per character in the 256 character blocks.
+ * 0: zero width, 1: narrow, 2: wide, 3: ambiguous
+ */
+''' % unicodedata.unidata_version)
+    out.write('static const guint8 width_stage1[0x%x] = {\n' % len(stage1))
+    for i in range(0, len(stage1), 12):
+        out.write('    %s\n' % ' '.join('%3d,' % x for x in stage1[i:i + 12]))
+    out.write('};\n\n')
+    out.write('static const guint8 width_stage2[%d][64] = {\n' % len(stage2))
+    for data in stage2:
+        out.write('    {\n')
+        for i in range(0, 64, 11):
+            out.write('        %s\n' %
+                      ' '.join('0x%02x,' % x for x in data[i:i + 11]))
+        out.write('    },\n')
+    out.write('};\n\n#endif\n')
+
+if __name__ == '__main__':
+    main()
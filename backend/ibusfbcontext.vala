@@ -18,39 +18,6 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-/* FIXME: Cannot use fbcontext.vapi because GObject.TypeInterface
- * does not exist in gobject-2.0.vapi
- */
-public interface FbContext {
-    public abstract uint filter_keypress   (string?          buff,
-                                            uint             length,
-                                            out string?      dispatched = null);
-    public abstract void load_settings     ();
-
-    public signal void   user_warning      (string           message);
-    public signal void   cursor_position   (int              x,
-                                            int              y);
-    public signal int    switcher_switch   (IBus.EngineDesc[]
-                                                             engines,
-                                            uint32           keyval);
-    public signal uint32 keysym_to_keycode (uint32           keysym);
-    public signal void   engine_changed    (IBus.EngineDesc  engine);
-
-    public signal void   commit            (IBus.Text        text);
-    public signal void   preedit_changed   (IBus.Text        text,
-                                            uint             cursor_pos,
-                                            bool             visible);
-    public signal void   update_lookup_table
-                                           (IBus.LookupTable table,
-                                            bool             visible);
-    public signal void   register_properties
-                                           (IBus.PropList    props);
-    public signal void   update_property   (IBus.Property    prop);
-    public signal void   forward_key_event (uint             keyval,
-                                            uint             keycode,
-                                            uint             state);
-}
-
 class IBusFbContext : GLib.InitiallyUnowned, FbContext {
     private enum BindingState {
         NO_BINDING = 0,
@@ -58,24 +25,62 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
         DOUBLE_BINDING,
     }
 
+    private enum HotkeyAction {
+        TRIGGER = 0,
+        NEXT_ENGINE,
+        PREVIOUS_ENGINE,
+    }
+
+    /* The hotkey hash key packs the keyval in the lower 25 bits, which
+     * covers the Unicode keysyms 0x1000000 + 0x10ffff, and the modifiers
+     * below in the upper 7 bits.
+     */
+    private const uint32 HOTKEY_KEYVAL_MASK = 0x1ffffff;
+    private const uint32[] HOTKEY_MODIFIERS = {
+        IBus.ModifierType.SHIFT_MASK,
+        IBus.ModifierType.CONTROL_MASK,
+        IBus.ModifierType.MOD1_MASK,
+        IBus.ModifierType.SUPER_MASK,
+        IBus.ModifierType.HYPER_MASK,
+        IBus.ModifierType.META_MASK,
+        IBus.ModifierType.RELEASE_MASK,
+    };
+    /* The built-in engine to compose the dead keys and the Compose
+     * sequences without ibus-daemon.  It's enabled when this name is
+     * added in preload-engines.
+     */
+    private const string COMPOSE_ENGINE_NAME = "fbterm:compose";
+
+    private const string[] HOTKEY_KEYS = {
+        "triggers",
+        "next-engine-in-menu",
+        "previous-engine",
+    };
+
     private GLib.Settings m_settings_general;
     private GLib.Settings m_settings_hotkey;
     private Loadkeys m_loadkeys;
     private IBus.Bus m_bus;
     private IBus.InputContext m_ibuscontext;
-    private GLib.List<Keybinding> m_bindings;
+    private GLib.HashTable<uint, Keybinding> m_hotkeys;
     private IBus.EngineDesc[] m_engines = {};
+    private FbCompose? m_compose;
+    private IBus.EngineDesc? m_compose_engine;
+    private bool m_is_compose_engine;
     private bool m_is_escaped;
     private BindingState m_is_binding;
 
     private class Keybinding {
-        public Keybinding(uint32 keyval,
-                          uint32 modifiers) {
+        public Keybinding(uint32       keyval,
+                          uint32       modifiers,
+                          HotkeyAction action) {
             this.keyval = keyval;
             this.modifiers = modifiers;
+            this.action = action;
         }
         public uint32 keyval { get; set; }
         public uint32 modifiers { get; set; }
+        public HotkeyAction action { get; set; }
     }
 
     public IBusFbContext() {
@@ -84,9 +89,13 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
         m_settings_hotkey =
                 new GLib.Settings("org.freedesktop.ibus.general.hotkey");
 
-        m_settings_hotkey.changed["triggers"].connect((key) => {
-                bind_switch_shortcut();
-        });
+        foreach (var key in HOTKEY_KEYS) {
+            if (!m_settings_hotkey.settings_schema.has_key(key))
+                continue;
+            m_settings_hotkey.changed[key].connect((changed_key) => {
+                    bind_hotkeys();
+            });
+        }
 
         m_loadkeys = new Loadkeys();
         m_loadkeys.user_warning.connect((s) => user_warning(s));
@@ -143,13 +152,25 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
     }
 
     private void set_engine(IBus.EngineDesc engine) {
+        if (engine.get_name() == COMPOSE_ENGINE_NAME) {
+            if (m_compose == null)
+                m_compose = new FbCompose();
+            m_compose.reset();
+            m_ibuscontext.reset();
+            m_is_compose_engine = true;
+            engine_changed(engine);
+            return;
+        }
+
+        m_is_compose_engine = false;
         if (!m_bus.set_global_engine(engine.get_name())) {
             user_warning(
                     "Switch engine to %s failed.".printf(engine.get_name()));
             return;
         }
 
-        m_loadkeys.set_layout(engine);
+        if (m_loadkeys.set_layout(engine))
+            keymap_changed();
         engine_changed(engine);
     }
 
@@ -190,15 +211,50 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
             names += name;
         }
 
-        var engines = m_bus.get_engines_by_names(names);
+        /* The compose engine is not registered in ibus-daemon. */
+        int compose_index = -1;
+        string[] bus_names = {};
+        foreach (var name in names) {
+            if (name == COMPOSE_ENGINE_NAME)
+                compose_index = bus_names.length;
+            else
+                bus_names += name;
+        }
+        names = bus_names;
 
-        /* Fedora internal patch could save engines not in simple.xml
-         * likes 'xkb:cn::chi'.
-         */
-        if (engines.length == 0) {
-            names =  {"xkb:us::eng"};
-            m_settings_general.set_strv("preload-engines", names);
+        /* The cache saves the synchronous registry query on startup. */
+        var cache = FbCache.get_default();
+        var engines = cache.lookup_engines(names);
+        if (engines == null) {
             engines = m_bus.get_engines_by_names(names);
+
+            /* Fedora internal patch could save engines not in simple.xml
+             * likes 'xkb:cn::chi'.
+             * The fallback is cached with the requested names so that
+             * the registry is not queried again.
+             */
+            if (engines.length == 0) {
+                string[] fallback_names =  {"xkb:us::eng"};
+                if (compose_index < 0) {
+                    m_settings_general.set_strv("preload-engines",
+                                                fallback_names);
+                }
+                engines = m_bus.get_engines_by_names(fallback_names);
+            }
+            if (engines.length > 0)
+                cache.store_engines(names, engines);
+        }
+
+        if (compose_index >= 0) {
+            IBus.EngineDesc[] with_compose = {};
+            for (int i = 0; i < engines.length; i++) {
+                if (i == compose_index)
+                    with_compose += create_compose_engine();
+                with_compose += engines[i];
+            }
+            if (compose_index >= engines.length)
+                with_compose += create_compose_engine();
+            engines = with_compose;
         }
 
         if (m_engines.length == 0) {
@@ -231,35 +287,131 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
         }
     }
 
-    private void bind_switch_shortcut() {
-        string[] accelerators = m_settings_hotkey.get_strv("triggers");
-        m_bindings = new GLib.List<Keybinding>();
-        foreach (var accelerator in accelerators) {
-            if (accelerator == "<Super>space") {
-                Keybinding keybinding =
-                        new Keybinding(IBus.KEY_space,
-                                       IBus.ModifierType.SUPER_MASK);
-                m_bindings.append(keybinding);
-            }
-            if (accelerator == "<Control>space") {
-                Keybinding keybinding =
-                        new Keybinding(IBus.KEY_space,
-                                       IBus.ModifierType.CONTROL_MASK);
-                m_bindings.append(keybinding);
+    /* The same desc is returned so that the switcher cache which
+     * compares the pointers is not rebuilt.
+     */
+    private IBus.EngineDesc create_compose_engine() {
+        if (m_compose_engine == null) {
+            m_compose_engine = new IBus.EngineDesc(
+                    COMPOSE_ENGINE_NAME,
+                    "Compose",
+                    "Dead keys and Compose sequences",
+                    "",
+                    "GPL",
+                    "",
+                    "",
+                    "default");
+        }
+        return m_compose_engine;
+    }
+
+    private static uint hotkey_hash_key(uint32 keyval,
+                                        uint32 modifiers) {
+        uint32 key = keyval & HOTKEY_KEYVAL_MASK;
+        for (int i = 0; i < HOTKEY_MODIFIERS.length; i++) {
+            if ((modifiers & HOTKEY_MODIFIERS[i]) != 0)
+                key |= (uint32) 1 << (25 + i);
+        }
+        return key;
+    }
+
+    /* Parse the IBus accelerator syntax likes "<Control><Shift>space". */
+    private static bool parse_accelerator(string     accelerator,
+                                          out uint32 keyval,
+                                          out uint32 modifiers) {
+        keyval = 0;
+        modifiers = 0;
+
+        string rest = accelerator.strip();
+        while (rest.has_prefix("<")) {
+            int end = rest.index_of_char('>');
+            if (end < 0)
+                return false;
+            switch (rest.substring(1, end - 1).down()) {
+            case "shift":
+                modifiers |= IBus.ModifierType.SHIFT_MASK;
+                break;
+            case "control":
+            case "ctrl":
+            case "ctl":
+            case "primary":
+                modifiers |= IBus.ModifierType.CONTROL_MASK;
+                break;
+            case "alt":
+            case "mod1":
+                modifiers |= IBus.ModifierType.MOD1_MASK;
+                break;
+            case "super":
+                modifiers |= IBus.ModifierType.SUPER_MASK;
+                break;
+            case "hyper":
+                modifiers |= IBus.ModifierType.HYPER_MASK;
+                break;
+            case "meta":
+                modifiers |= IBus.ModifierType.META_MASK;
+                break;
+            case "release":
+                modifiers |= IBus.ModifierType.RELEASE_MASK;
+                break;
+            default:
+                return false;
             }
-            if (accelerator == "<Ctrl>space") {
-                Keybinding keybinding =
-                        new Keybinding(IBus.KEY_space,
-                                       IBus.ModifierType.CONTROL_MASK);
-                m_bindings.append(keybinding);
+            rest = rest.substring(end + 1);
+        }
+
+        if (rest == "")
+            return false;
+        keyval = IBus.keyval_from_name(rest);
+        if (keyval == 0 || keyval == IBus.KEY_VoidSymbol)
+            return false;
+        /* control_key_to_keyval() returns the lower case keyvals. */
+        if (keyval >= IBus.KEY_A && keyval <= IBus.KEY_Z)
+            keyval += IBus.KEY_a - IBus.KEY_A;
+        return true;
+    }
+
+    private void add_hotkey(uint32       keyval,
+                            uint32       modifiers,
+                            HotkeyAction action) {
+        uint key = hotkey_hash_key(keyval, modifiers);
+        if (m_hotkeys.contains(key))
+            return;
+        m_hotkeys.insert(key, new Keybinding(keyval, modifiers, action));
+    }
+
+    private void bind_hotkeys_for_key(string       key,
+                                      HotkeyAction action) {
+        if (!m_settings_hotkey.settings_schema.has_key(key))
+            return;
+        foreach (var accelerator in m_settings_hotkey.get_strv(key)) {
+            uint32 keyval;
+            uint32 modifiers;
+            if (!parse_accelerator(accelerator, out keyval, out modifiers)) {
+                warning("Invalid accelerator %s in %s", accelerator, key);
+                continue;
             }
+            add_hotkey(keyval, modifiers, action);
         }
-        if (m_bindings.length() == 0) {
-            Keybinding keybinding =
-                    new Keybinding(IBus.KEY_space,
-                                   IBus.ModifierType.SUPER_MASK);
-            m_bindings.append(keybinding);
+    }
+
+    private void bind_hotkeys() {
+        m_hotkeys = new GLib.HashTable<uint, Keybinding>(GLib.direct_hash,
+                                                         GLib.direct_equal);
+        bind_hotkeys_for_key("triggers", HotkeyAction.TRIGGER);
+        if (m_hotkeys.size() == 0) {
+            add_hotkey(IBus.KEY_space,
+                       IBus.ModifierType.SUPER_MASK,
+                       HotkeyAction.TRIGGER);
         }
+        bind_hotkeys_for_key("next-engine-in-menu", HotkeyAction.NEXT_ENGINE);
+        bind_hotkeys_for_key("previous-engine", HotkeyAction.PREVIOUS_ENGINE);
+    }
+
+    private unowned Keybinding? lookup_hotkey(uint32 keyval,
+                                              uint32 modifiers) {
+        if (m_hotkeys == null)
+            return null;
+        return m_hotkeys.lookup(hotkey_hash_key(keyval, modifiers));
     }
 
     private void create_input_context() {
@@ -402,22 +554,6 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
         if (buff.get(0) != '\x1b' || buff.get(1) != '[')
             return false;
 
-        uint i = 0;
-        string delim = null;
-        for (; i < length; i++) {
-            delim = buff.substring(i);
-            if (delim.get(0) == ';')
-                break;
-        }
-        if (i < length) {
-            /* format is '\033[x;yR]' */
-            int x = int.parse(buff.substring(2));
-            int y = int.parse(delim.substring(1));
-            if (buff.get(length - 1) == 'R') {
-                cursor_position(x, y);
-                return true;
-            }
-        }
         switch (buff.get(2)) {
         case 'A':
             keyval = IBus.KEY_Up;
@@ -486,39 +622,52 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
                                       uint32 modifiers) {
         bool reverse = false;
         uint32 binding_modifiers = modifiers;
+        unowned Keybinding? binding = lookup_hotkey(keyval, modifiers);
 
         /* Shift+space cannot be received on terminal so all shift-mask
-         * keys are reverse shortcut keys.
+         * keys are reverse shortcut keys unless the accelerator has
+         * the shift modifier.
          */
         if ((binding_modifiers & IBus.ModifierType.SHIFT_MASK) != 0) {
-            reverse = true;
             binding_modifiers &= ~IBus.ModifierType.SHIFT_MASK;
+            if (binding == null) {
+                binding = lookup_hotkey(keyval, binding_modifiers);
+                reverse = true;
+            }
         }
 
-        foreach (var binding in m_bindings) {
-            if (binding.keyval == keyval &&
-                binding.modifiers == binding_modifiers) {
-                if (m_is_binding == BindingState.SINGLE_BINDING)
-                    m_is_binding = BindingState.DOUBLE_BINDING;
-                if (m_is_binding == BindingState.DOUBLE_BINDING) {
-                    if (!reverse)
-                        switcher_switch(m_engines, IBus.KEY_Right);
-                    else
-                        switcher_switch(m_engines, IBus.KEY_Left);
-                }
-                else if (m_engines.length > 1) {
-                    if (!reverse)
-                        switch_engine(1);
-                    else
-                        switch_engine(m_engines.length - 1);
-                    m_is_binding = BindingState.SINGLE_BINDING;
-                } else {
-                    user_warning(
-                            "Only one engine(%s) is configured so use ibus-setup or gsettings".
-                                    printf(m_engines[0].get_name()));
-                }
+        if (binding != null) {
+            if (binding.action == HotkeyAction.NEXT_ENGINE ||
+                binding.action == HotkeyAction.PREVIOUS_ENGINE) {
+                if (binding.action == HotkeyAction.PREVIOUS_ENGINE)
+                    reverse = !reverse;
+                if (m_is_binding == BindingState.DOUBLE_BINDING)
+                    switcher_switch(m_engines, IBus.KEY_Escape);
+                m_is_binding = BindingState.NO_BINDING;
+                if (m_engines.length > 1)
+                    switch_engine(reverse ? m_engines.length - 1 : 1);
                 return true;
             }
+            if (m_is_binding == BindingState.SINGLE_BINDING)
+                m_is_binding = BindingState.DOUBLE_BINDING;
+            if (m_is_binding == BindingState.DOUBLE_BINDING) {
+                if (!reverse)
+                    switcher_switch(m_engines, IBus.KEY_Right);
+                else
+                    switcher_switch(m_engines, IBus.KEY_Left);
+            }
+            else if (m_engines.length > 1) {
+                if (!reverse)
+                    switch_engine(1);
+                else
+                    switch_engine(m_engines.length - 1);
+                m_is_binding = BindingState.SINGLE_BINDING;
+            } else {
+                user_warning(
+                        "Only one engine(%s) is configured so use ibus-setup or gsettings".
+                                printf(m_engines[0].get_name()));
+            }
+            return true;
         }
 
         if (m_is_binding == BindingState.DOUBLE_BINDING) {
@@ -606,10 +755,13 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
             if (keycode == 0)
                 keycode = typed;
 
-            processed = m_ibuscontext.process_key_event(
-                    keyval,
-                    keycode,
-                    modifiers);
+            if (m_is_compose_engine)
+                processed = compose_key_event(keyval, modifiers);
+            else
+                processed = m_ibuscontext.process_key_event(
+                        keyval,
+                        keycode,
+                        modifiers);
 
             if (is_control) {
                 if (!processed) {
@@ -630,10 +782,11 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
                 }
             }
 
-            m_ibuscontext.process_key_event(
-                keyval,
-                keycode,
-                modifiers | IBus.ModifierType.RELEASE_MASK);
+            if (!m_is_compose_engine)
+                m_ibuscontext.process_key_event(
+                    keyval,
+                    keycode,
+                    modifiers | IBus.ModifierType.RELEASE_MASK);
         }
 
         if (j == 0)
@@ -641,9 +794,52 @@ class IBusFbContext : GLib.InitiallyUnowned, FbContext {
         return j;
     }
 
+    /* No D-Bus calls while the compose engine is selected. */
+    private bool compose_key_event(uint keyval,
+                                   uint modifiers) {
+        unowned string? output = null;
+
+        switch (m_compose.process_key(keyval, modifiers, out output)) {
+        case FbComposeStatus.IGNORED:
+            return false;
+        case FbComposeStatus.COMMITTED:
+            commit(new IBus.Text.from_string(output));
+            break;
+        default:
+            break;
+        }
+        return true;
+    }
+
+    private bool is_modifier_keyval(uint keyval) {
+        return (keyval >= IBus.KEY_Shift_L && keyval <= IBus.KEY_Hyper_R) ||
+               keyval == IBus.KEY_ISO_Level3_Shift;
+    }
+
+    /* Called in the raw keyboard mode instead of filter_keypress()
+     * with the exact key events so the guesses of the escape sequences
+     * are not needed.
+     */
+    public bool process_key_event(uint keyval,
+                                  uint keycode,
+                                  uint modifiers) {
+        if ((modifiers & IBus.ModifierType.RELEASE_MASK) == 0 &&
+            !is_modifier_keyval(keyval)) {
+            uint32 state = modifiers & ~(IBus.ModifierType.LOCK_MASK |
+                                         IBus.ModifierType.MOD2_MASK);
+            if (handle_engine_switch(keyval, state))
+                return true;
+        }
+
+        if (m_is_compose_engine)
+            return compose_key_event(keyval, modifiers);
+        return m_ibuscontext.process_key_event(keyval, keycode, modifiers);
+    }
+
     public void load_settings () {
         update_engines(m_settings_general.get_strv("preload-engines"),
                        m_settings_general.get_strv("engines-order"));
-        bind_switch_shortcut();
+        if (m_hotkeys == null)
+            bind_hotkeys();
     }
 }
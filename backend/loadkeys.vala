@@ -27,7 +27,8 @@ class Loadkeys
     public Loadkeys() {
     }
 
-    public void set_layout(IBus.EngineDesc engine) {
+    /* Returns true if loadkeys changed the console keymap. */
+    public bool set_layout(IBus.EngineDesc engine) {
         string layout = engine.get_layout();
         string variant = engine.get_layout_variant();
 
@@ -38,11 +39,11 @@ class Loadkeys
          * Some engines do not wish to change the current keymap.
          */
         if (layout == "default")
-            return;
+            return false;
 
         if (layout == "") {
             user_warning("Could not get the correct layout");
-            return;
+            return false;
         }
 
         /* format is under /lib/kbd/keymaps/xkb/*.map.gz */
@@ -68,11 +69,16 @@ class Loadkeys
                         engine.get_layout()));
         } catch (GLib.SpawnError e) {
             user_warning("Execute setxkbmap failed: %s".printf(e.message));
-            return;
+            return false;
         }
 
-        if (exit_status != 0)
+        if (exit_status != 0) {
             user_warning("Execute loadkeys failed: %s".printf(
                     standard_error ?? "(null)"));
+            return false;
+        }
+
+        FbCache.get_default().invalidate_keymap();
+        return true;
     }
 }
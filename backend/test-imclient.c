@@ -0,0 +1,331 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Runs FbImClient against a stand-in of fbterm on a socketpair and
+ * checks the imapi messages.  The context echoes the keys.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+#include <glib-object.h>
+#include <ibus.h>
+
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "fbcontext.h"
+#include "fbimclient.h"
+
+typedef struct {
+    GObject parent;
+    guint   n_load_settings;
+} TestContext;
+
+typedef struct {
+    GObjectClass parent;
+} TestContextClass;
+
+static void test_context_iface_init (FbContextIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (TestContext,
+                         test_context,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (TYPE_FB_CONTEXT,
+                                                test_context_iface_init));
+
+static void
+test_context_init (TestContext *context)
+{
+}
+
+static void
+test_context_class_init (TestContextClass *class)
+{
+}
+
+static guint
+test_context_filter_keypress (FbContext    *context,
+                              const gchar  *buff,
+                              guint         length,
+                              gchar       **dispatched)
+{
+    *dispatched = g_strndup (buff, length);
+    return length;
+}
+
+static void
+test_context_load_settings (FbContext *context)
+{
+    ((TestContext *)context)->n_load_settings++;
+}
+
+static gboolean
+test_context_process_key_event (FbContext *context,
+                                guint      keyval,
+                                guint      keycode,
+                                guint      modifiers)
+{
+    return FALSE;
+}
+
+static void
+test_context_iface_init (FbContextIface *iface)
+{
+    iface->filter_keypress = test_context_filter_keypress;
+    iface->load_settings = test_context_load_settings;
+    iface->process_key_event = test_context_process_key_event;
+}
+
+/* The client writes the messages synchronously in the callbacks. */
+static void
+flush_main_context (void)
+{
+    while (g_main_context_iteration (NULL, FALSE));
+}
+
+static void
+send_message (int          fd,
+              FbImMessage *message,
+              gsize        size)
+{
+    message->length = size;
+    g_assert_cmpint (write (fd, message, size), ==, size);
+    flush_main_context ();
+}
+
+static void
+send_type (int             fd,
+           FbImMessageType type)
+{
+    FbImMessage message;
+
+    memset (&message, 0, sizeof (message));
+    message.type = type;
+    send_message (fd, &message, sizeof (message));
+}
+
+/* Returns the next message or %NULL if the client sent nothing. */
+static FbImMessage *
+read_message (int fd)
+{
+    guint16 header[2];
+    FbImMessage *message;
+
+    flush_main_context ();
+    if (recv (fd, header, sizeof (header), MSG_PEEK | MSG_DONTWAIT) !=
+        sizeof (header)) {
+        return NULL;
+    }
+    g_assert_cmpuint (header[1], >=, FB_IM_MESSAGE_HEADER_SIZE);
+    message = g_malloc0 (MAX (header[1], sizeof (FbImMessage)));
+    g_assert_cmpint (read (fd, message, header[1]), ==, header[1]);
+    return message;
+}
+
+static FbImMessage *
+expect_message (int             fd,
+                FbImMessageType type)
+{
+    FbImMessage *message = read_message (fd);
+
+    g_assert_nonnull (message);
+    g_assert_cmpuint (message->type, ==, type);
+    return message;
+}
+
+static void
+expect_nothing (int fd)
+{
+    FbImMessage *message = read_message (fd);
+
+    if (message)
+        g_error ("Unexpected IM message: type %u", message->type);
+}
+
+static void
+expect_text (int          fd,
+             const gchar *text)
+{
+    FbImMessage *message = expect_message (fd, FB_IM_MESSAGE_PUT_TEXT);
+
+    g_assert_cmpuint (message->length - FB_IM_MESSAGE_HEADER_SIZE,
+                      ==,
+                      strlen (text));
+    g_assert_true (memcmp (message->texts, text, strlen (text)) == 0);
+    g_free (message);
+}
+
+static void
+expect_window (int          fd,
+               guint32      x,
+               guint32      y,
+               guint32      w,
+               const gchar *text)
+{
+    FbImMessage *message = expect_message (fd, FB_IM_MESSAGE_FILL_RECT);
+    gsize offset = G_STRUCT_OFFSET (FbImMessage, draw_text.texts);
+
+    g_assert_cmpuint (message->fill_rect.rect.x, ==, x);
+    g_assert_cmpuint (message->fill_rect.rect.y, ==, y);
+    g_assert_cmpuint (message->fill_rect.rect.w, ==, w);
+    g_assert_cmpuint (message->fill_rect.rect.h, ==, 16);
+    g_free (message);
+
+    message = expect_message (fd, FB_IM_MESSAGE_DRAW_TEXT);
+    g_assert_cmpuint (message->draw_text.x, ==, x);
+    g_assert_cmpuint (message->draw_text.y, ==, y);
+    g_assert_cmpuint (message->draw_text.fc, ==, FB_IM_COLOR_BLACK);
+    g_assert_cmpuint (message->draw_text.bc, ==, FB_IM_COLOR_GRAY);
+    g_assert_cmpuint (message->length - offset, ==, strlen (text));
+    g_assert_true (memcmp (message->draw_text.texts,
+                           text,
+                           strlen (text)) == 0);
+    g_free (message);
+}
+
+static void
+set_preedit (FbContext   *context,
+             const gchar *text)
+{
+    g_signal_emit_by_name (context,
+                           "preedit-changed",
+                           ibus_text_new_from_string (text),
+                           (guint) g_utf8_strlen (text, -1),
+                           TRUE);
+}
+
+static void
+forward_key (FbContext *context,
+             guint      keyval,
+             guint      state)
+{
+    g_signal_emit_by_name (context, "forward-key-event", keyval, 0, state);
+}
+
+static void
+test_protocol (void)
+{
+    TestContext *context;
+    FbImClient *client;
+    FbImMessage message;
+    FbImMessage *reply;
+    int fds[2];
+
+    g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+    context = g_object_new (test_context_get_type (), NULL);
+    client = fb_im_client_new (fds[0], FB_CONTEXT (context));
+    g_object_ref_sink (client);
+
+    reply = expect_message (fds[1], FB_IM_MESSAGE_CONNECT);
+    g_assert_cmpuint (reply->length, ==, sizeof (FbImMessage));
+    g_assert_cmpint (reply->raw, ==, 0);
+    g_free (reply);
+
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_FBTERM_INFO;
+    message.info.font_height = 16;
+    message.info.font_width = 8;
+    message.info.screen_height = 480;
+    message.info.screen_width = 640;
+    send_message (fds[1], &message, sizeof (message));
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_SET_CURSOR;
+    message.cursor.x = 80;
+    message.cursor.y = 160;
+    send_message (fds[1], &message, sizeof (message));
+    send_type (fds[1], FB_IM_MESSAGE_ACTIVE);
+    g_assert_cmpuint (context->n_load_settings, ==, 1);
+    expect_nothing (fds[1]);
+
+    /* The windows are not drawn until they are acknowledged. */
+    set_preedit (FB_CONTEXT (context), "abc");
+    reply = expect_message (fds[1], FB_IM_MESSAGE_SET_WINS);
+    g_assert_cmpuint (reply->length,
+                      ==,
+                      FB_IM_MESSAGE_HEADER_SIZE + sizeof (FbImWin));
+    g_assert_cmpuint (reply->wins[0].x, ==, 80);
+    g_assert_cmpuint (reply->wins[0].y, ==, 160);
+    g_assert_cmpuint (reply->wins[0].w, ==, 24);
+    g_assert_cmpuint (reply->wins[0].h, ==, 16);
+    g_free (reply);
+    expect_nothing (fds[1]);
+    send_type (fds[1], FB_IM_MESSAGE_ACK_WINS);
+    expect_window (fds[1], 80, 160, 24, "abc");
+    expect_nothing (fds[1]);
+
+    /* The same window is redrawn without FB_IM_MESSAGE_SET_WINS. */
+    set_preedit (FB_CONTEXT (context), "\xe6\xbc\xa2" "a");
+    expect_window (fds[1], 80, 160, 24, "\xe6\xbc\xa2" "a");
+    expect_nothing (fds[1]);
+
+    g_signal_emit_by_name (context,
+                           "commit",
+                           ibus_text_new_from_string ("\xe6\xbc\xa2"));
+    expect_text (fds[1], "\xe6\xbc\xa2");
+
+    /* The forwarded keys are not truncated to a byte. */
+    forward_key (FB_CONTEXT (context), IBUS_KEY_Left, 0);
+    expect_text (fds[1], "\033[D");
+    forward_key (FB_CONTEXT (context), IBUS_KEY_eacute, 0);
+    expect_text (fds[1], "\xc3\xa9");
+    forward_key (FB_CONTEXT (context), IBUS_KEY_a, IBUS_MOD1_MASK);
+    expect_text (fds[1], "\033a");
+    forward_key (FB_CONTEXT (context), IBUS_KEY_a, IBUS_RELEASE_MASK);
+    expect_nothing (fds[1]);
+
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_TERM_MODE;
+    message.term.cursor_esc_o = 1;
+    send_message (fds[1], &message, sizeof (message));
+    forward_key (FB_CONTEXT (context), IBUS_KEY_Left, 0);
+    expect_text (fds[1], "\033OD");
+
+    memset (&message, 0, sizeof (message));
+    message.type = FB_IM_MESSAGE_SEND_KEY;
+    message.keys[0] = 'a';
+    send_message (fds[1], &message, FB_IM_MESSAGE_HEADER_SIZE + 1);
+    expect_text (fds[1], "a");
+
+    send_type (fds[1], FB_IM_MESSAGE_PING);
+    g_free (expect_message (fds[1], FB_IM_MESSAGE_ACK_PING));
+
+    send_type (fds[1], FB_IM_MESSAGE_HIDE_UI);
+    reply = expect_message (fds[1], FB_IM_MESSAGE_SET_WINS);
+    g_assert_cmpuint (reply->length, ==, FB_IM_MESSAGE_HEADER_SIZE);
+    g_free (reply);
+    send_type (fds[1], FB_IM_MESSAGE_ACK_WINS);
+    expect_nothing (fds[1]);
+
+    ibus_object_destroy (IBUS_OBJECT (client));
+    g_object_unref (client);
+    g_object_unref (context);
+    close (fds[0]);
+    close (fds[1]);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/fbimclient/protocol", test_protocol);
+    return g_test_run ();
+}
@@ -0,0 +1,186 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Feeds the sequences of fb_vt_repaint() into another FbVt and checks
+ * that the screen models are the same.  The shells switch the screen
+ * with the sequences.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <string.h>
+
+#include "fbscrollback.h"
+#include "fbvt.h"
+
+#define ROWS 6
+#define COLS 20
+
+static const gchar screen_a[] =
+    "\033[H\033[J"
+    "plain text\r\n"
+    "\033[1;31mbold\033[0m and \033[4mline\033[0m\r\n"
+    "\xe6\xbc\xa2\xe5\xad\x97 wide\r\n"
+    "\033[44m   \033[0m blue\r\n"
+    "\033[6;15Hcorner"
+    "\033[3;5H\033[7m";
+
+static const gchar screen_b[] =
+    "\033[H\033[J"
+    "other text here\r\n"
+    "x\xe6\xbc\xa2y\r\n"
+    "\r\n"
+    "\033[42mgreen line\033[0m\r\n"
+    "\033[?25l\033[1;1H";
+
+static FbVt *
+new_vt (const gchar *screen)
+{
+    FbVt *vt = fb_vt_new ();
+
+    fb_vt_resize (vt, ROWS, COLS);
+    if (screen != NULL)
+        fb_vt_feed (vt, screen, strlen (screen));
+    return vt;
+}
+
+/* Compares the cells, the cursor and the current attribute which
+ * the next character is drawn with.
+ */
+static void
+assert_vt_equal (FbVt *vt,
+                 FbVt *expected)
+{
+    GString *line = g_string_new (NULL);
+    GString *expected_line = g_string_new (NULL);
+    int row, col, expected_row, expected_col;
+
+    fb_vt_get_cursor (vt, &row, &col);
+    fb_vt_get_cursor (expected, &expected_row, &expected_col);
+    g_assert_cmpint (row, ==, expected_row);
+    g_assert_cmpint (col, ==, expected_col);
+
+    fb_vt_feed (vt, "#", 1);
+    fb_vt_feed (expected, "#", 1);
+    for (row = 0; row < ROWS; row++) {
+        g_string_truncate (line, 0);
+        g_string_truncate (expected_line, 0);
+        fb_vt_append_row (vt, row, line);
+        fb_vt_append_row (expected, row, expected_line);
+        g_assert_cmpstr (line->str, ==, expected_line->str);
+    }
+
+    g_string_free (line, TRUE);
+    g_string_free (expected_line, TRUE);
+}
+
+static void
+test_repaint_diff (void)
+{
+    FbVt *vt_a = new_vt (screen_a);
+    FbVt *vt_b = new_vt (screen_b);
+    FbVt *displayed = new_vt (screen_b);
+    GString *output = g_string_new (NULL);
+
+    /* Repaint A over B and back B over A. */
+    fb_vt_repaint (vt_a, vt_b, output);
+    fb_vt_feed (displayed, output->str, output->len);
+    assert_vt_equal (displayed, vt_a);
+
+    g_string_truncate (output, 0);
+    fb_vt_repaint (vt_b, displayed, output);
+    fb_vt_feed (displayed, output->str, output->len);
+    assert_vt_equal (displayed, vt_b);
+
+    g_string_free (output, TRUE);
+    fb_vt_free (vt_a);
+    fb_vt_free (vt_b);
+    fb_vt_free (displayed);
+}
+
+static void
+test_repaint_clear (void)
+{
+    FbVt *vt_a = new_vt (screen_a);
+    FbVt *vt_b = new_vt (screen_b);
+    FbVt *expected = new_vt (screen_a);
+    GString *output = g_string_new (NULL);
+
+    /* The screen is cleared without the displayed screen. */
+    fb_vt_repaint (vt_a, NULL, output);
+    fb_vt_feed (vt_b, output->str, output->len);
+    assert_vt_equal (vt_b, expected);
+
+    g_string_free (output, TRUE);
+    fb_vt_free (vt_a);
+    fb_vt_free (vt_b);
+    fb_vt_free (expected);
+}
+
+static void
+test_feed_split (void)
+{
+    FbVt *vt = new_vt (NULL);
+    FbVt *expected = new_vt (screen_a);
+    gsize i;
+
+    /* The escape sequences and the UTF-8 characters are split. */
+    for (i = 0; i < strlen (screen_a); i++)
+        fb_vt_feed (vt, &screen_a[i], 1);
+    assert_vt_equal (vt, expected);
+
+    fb_vt_free (vt);
+    fb_vt_free (expected);
+}
+
+static void
+test_scrollback (void)
+{
+    static const gchar lines[] = "1\r\n2\r\n3\r\n4\r\n5\r\n6\r\n7\r\n8";
+    FbVt *vt = new_vt (NULL);
+    FbScrollback *scrollback = fb_scrollback_new ();
+    GString *line = g_string_new (NULL);
+
+    fb_vt_set_scrollback (vt, scrollback);
+    fb_vt_feed (vt, lines, strlen (lines));
+    g_assert_cmpuint (fb_scrollback_get_n_lines (scrollback), ==, 8 - ROWS);
+    g_assert_true (fb_scrollback_get_line (scrollback, 0, line));
+    g_assert_cmpstr (line->str, ==, "1");
+    g_string_truncate (line, 0);
+    fb_vt_append_row (vt, 0, line);
+    g_assert_cmpstr (line->str, ==, "3");
+
+    g_string_free (line, TRUE);
+    fb_vt_free (vt);
+    fb_scrollback_free (scrollback);
+}
+
+int
+main (int argc, char *argv[])
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/fbvt/repaint-diff", test_repaint_diff);
+    g_test_add_func ("/fbvt/repaint-clear", test_repaint_clear);
+    g_test_add_func ("/fbvt/feed-split", test_feed_split);
+    g_test_add_func ("/fbvt/scrollback", test_scrollback);
+    return g_test_run ();
+}
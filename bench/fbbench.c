@@ -0,0 +1,470 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <ftw.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "fbbench.h"
+
+#define ENGINE_NAME         "fbbench"
+#define COMPONENT_NAME      "org.freedesktop.IBus.FbBench"
+#define CANDIDATE_COUNT     45
+#define CANDIDATE_PAGE_SIZE 9
+
+/*
+ * The deterministic engine
+ */
+typedef struct {
+    IBusEngine       parent;
+    GString         *preedit;
+    IBusLookupTable *table;
+    gboolean         table_visible;
+} FbBenchEngine;
+
+typedef struct {
+    IBusEngineClass parent;
+} FbBenchEngineClass;
+
+GType fb_bench_engine_get_type (void);
+
+G_DEFINE_TYPE (FbBenchEngine, fb_bench_engine, IBUS_TYPE_ENGINE);
+
+static const gchar *candidate_words[] = {
+    "漢字", "感じ", "幹事", "監事", "寛治", "莞爾", "完治", "換字", "冠辞",
+};
+
+static void
+fb_bench_engine_init (FbBenchEngine *engine)
+{
+    engine->preedit = g_string_new (NULL);
+    engine->table = g_object_ref_sink (
+            ibus_lookup_table_new (CANDIDATE_PAGE_SIZE, 0, TRUE, FALSE));
+}
+
+static void
+fb_bench_engine_destroy (FbBenchEngine *engine)
+{
+    if (engine->preedit) {
+        g_string_free (engine->preedit, TRUE);
+        engine->preedit = NULL;
+    }
+    g_clear_object (&engine->table);
+    IBUS_OBJECT_CLASS (fb_bench_engine_parent_class)->destroy (
+            IBUS_OBJECT (engine));
+}
+
+static void
+fb_bench_engine_update (FbBenchEngine *engine)
+{
+    IBusEngine *ibus_engine = IBUS_ENGINE (engine);
+    IBusText *text = ibus_text_new_from_string (engine->preedit->str);
+
+    ibus_text_append_attribute (text,
+                                IBUS_ATTR_TYPE_UNDERLINE,
+                                IBUS_ATTR_UNDERLINE_SINGLE,
+                                0, -1);
+    ibus_engine_update_preedit_text (ibus_engine,
+                                     text,
+                                     ibus_text_get_length (text),
+                                     engine->preedit->len > 0);
+    if (engine->table_visible)
+        ibus_engine_update_lookup_table (ibus_engine, engine->table, TRUE);
+    else
+        ibus_engine_hide_lookup_table (ibus_engine);
+}
+
+static void
+fb_bench_engine_show_candidates (FbBenchEngine *engine)
+{
+    int i;
+
+    ibus_lookup_table_clear (engine->table);
+    for (i = 0; i < CANDIDATE_COUNT; i++) {
+        gchar *word = g_strdup_printf (
+                "%s%d",
+                candidate_words[i % G_N_ELEMENTS (candidate_words)],
+                i + 1);
+        ibus_lookup_table_append_candidate (engine->table,
+                                            ibus_text_new_from_string (word));
+        g_free (word);
+    }
+    engine->table_visible = TRUE;
+}
+
+static void
+fb_bench_engine_commit (FbBenchEngine *engine)
+{
+    IBusText *text;
+
+    if (engine->table_visible) {
+        guint cursor = ibus_lookup_table_get_cursor_pos (engine->table);
+        text = ibus_lookup_table_get_candidate (engine->table, cursor);
+    } else {
+        text = ibus_text_new_from_string (engine->preedit->str);
+    }
+    ibus_engine_commit_text (IBUS_ENGINE (engine), text);
+}
+
+static gboolean
+fb_bench_engine_process_key_event (IBusEngine *ibus_engine,
+                                   guint       keyval,
+                                   guint       keycode,
+                                   guint       modifiers)
+{
+    FbBenchEngine *engine = (FbBenchEngine *) ibus_engine;
+
+    if (modifiers & IBUS_RELEASE_MASK)
+        return FALSE;
+    if (modifiers & (IBUS_CONTROL_MASK | IBUS_MOD1_MASK))
+        return FALSE;
+
+    if (keyval >= IBUS_KEY_a && keyval <= IBUS_KEY_z) {
+        g_string_append_c (engine->preedit, keyval);
+        engine->table_visible = FALSE;
+        fb_bench_engine_update (engine);
+        return TRUE;
+    }
+    if (engine->preedit->len == 0)
+        return FALSE;
+
+    switch (keyval) {
+    case IBUS_KEY_space:
+        if (engine->table_visible)
+            ibus_lookup_table_cursor_down (engine->table);
+        else
+            fb_bench_engine_show_candidates (engine);
+        break;
+    case IBUS_KEY_Page_Down:
+        if (engine->table_visible)
+            ibus_lookup_table_page_down (engine->table);
+        break;
+    case IBUS_KEY_Page_Up:
+        if (engine->table_visible)
+            ibus_lookup_table_page_up (engine->table);
+        break;
+    case IBUS_KEY_Return:
+        fb_bench_engine_commit (engine);
+        /* fall through */
+    case IBUS_KEY_Escape:
+        g_string_truncate (engine->preedit, 0);
+        engine->table_visible = FALSE;
+        break;
+    case IBUS_KEY_BackSpace:
+        g_string_truncate (engine->preedit, engine->preedit->len - 1);
+        engine->table_visible = FALSE;
+        break;
+    default:
+        return TRUE;
+    }
+    fb_bench_engine_update (engine);
+    return TRUE;
+}
+
+static void
+fb_bench_engine_class_init (FbBenchEngineClass *class)
+{
+    IBUS_OBJECT_CLASS (class)->destroy =
+            (IBusObjectDestroyFunc) fb_bench_engine_destroy;
+    IBUS_ENGINE_CLASS (class)->process_key_event =
+            fb_bench_engine_process_key_event;
+}
+
+int
+fb_bench_run_engine (void)
+{
+    IBusBus *bus;
+    IBusFactory *factory;
+    IBusComponent *component;
+
+    ibus_init ();
+    bus = ibus_bus_new ();
+    if (!ibus_bus_is_connected (bus)) {
+        g_printerr ("The engine cannot connect to %s\n", ibus_get_address ());
+        return 1;
+    }
+    g_signal_connect (bus, "disconnected", G_CALLBACK (ibus_quit), NULL);
+
+    factory = ibus_factory_new (ibus_bus_get_connection (bus));
+    ibus_factory_add_engine (factory, ENGINE_NAME, fb_bench_engine_get_type ());
+    component = ibus_component_new (COMPONENT_NAME,
+                                    "Benchmark engine",
+                                    VERSION,
+                                    "GPL",
+                                    "",
+                                    "",
+                                    "",
+                                    "");
+    ibus_component_add_engine (component,
+                               ibus_engine_desc_new (ENGINE_NAME,
+                                                     "FbBench",
+                                                     "Benchmark engine",
+                                                     "ja",
+                                                     "GPL",
+                                                     "",
+                                                     "",
+                                                     "default"));
+    ibus_bus_register_component (bus, component);
+    ibus_main ();
+    return 0;
+}
+
+static gboolean
+wait_for_path (const gchar *path,
+               int          timeout_ms)
+{
+    int i;
+
+    for (i = 0; i < timeout_ms / 10; i++) {
+        if (g_file_test (path, G_FILE_TEST_EXISTS))
+            return TRUE;
+        g_usleep (10000);
+    }
+    return FALSE;
+}
+
+static gboolean
+wait_for_engine (IBusBus *bus,
+                 int      timeout_ms)
+{
+    const gchar *names[] = { ENGINE_NAME, NULL };
+    int i;
+
+    for (i = 0; i < timeout_ms / 10; i++) {
+        IBusEngineDesc **engines = ibus_bus_get_engines_by_names (bus, names);
+        gboolean found = engines != NULL && engines[0] != NULL;
+        IBusEngineDesc **p;
+
+        for (p = engines; p && *p; p++)
+            g_object_unref (*p);
+        g_free (engines);
+        if (found)
+            return TRUE;
+        g_usleep (10000);
+    }
+    return FALSE;
+}
+
+static int
+remove_path (const char        *path,
+             const struct stat *sb,
+             int                type,
+             struct FTW        *ftw)
+{
+    return remove (path);
+}
+
+void
+fb_bench_write_all (int          fd,
+                    const gchar *buff,
+                    gsize        length)
+{
+    while (length) {
+        gssize retval = write (fd, buff, length);
+        if (retval < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        buff += retval;
+        length -= retval;
+    }
+}
+
+gint64
+fb_bench_drain_output (int fd,
+                       int quiet_ms,
+                       int timeout_ms)
+{
+    gint64 first = -1;
+    char buff[4096];
+
+    for (;;) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int retval = poll (&pfd, 1, first < 0 ? timeout_ms : quiet_ms);
+        gint64 now = g_get_monotonic_time ();
+        gssize length;
+
+        if (retval < 0 && errno == EINTR)
+            continue;
+        if (retval <= 0)
+            return first;
+        length = read (fd, buff, sizeof (buff));
+        if (length <= 0)
+            return first;
+        if (first < 0)
+            first = now;
+    }
+}
+
+static GPid
+spawn (gchar **argv)
+{
+    GError *error = NULL;
+    GPid pid = 0;
+
+    if (!g_spawn_async (NULL, argv, NULL,
+                        G_SPAWN_SEARCH_PATH | G_SPAWN_DO_NOT_REAP_CHILD,
+                        NULL, NULL, &pid, &error)) {
+        g_printerr ("Cannot run %s: %s\n", argv[0], error->message);
+        g_error_free (error);
+        return 0;
+    }
+    return pid;
+}
+
+void
+fb_bench_stop (GPid pid)
+{
+    if (pid <= 0)
+        return;
+    kill (pid, SIGTERM);
+    waitpid (pid, NULL, 0);
+}
+
+pid_t
+fb_bench_spawn_backend (const gchar *path,
+                        const gchar *shell,
+                        int          trace_fd,
+                        int         *master_fd)
+{
+    struct winsize size = { 25, 80, 0, 0 };
+    pid_t pid;
+
+    pid = forkpty (master_fd, NULL, NULL, &size);
+    if (pid != 0)
+        return pid;
+
+    if (trace_fd != -1) {
+        dup2 (trace_fd, FB_BENCH_TRACE_FD);
+        g_setenv ("IBUS_FBTERM_TRACE_FD",
+                  G_STRINGIFY (FB_BENCH_TRACE_FD), TRUE);
+    } else {
+        g_unsetenv ("IBUS_FBTERM_TRACE_FD");
+    }
+    g_setenv ("SHELL", shell, TRUE);
+    g_setenv ("IBUS_FBTERM_IDLE_TRIM", "0", TRUE);
+    g_unsetenv ("IBUS_FBTERM_SHELL_POOL");
+    g_unsetenv ("IBUS_FBTERM_KEYBOARD_MODE");
+    execl (path, path, NULL);
+    _exit (127);
+}
+
+gboolean
+fb_bench_env_setup (FbBenchEnv *env)
+{
+    GError *error = NULL;
+    gchar *path;
+    gchar *address;
+    gchar *self;
+    gchar *daemon_argv[5];
+    gchar *engine_argv[3];
+
+    memset (env, 0, sizeof (FbBenchEnv));
+
+    /* Keep the settings and the caches of the user. */
+    env->tmpdir = g_dir_make_tmp ("ibus-fbterm-bench-XXXXXX", &error);
+    if (env->tmpdir == NULL) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    path = g_build_filename (env->tmpdir, "config", NULL);
+    g_setenv ("XDG_CONFIG_HOME", path, TRUE);
+    g_free (path);
+    path = g_build_filename (env->tmpdir, "cache", NULL);
+    g_setenv ("XDG_CACHE_HOME", path, TRUE);
+    g_free (path);
+    path = g_build_filename (env->tmpdir, "config", "glib-2.0", "settings",
+                             NULL);
+    g_mkdir_with_parents (path, 0700);
+    g_free (path);
+    path = g_build_filename (env->tmpdir, "config", "glib-2.0", "settings",
+                             "keyfile", NULL);
+    g_file_set_contents (path,
+                         "[org/freedesktop/ibus/general]\n"
+                         "preload-engines=['" ENGINE_NAME "']\n",
+                         -1, NULL);
+    g_free (path);
+    g_setenv ("GSETTINGS_BACKEND", "keyfile", TRUE);
+
+    env->socket_path = g_build_filename (env->tmpdir, "ibus", NULL);
+    address = g_strdup_printf ("unix:path=%s", env->socket_path);
+    g_setenv ("IBUS_ADDRESS", address, TRUE);
+
+    daemon_argv[0] = "ibus-daemon";
+    daemon_argv[1] = "--panel=disable";
+    daemon_argv[2] = "--config=disable";
+    daemon_argv[3] = g_strdup_printf ("--address=%s", address);
+    daemon_argv[4] = NULL;
+    env->daemon_pid = spawn (daemon_argv);
+    g_free (daemon_argv[3]);
+    g_free (address);
+    if (env->daemon_pid == 0)
+        return FALSE;
+    if (!wait_for_path (env->socket_path, FB_BENCH_STARTUP_TIMEOUT)) {
+        g_printerr ("ibus-daemon does not listen on %s\n",
+                    env->socket_path);
+        return FALSE;
+    }
+
+    self = g_file_read_link ("/proc/self/exe", NULL);
+    if (self == NULL) {
+        g_printerr ("Cannot read /proc/self/exe\n");
+        return FALSE;
+    }
+    engine_argv[0] = self;
+    engine_argv[1] = "--engine";
+    engine_argv[2] = NULL;
+    env->engine_pid = spawn (engine_argv);
+    g_free (self);
+    if (env->engine_pid == 0)
+        return FALSE;
+
+    ibus_init ();
+    env->bus = ibus_bus_new ();
+    if (!ibus_bus_is_connected (env->bus) ||
+        !wait_for_engine (env->bus, FB_BENCH_STARTUP_TIMEOUT)) {
+        g_printerr ("The engine is not registered\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+void
+fb_bench_env_teardown (FbBenchEnv *env)
+{
+    fb_bench_stop (env->engine_pid);
+    g_clear_object (&env->bus);
+    fb_bench_stop (env->daemon_pid);
+    if (env->tmpdir)
+        nftw (env->tmpdir, remove_path, 16, FTW_DEPTH | FTW_PHYS);
+    g_clear_pointer (&env->socket_path, g_free);
+    g_clear_pointer (&env->tmpdir, g_free);
+}
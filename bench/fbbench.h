@@ -0,0 +1,124 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __FB_BENCH_H_
+#define __FB_BENCH_H_
+
+#include <glib.h>
+#include <ibus.h>
+#include <sys/types.h>
+
+G_BEGIN_DECLS
+
+/* The time to wait for the daemon, the engine and the first screen
+ * of the backend in milliseconds */
+#define FB_BENCH_STARTUP_TIMEOUT        10000
+/* The time without output after the backend starts in milliseconds */
+#define FB_BENCH_STARTUP_QUIET          500
+/* The fd of the trace pipe in the backend */
+#define FB_BENCH_TRACE_FD               3
+
+/* The environment which is shared by the benchmark programs */
+typedef struct {
+    gchar   *tmpdir;
+    gchar   *socket_path;
+    GPid     daemon_pid;
+    GPid     engine_pid;
+    IBusBus *bus;
+} FbBenchEnv;
+
+/**
+ * fb_bench_run_engine:
+ *
+ * Runs the deterministic engine "fbbench" until the bus is
+ * disconnected.  Lowercase letters are composed, space shows 45
+ * candidates in pages of 9, Page_Up and Page_Down move the pages,
+ * Return commits and Escape resets.  Other keys are not handled
+ * while the preedit is empty.
+ *
+ * Returns: The exit status of the process.
+ */
+int              fb_bench_run_engine               (void);
+
+/**
+ * fb_bench_env_setup:
+ * @env: A #FbBenchEnv
+ *
+ * Creates a temporary XDG_CONFIG_HOME and XDG_CACHE_HOME which preload
+ * "fbbench" and runs a private ibus-daemon and the engine.  The engine
+ * is the current program run with --engine.
+ *
+ * Returns: %TRUE if the engine is registered.
+ */
+gboolean         fb_bench_env_setup                (FbBenchEnv *env);
+
+/**
+ * fb_bench_env_teardown:
+ * @env: A #FbBenchEnv
+ *
+ * Stops the processes and removes the temporary directory.
+ */
+void             fb_bench_env_teardown             (FbBenchEnv *env);
+
+/**
+ * fb_bench_spawn_backend:
+ * @path: The path of ibus-fbterm-backend.
+ * @shell: The value of SHELL in the backend.
+ * @trace_fd: The write end of the trace pipe or -1.
+ * @master_fd: (out): The master of the pty of the backend.
+ *
+ * Runs the backend on a 25x80 pty.
+ *
+ * Returns: The process id or -1 if the pty is not created.
+ */
+pid_t            fb_bench_spawn_backend            (const gchar *path,
+                                                    const gchar *shell,
+                                                    int          trace_fd,
+                                                    int         *master_fd);
+
+/**
+ * fb_bench_stop:
+ * @pid: A process id.
+ *
+ * Terminates @pid and waits for it.
+ */
+void             fb_bench_stop                     (GPid         pid);
+
+void             fb_bench_write_all                (int          fd,
+                                                    const gchar *buff,
+                                                    gsize        length);
+
+/**
+ * fb_bench_drain_output:
+ * @fd: The master of the pty.
+ * @quiet_ms: The milliseconds without output which end the output.
+ * @timeout_ms: The milliseconds to wait for the first byte.
+ *
+ * Reads the output until nothing arrives for @quiet_ms.
+ *
+ * Returns: The monotonic time of the first byte or -1 if nothing
+ *          arrives in @timeout_ms.
+ */
+gint64           fb_bench_drain_output             (int          fd,
+                                                    int          quiet_ms,
+                                                    int          timeout_ms);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,306 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the latency from a key typed on the pty of the backend to
+ * the screen output.  A private ibus-daemon runs a deterministic
+ * engine in a child process and the backend writes the times of its
+ * stages to IBUS_FBTERM_TRACE_FD.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+#include <ibus.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "fbbench.h"
+#include "fbtrace.h"
+
+/* The time to wait for the first output of a key in milliseconds */
+#define OUTPUT_TIMEOUT      2000
+
+static const gchar *stage_names[] = {
+    "tty-read",
+    "key-filtered",
+    "preedit",
+    "lookup",
+    "commit",
+    "pty-write",
+    "pty-read",
+    "console-write",
+};
+G_STATIC_ASSERT (G_N_ELEMENTS (stage_names) == FB_TRACE_N_STAGES);
+
+/* The uppercase letters are not handled by the engine. */
+static const gchar *ascii_keys[] = {
+    "H", "E", "L", "L", "O", " ", "W", "O", "R", "L", "D", "\r", NULL
+};
+
+/* The lowercase letters are composed and the space converts them. */
+static const gchar *convert_keys[] = {
+    "k", "a", "n", "j", "i", " ", "\r", NULL
+};
+
+static const gchar *paging_keys[] = {
+    "k", "a", "n", " ",
+    "\033[6~", "\033[6~", "\033[6~", "\033[6~",
+    "\033[5~", "\033[5~", "\033[5~", "\033[5~",
+    "\r", NULL
+};
+
+typedef struct {
+    const gchar  *name;
+    const gchar **keys;
+} Script;
+
+static const Script scripts[] = {
+    { "ascii",   ascii_keys },
+    { "convert", convert_keys },
+    { "paging",  paging_keys },
+};
+
+typedef struct {
+    /* FB_TRACE_N_STAGES arrays of gint64 and the end-to-end array */
+    GArray *stages[FB_TRACE_N_STAGES];
+    GArray *total;
+    guint   timeouts;
+} Samples;
+
+typedef struct {
+    int     master_fd;
+    int     trace_fd;
+    int     quiet_ms;
+} Bench;
+
+static gchar   *opt_backend = BACKEND_PATH;
+static int      opt_iterations = 100;
+static int      opt_quiet_ms = 10;
+static gboolean opt_engine = FALSE;
+
+static const GOptionEntry entries[] = {
+    { "backend", 'b', 0, G_OPTION_ARG_FILENAME, &opt_backend,
+      "The path of ibus-fbterm-backend", "PATH" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations,
+      "The repeat count of each script", "N" },
+    { "quiet", 'q', 0, G_OPTION_ARG_INT, &opt_quiet_ms,
+      "The milliseconds without output which end a key", "MS" },
+    { "engine", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_engine,
+      "Run the engine", NULL },
+    { NULL }
+};
+
+static void
+read_trace (Bench   *bench,
+            gint64   start,
+            gint64  *stages)
+{
+    FbTraceEvent events[256];
+    gssize length;
+    int i;
+
+    for (i = 0; i < FB_TRACE_N_STAGES; i++)
+        stages[i] = -1;
+
+    while ((length = read (bench->trace_fd, events, sizeof (events))) > 0) {
+        for (i = 0; i < length / (gssize) sizeof (FbTraceEvent); i++) {
+            FbTraceEvent *event = &events[i];
+            if (event->stage >= FB_TRACE_N_STAGES || event->time < start)
+                continue;
+            if (stages[event->stage] < 0)
+                stages[event->stage] = event->time - start;
+        }
+    }
+}
+
+static void
+run_script (Bench        *bench,
+            const Script *script,
+            Samples      *samples)
+{
+    const gchar **key;
+    int n;
+
+    for (n = 0; n < opt_iterations; n++) {
+        for (key = script->keys; *key; key++) {
+            gint64 stages[FB_TRACE_N_STAGES];
+            gint64 start;
+            gint64 first;
+            int i;
+
+            start = g_get_monotonic_time ();
+            fb_bench_write_all (bench->master_fd, *key, strlen (*key));
+            first = fb_bench_drain_output (bench->master_fd,
+                                           bench->quiet_ms,
+                                           OUTPUT_TIMEOUT);
+            read_trace (bench, start, stages);
+
+            if (first < 0) {
+                samples->timeouts++;
+                continue;
+            }
+            first -= start;
+            g_array_append_val (samples->total, first);
+            for (i = 0; i < FB_TRACE_N_STAGES; i++) {
+                if (stages[i] >= 0)
+                    g_array_append_val (samples->stages[i], stages[i]);
+            }
+        }
+    }
+}
+
+static gint
+compare_time (gconstpointer a,
+              gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a;
+    gint64 y = *(const gint64 *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* The nearest rank of @q in the sorted @times */
+static gint64
+percentile (GArray *times,
+            double  q)
+{
+    gsize rank = (gsize) (q * times->len + 0.999999);
+
+    rank = CLAMP (rank, 1, times->len);
+    return g_array_index (times, gint64, rank - 1);
+}
+
+static void
+print_times (const gchar *script,
+             const gchar *stage,
+             GArray      *times)
+{
+    if (times->len == 0)
+        return;
+    g_array_sort (times, compare_time);
+    g_print ("%-8s %-14s %7u %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT
+             " %9" G_GINT64_FORMAT "\n",
+             script, stage, times->len,
+             percentile (times, 0.50),
+             percentile (times, 0.99),
+             percentile (times, 0.999));
+}
+
+static void
+print_samples (const Script *script,
+               Samples      *samples)
+{
+    int i;
+
+    for (i = 0; i < FB_TRACE_N_STAGES; i++)
+        print_times (script->name, stage_names[i], samples->stages[i]);
+    print_times (script->name, "end-to-end", samples->total);
+    if (samples->timeouts > 0) {
+        g_print ("%-8s %u keys had no output in %d ms\n",
+                 script->name, samples->timeouts, OUTPUT_TIMEOUT);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    FbBenchEnv env;
+    pid_t backend_pid = -1;
+    int trace_fds[2];
+    Bench bench = { -1, -1, 0 };
+    int retval = 1;
+    guint i;
+
+    context = g_option_context_new ("- measure the key latency");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    if (opt_engine)
+        return fb_bench_run_engine ();
+
+    if (!fb_bench_env_setup (&env))
+        goto out;
+
+    if (pipe2 (trace_fds, O_CLOEXEC) < 0) {
+        g_printerr ("pipe2: %s\n", g_strerror (errno));
+        goto out;
+    }
+    /* The backend sets O_NONBLOCK to the shared write end. */
+    fcntl (trace_fds[0], F_SETFL, O_NONBLOCK);
+    /* The line discipline of the shell echoes the keys. */
+    backend_pid = fb_bench_spawn_backend (opt_backend,
+                                          "/bin/cat",
+                                          trace_fds[1],
+                                          &bench.master_fd);
+    close (trace_fds[1]);
+    bench.trace_fd = trace_fds[0];
+    bench.quiet_ms = opt_quiet_ms;
+    if (backend_pid < 0) {
+        g_printerr ("forkpty: %s\n", g_strerror (errno));
+        goto out;
+    }
+
+    /* The context is created and the engine is enabled. */
+    if (fb_bench_drain_output (bench.master_fd,
+                               FB_BENCH_STARTUP_QUIET,
+                               FB_BENCH_STARTUP_TIMEOUT) < 0) {
+        g_printerr ("%s does not draw the screen\n", opt_backend);
+        goto out;
+    }
+
+    g_print ("%-8s %-14s %7s %9s %9s %9s\n",
+             "script", "stage", "count",
+             "p50[us]", "p99[us]", "p999[us]");
+    for (i = 0; i < G_N_ELEMENTS (scripts); i++) {
+        Samples samples = { { NULL, }, NULL, 0 };
+        int j;
+
+        for (j = 0; j < FB_TRACE_N_STAGES; j++)
+            samples.stages[j] = g_array_new (FALSE, FALSE, sizeof (gint64));
+        samples.total = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+        run_script (&bench, &scripts[i], &samples);
+        print_samples (&scripts[i], &samples);
+
+        for (j = 0; j < FB_TRACE_N_STAGES; j++)
+            g_array_unref (samples.stages[j]);
+        g_array_unref (samples.total);
+    }
+    retval = 0;
+
+out:
+    if (backend_pid > 0)
+        fb_bench_stop (backend_pid);
+    if (bench.master_fd != -1)
+        close (bench.master_fd);
+    if (bench.trace_fd != -1)
+        close (bench.trace_fd);
+    fb_bench_env_teardown (&env);
+    return retval;
+}
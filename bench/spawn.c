@@ -0,0 +1,266 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Compares forkpty() and posix_spawn() with POSIX_SPAWN_SETSID as
+ * fb_shell_create_shell_process() runs the shells.  Each method runs
+ * in its own process which touches a ballast of memory in place of
+ * the mappings of the backend, and spawns a short command on a new pty
+ * repeatedly.  The time until the spawn returns, the time until
+ * the child is reaped and the peak RSS are printed.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+extern char **environ;
+
+typedef pid_t (*SpawnFunc) (const gchar *command,
+                            int         *master_fd);
+
+typedef struct {
+    const gchar *name;
+    SpawnFunc    spawn;
+} Method;
+
+static gchar   *opt_command = "/bin/true";
+static int      opt_iterations = 200;
+static int      opt_ballast = 256;
+
+static const GOptionEntry entries[] = {
+    { "command", 'c', 0, G_OPTION_ARG_FILENAME, &opt_command,
+      "The command which is spawned", "PATH" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations,
+      "The repeat count of each method", "N" },
+    { "ballast", 'm', 0, G_OPTION_ARG_INT, &opt_ballast,
+      "The MiB of the memory which is touched before the spawns", "MIB" },
+    { NULL }
+};
+
+static pid_t
+spawn_forkpty (const gchar *command,
+               int         *master_fd)
+{
+    pid_t pid;
+
+    pid = forkpty (master_fd, NULL, NULL, NULL);
+    if (pid == 0) {
+        execl (command, command, NULL);
+        _exit (127);
+    }
+    return pid;
+}
+
+#if HAVE_DECL_POSIX_SPAWN_SETSID
+static pid_t
+spawn_posix_spawn (const gchar *command,
+                   int         *master_fd)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    gchar *argv[] = { (gchar *) command, NULL };
+    const gchar *slave;
+    pid_t pid = -1;
+    int fd;
+    int retval;
+
+    fd = posix_openpt (O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (grantpt (fd) < 0 || unlockpt (fd) < 0 ||
+        (slave = ptsname (fd)) == NULL) {
+        close (fd);
+        return -1;
+    }
+
+    /* The child opens the slave as its controlling tty after setsid(). */
+    posix_spawn_file_actions_init (&actions);
+    posix_spawn_file_actions_addopen (&actions, STDIN_FILENO, slave,
+                                      O_RDWR, 0);
+    posix_spawn_file_actions_adddup2 (&actions, STDIN_FILENO, STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2 (&actions, STDIN_FILENO, STDERR_FILENO);
+    posix_spawnattr_init (&attr);
+    posix_spawnattr_setflags (&attr, POSIX_SPAWN_SETSID);
+
+    retval = posix_spawn (&pid, command, &actions, &attr, argv, environ);
+
+    posix_spawnattr_destroy (&attr);
+    posix_spawn_file_actions_destroy (&actions);
+    if (retval != 0) {
+        close (fd);
+        errno = retval;
+        return -1;
+    }
+    *master_fd = fd;
+    return pid;
+}
+#endif
+
+static const Method methods[] = {
+    { "forkpty",     spawn_forkpty },
+#if HAVE_DECL_POSIX_SPAWN_SETSID
+    { "posix_spawn", spawn_posix_spawn },
+#endif
+};
+
+static gint
+compare_time (gconstpointer a,
+              gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a;
+    gint64 y = *(const gint64 *) b;
+
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* The nearest rank of @q in the sorted @times */
+static gint64
+percentile (GArray *times,
+            double  q)
+{
+    gsize rank = (gsize) (q * times->len + 0.999999);
+
+    rank = CLAMP (rank, 1, times->len);
+    return g_array_index (times, gint64, rank - 1);
+}
+
+static void
+print_times (const gchar *method,
+             const gchar *stage,
+             GArray      *times)
+{
+    if (times->len == 0)
+        return;
+    g_array_sort (times, compare_time);
+    g_print ("%-12s %-8s %7u %9" G_GINT64_FORMAT " %9" G_GINT64_FORMAT
+             " %9" G_GINT64_FORMAT "\n",
+             method, stage, times->len,
+             percentile (times, 0.50),
+             percentile (times, 0.99),
+             g_array_index (times, gint64, times->len - 1));
+}
+
+/* Runs in a child process so that the peak RSS is of @method only. */
+static int
+run_method (const Method *method)
+{
+    GArray *returned = g_array_new (FALSE, FALSE, sizeof (gint64));
+    GArray *reaped = g_array_new (FALSE, FALSE, sizeof (gint64));
+    gsize ballast_size = (gsize) MAX (opt_ballast, 0) * 1024 * 1024;
+    gchar *ballast;
+    struct rusage self_usage;
+    struct rusage children_usage;
+    int n;
+
+    /* The pages are resident and the fork copies their page tables. */
+    ballast = g_malloc (MAX (ballast_size, 1));
+    memset (ballast, 1, ballast_size);
+
+    for (n = 0; n < opt_iterations; n++) {
+        gint64 start;
+        gint64 time;
+        int master_fd = -1;
+        int status;
+        pid_t pid;
+
+        start = g_get_monotonic_time ();
+        pid = method->spawn (opt_command, &master_fd);
+        time = g_get_monotonic_time () - start;
+        if (pid < 0) {
+            g_printerr ("%s: %s\n", method->name, g_strerror (errno));
+            return 1;
+        }
+        g_array_append_val (returned, time);
+
+        while (waitpid (pid, &status, 0) < 0 && errno == EINTR);
+        time = g_get_monotonic_time () - start;
+        g_array_append_val (reaped, time);
+        close (master_fd);
+    }
+
+    getrusage (RUSAGE_SELF, &self_usage);
+    getrusage (RUSAGE_CHILDREN, &children_usage);
+    print_times (method->name, "return", returned);
+    print_times (method->name, "reap", reaped);
+    /* The forked child counts the pages which it shares with this
+     * process until it executes the command.
+     */
+    g_print ("%-12s maxrss self %ld KiB, children %ld KiB\n",
+             method->name, self_usage.ru_maxrss, children_usage.ru_maxrss);
+
+    g_free (ballast);
+    g_array_unref (returned);
+    g_array_unref (reaped);
+    fflush (stdout);
+    return 0;
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    int retval = 0;
+    guint i;
+
+    context = g_option_context_new ("- compare forkpty and posix_spawn");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free (context);
+
+#if !HAVE_DECL_POSIX_SPAWN_SETSID
+    g_print ("POSIX_SPAWN_SETSID is not available and "
+             "only forkpty is measured.\n");
+#endif
+    g_print ("%-12s %-8s %7s %9s %9s %9s\n",
+             "method", "stage", "count", "p50[us]", "p99[us]", "max[us]");
+    for (i = 0; i < G_N_ELEMENTS (methods); i++) {
+        int status;
+        pid_t pid;
+
+        /* The child exits with _exit() and flushes only its own lines. */
+        fflush (stdout);
+        pid = fork ();
+        if (pid < 0) {
+            g_printerr ("fork: %s\n", g_strerror (errno));
+            return 1;
+        }
+        if (pid == 0)
+            _exit (run_method (&methods[i]));
+        while (waitpid (pid, &status, 0) < 0 && errno == EINTR);
+        if (!WIFEXITED (status) || WEXITSTATUS (status) != 0)
+            retval = 1;
+    }
+    return retval;
+}
@@ -0,0 +1,456 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/*
+ * Copyright (C) 2015-2016 Takao Fujiwara <takao.fujiwara1@gmail.com>
+ * Copyright (C) 2015-2016 Red Hat, Inc.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Measures the throughput of the shell output through
+ * fb_io_ready() and fb_shell_ready_read() to the console.  The shell
+ * of the backend is this program which writes the workloads to its pty
+ * and the backend writes them to the pty of the harness.  The
+ * workloads are repeated while the preedit and the lookup table of
+ * the deterministic engine are shown.
+ */
+
+#include <config.h>
+
+#include <glib.h>
+#include <ibus.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include "fbbench.h"
+
+/* The fifo from which the shell reads the workloads */
+#define GENERATOR_ENV       "IBUS_FBTERM_BENCH_FIFO"
+#define SENTINEL            "\r\nFBBENCH-END\r\n"
+/* The shell waits for the backend to read the workload before it
+ * writes SENTINEL so that SENTINEL is read alone. */
+#define SENTINEL_DELAY      50000
+#define BLOCK_SIZE          65536
+/* The time to wait for the output of a workload in milliseconds */
+#define OUTPUT_TIMEOUT      10000
+#define KEY_QUIET           50
+
+typedef struct {
+    const gchar *name;
+    void       (*fill) (GString *block);
+    gsize        chunk;
+} Workload;
+
+typedef struct {
+    gint64  time;
+    guint64 syscalls;
+    guint64 ticks;
+} Usage;
+
+static void fill_ascii (GString *block);
+static void fill_cjk   (GString *block);
+static void fill_tui   (GString *block);
+
+static const Workload workloads[] = {
+    { "ascii", fill_ascii, 4096 },
+    { "cjk",   fill_cjk,   4096 },
+    { "tui",   fill_tui,   4096 },
+    { "small", fill_ascii, 16 },
+};
+
+/* The keys which show the preedit and the lookup table */
+static const gchar *overlay_keys[] = { "k", "a", "n", " ", NULL };
+
+static gchar   *opt_backend = BACKEND_PATH;
+static int      opt_size = 16;
+static int      opt_iterations = 3;
+static gboolean opt_engine = FALSE;
+
+static const GOptionEntry entries[] = {
+    { "backend", 'b', 0, G_OPTION_ARG_FILENAME, &opt_backend,
+      "The path of ibus-fbterm-backend", "PATH" },
+    { "size", 's', 0, G_OPTION_ARG_INT, &opt_size,
+      "The megabytes of each workload", "MB" },
+    { "iterations", 'n', 0, G_OPTION_ARG_INT, &opt_iterations,
+      "The repeat count of each workload", "N" },
+    { "engine", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &opt_engine,
+      "Run the engine", NULL },
+    { NULL }
+};
+
+/*
+ * The workloads
+ */
+static void
+fill_ascii (GString *block)
+{
+    static const gchar words[] =
+            "The quick brown fox jumps over the lazy dog 0123456789 ";
+    guint i = 0;
+
+    while (block->len < BLOCK_SIZE) {
+        int col;
+        for (col = 0; col < 79; col++, i++)
+            g_string_append_c (block, words[i % (sizeof (words) - 1)]);
+        g_string_append (block, "\r\n");
+    }
+}
+
+static void
+fill_cjk (GString *block)
+{
+    static const gunichar chars[] = {
+        0x6f22, 0x5b57, 0x304b, 0x306a, 0x4ea4, 0x3058, 0x308a, 0x6587,
+        0x65e5, 0x672c, 0x8a9e, 0x30ab, 0x30bf, 0x30ab, 0x30ca, 0x3002,
+    };
+    guint i = 0;
+
+    while (block->len < BLOCK_SIZE) {
+        int col;
+        /* 39 double width characters fit in 80 columns. */
+        for (col = 0; col < 39; col++, i++)
+            g_string_append_unichar (block, chars[i % G_N_ELEMENTS (chars)]);
+        g_string_append (block, "\r\n");
+    }
+}
+
+/* Redraws of a status bar and colored panes like a full screen
+ * program */
+static void
+fill_tui (GString *block)
+{
+    guint frame = 0;
+
+    while (block->len < BLOCK_SIZE) {
+        int row;
+
+        g_string_append (block, "\033[?25l\033[H\033[7m");
+        g_string_append_printf (block, " frame %-8u", frame);
+        g_string_append (block, "\033[K\033[0m");
+        for (row = 2; row <= 24; row++) {
+            int col;
+            for (col = 1; col < 80; col += 20) {
+                g_string_append_printf (block,
+                                        "\033[%d;%dH\033[1;3%d;4%dm%-18.18s",
+                                        row, col,
+                                        (row + col + frame) % 8,
+                                        (row + frame) % 8,
+                                        "pane item text");
+            }
+            g_string_append (block, "\033[0m\033[K");
+        }
+        g_string_append (block, "\033[24;1H\033[?25h");
+        frame++;
+    }
+}
+
+/*
+ * The shell
+ */
+static void
+write_workload (const Workload *workload,
+                gsize           size)
+{
+    GString *block = g_string_sized_new (BLOCK_SIZE + 4096);
+    gsize offset = 0;
+
+    workload->fill (block);
+    while (size > 0) {
+        gsize length = MIN (MIN (workload->chunk, size),
+                            block->len - offset);
+
+        fb_bench_write_all (STDOUT_FILENO, block->str + offset, length);
+        offset = (offset + length) % block->len;
+        size -= length;
+    }
+    g_string_free (block, TRUE);
+
+    g_usleep (SENTINEL_DELAY);
+    fb_bench_write_all (STDOUT_FILENO, SENTINEL, strlen (SENTINEL));
+}
+
+static int
+run_shell (const gchar *fifo_path)
+{
+    struct termios attr;
+    FILE *fifo;
+    gchar line[256];
+
+    /* The workloads are forwarded without the CR of ONLCR. */
+    if (tcgetattr (STDOUT_FILENO, &attr) == 0) {
+        attr.c_oflag &= ~OPOST;
+        tcsetattr (STDOUT_FILENO, TCSANOW, &attr);
+    }
+    fifo = fopen (fifo_path, "r");
+    if (fifo == NULL)
+        return 1;
+
+    while (fgets (line, sizeof (line), fifo)) {
+        gchar name[64];
+        gsize size;
+        guint i;
+
+        if (sscanf (line, "%63s %zu", name, &size) != 2)
+            continue;
+        for (i = 0; i < G_N_ELEMENTS (workloads); i++) {
+            if (g_strcmp0 (workloads[i].name, name) == 0)
+                write_workload (&workloads[i], size);
+        }
+    }
+    fclose (fifo);
+    return 0;
+}
+
+/*
+ * The harness
+ */
+static gboolean
+read_usage (pid_t  pid,
+            Usage *usage)
+{
+    gchar *path;
+    gchar *contents = NULL;
+    gchar *p;
+    guint64 syscr = 0;
+    guint64 syscw = 0;
+    unsigned long utime = 0;
+    unsigned long stime = 0;
+    gboolean retval = FALSE;
+
+    usage->time = g_get_monotonic_time ();
+
+    /* syscr and syscw count read(), write() and the friends. */
+    path = g_strdup_printf ("/proc/%d/io", pid);
+    if (g_file_get_contents (path, &contents, NULL, NULL)) {
+        if ((p = strstr (contents, "syscr:")))
+            syscr = g_ascii_strtoull (p + strlen ("syscr:"), NULL, 10);
+        if ((p = strstr (contents, "syscw:")))
+            syscw = g_ascii_strtoull (p + strlen ("syscw:"), NULL, 10);
+        g_free (contents);
+    }
+    g_free (path);
+    usage->syscalls = syscr + syscw;
+
+    /* utime and stime are the 14th and 15th fields after comm. */
+    path = g_strdup_printf ("/proc/%d/stat", pid);
+    if (g_file_get_contents (path, &contents, NULL, NULL)) {
+        if ((p = strrchr (contents, ')')) &&
+            sscanf (p + 1,
+                    " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                    &utime, &stime) == 2) {
+            retval = TRUE;
+        }
+        g_free (contents);
+    }
+    g_free (path);
+    usage->ticks = utime + stime;
+    return retval;
+}
+
+static void
+type_keys (int           master_fd,
+           const gchar **keys)
+{
+    for (; *keys; keys++) {
+        fb_bench_write_all (master_fd, *keys, strlen (*keys));
+        fb_bench_drain_output (master_fd, KEY_QUIET, OUTPUT_TIMEOUT);
+    }
+}
+
+/* Reads the output until SENTINEL and returns the time of the last
+ * read before SENTINEL or -1 on the timeout.  SENTINEL_DELAY is not
+ * counted. */
+static gint64
+wait_for_sentinel (int master_fd)
+{
+    gsize sentinel_len = strlen (SENTINEL);
+    gchar buff[65536];
+    gsize kept = 0;
+    gint64 last = -1;
+
+    for (;;) {
+        struct pollfd pfd = { master_fd, POLLIN, 0 };
+        int retval = poll (&pfd, 1, OUTPUT_TIMEOUT);
+        gssize length;
+
+        if (retval < 0 && errno == EINTR)
+            continue;
+        if (retval <= 0)
+            return -1;
+        length = read (master_fd, buff + kept, sizeof (buff) - kept);
+        if (length <= 0)
+            return -1;
+        if (memmem (buff, kept + length, SENTINEL, sentinel_len))
+            return last >= 0 ? last : g_get_monotonic_time ();
+        last = g_get_monotonic_time ();
+
+        /* Keep the tail which may be the head of SENTINEL. */
+        length += kept;
+        kept = MIN ((gsize) length, sentinel_len - 1);
+        memmove (buff, buff + length - kept, kept);
+    }
+}
+
+static gboolean
+run_workload (int             master_fd,
+              FILE           *fifo,
+              pid_t           backend_pid,
+              const Workload *workload,
+              gboolean        overlay)
+{
+    gsize size = (gsize) opt_size * 1000000;
+    double mb = (double) size * opt_iterations / 1000000;
+    gint64 elapsed = 0;
+    guint64 syscalls = 0;
+    guint64 ticks = 0;
+    int i;
+
+    if (overlay)
+        type_keys (master_fd, overlay_keys);
+
+    for (i = 0; i < opt_iterations; i++) {
+        Usage start;
+        Usage end;
+        gint64 last;
+
+        read_usage (backend_pid, &start);
+        fprintf (fifo, "%s %zu\n", workload->name, size);
+        fflush (fifo);
+        last = wait_for_sentinel (master_fd);
+        if (last < 0) {
+            g_printerr ("%s: the output stopped\n", workload->name);
+            return FALSE;
+        }
+        if (!read_usage (backend_pid, &end)) {
+            g_printerr ("Cannot read /proc/%d/stat\n", backend_pid);
+            return FALSE;
+        }
+        elapsed += last - start.time;
+        syscalls += end.syscalls - start.syscalls;
+        ticks += end.ticks - start.ticks;
+    }
+
+    if (overlay) {
+        const gchar *reset_keys[] = { "\033", NULL };
+        type_keys (master_fd, reset_keys);
+    }
+
+    g_print ("%-8s %-8s %10.1f %12.1f %12.2f\n",
+             workload->name,
+             overlay ? "on" : "off",
+             mb / ((double) elapsed / G_USEC_PER_SEC),
+             syscalls / mb,
+             ticks * 1000.0 / sysconf (_SC_CLK_TCK) / mb);
+    return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    FbBenchEnv env;
+    const gchar *fifo_path;
+    gchar *path = NULL;
+    gchar *self = NULL;
+    FILE *fifo = NULL;
+    pid_t backend_pid = -1;
+    int master_fd = -1;
+    int retval = 1;
+    guint i;
+
+    /* The backend runs this program as the shell without arguments. */
+    if ((fifo_path = g_getenv (GENERATOR_ENV)) != NULL)
+        return run_shell (fifo_path);
+
+    context = g_option_context_new ("- measure the shell output throughput");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error)) {
+        g_printerr ("%s\n", error->message);
+        return 1;
+    }
+    g_option_context_free (context);
+
+    if (opt_engine)
+        return fb_bench_run_engine ();
+    if (opt_size <= 0 || opt_iterations <= 0) {
+        g_printerr ("--size and --iterations should be positive\n");
+        return 1;
+    }
+
+    if (!fb_bench_env_setup (&env))
+        goto out;
+
+    path = g_build_filename (env.tmpdir, "workload", NULL);
+    if (mkfifo (path, 0600) < 0) {
+        g_printerr ("mkfifo: %s\n", g_strerror (errno));
+        goto out;
+    }
+    g_setenv (GENERATOR_ENV, path, TRUE);
+    self = g_file_read_link ("/proc/self/exe", NULL);
+    backend_pid = fb_bench_spawn_backend (opt_backend,
+                                          self ? self : argv[0],
+                                          -1,
+                                          &master_fd);
+    g_unsetenv (GENERATOR_ENV);
+    if (backend_pid < 0) {
+        g_printerr ("forkpty: %s\n", g_strerror (errno));
+        goto out;
+    }
+
+    /* The context is created and the engine is enabled. */
+    if (fb_bench_drain_output (master_fd,
+                               FB_BENCH_STARTUP_QUIET,
+                               FB_BENCH_STARTUP_TIMEOUT) < 0) {
+        g_printerr ("%s does not draw the screen\n", opt_backend);
+        goto out;
+    }
+    /* Blocks until the shell opens the fifo. */
+    if ((fifo = fopen (path, "w")) == NULL) {
+        g_printerr ("%s: %s\n", path, g_strerror (errno));
+        goto out;
+    }
+
+    g_print ("%-8s %-8s %10s %12s %12s\n",
+             "workload", "overlay", "MB/s", "syscalls/MB", "CPU ms/MB");
+    for (i = 0; i < G_N_ELEMENTS (workloads); i++) {
+        if (!run_workload (master_fd, fifo, backend_pid,
+                           &workloads[i], FALSE) ||
+            !run_workload (master_fd, fifo, backend_pid,
+                           &workloads[i], TRUE)) {
+            goto out;
+        }
+    }
+    retval = 0;
+
+out:
+    /* The shell exits on EOF of the fifo. */
+    if (fifo)
+        fclose (fifo);
+    if (backend_pid > 0)
+        fb_bench_stop (backend_pid);
+    if (master_fd != -1)
+        close (master_fd);
+    fb_bench_env_teardown (&env);
+    g_free (self);
+    g_free (path);
+    return retval;
+}